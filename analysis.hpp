@@ -0,0 +1,323 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "pic1650.hpp"
+
+namespace pic1650 {
+
+// How control leaves a basic block
+enum class BlockExit : std::uint8_t {
+  Fallthrough, // into the block at the next address
+  Goto,
+  Call,     // to the callee, returning to the next address
+  Skip,     // to the next address or the one after
+  Return,   // RETLW
+  Computed, // a write to pc, through the jump table in `targets`
+  Unknown,  // a write to pc with no table found, or an illegal instruction
+};
+
+constexpr const char *to_string(const BlockExit exit) {
+  switch (exit) {
+  case BlockExit::Fallthrough:
+    return "fallthrough";
+  case BlockExit::Goto:
+    return "goto";
+  case BlockExit::Call:
+    return "call";
+  case BlockExit::Skip:
+    return "skip";
+  case BlockExit::Return:
+    return "return";
+  case BlockExit::Computed:
+    return "computed";
+  case BlockExit::Unknown:
+    break;
+  }
+  return "unknown";
+}
+
+struct BasicBlock {
+  std::uint16_t start{};
+  std::uint16_t length{};
+  BlockExit exit{BlockExit::Fallthrough};
+  // Every address control may continue at, the callee first for calls
+  std::vector<std::uint16_t> targets;
+};
+
+// A run of RETLW or GOTO instructions reached by writing pc
+struct JumpTable {
+  std::uint16_t jump{};
+  std::uint16_t first{};
+  std::uint16_t last{};
+};
+
+// The control flow of a program, as far as it can be followed from reset
+// without running it. Writes to pc are followed when they look like the
+// usual PIC table idioms: MOVWF F2 straight after a run of RETLWs, or ADDWF
+// F2 (or MOVWF F2 with no RETLWs before it) followed by a run of RETLWs or
+// GOTOs. Entries of such tables are data as far as the listing is concerned.
+struct ControlFlow {
+  static constexpr std::uint16_t reset_vector = 0x1ffu;
+
+  std::array<bool, 512> reachable{};
+  std::array<bool, 512> table_entry{};
+  std::array<bool, 512> subroutine{};
+  std::array<bool, 512> jump_target{};
+  // Addresses that jump, call or skip to each address
+  std::array<std::vector<std::uint16_t>, 512> xrefs;
+  std::vector<JumpTable> tables;
+  // Reachable blocks in address order
+  std::vector<BasicBlock> blocks;
+};
+
+constexpr std::uint16_t next_address(const std::size_t address,
+                                       const std::size_t by = 1) {
+  return static_cast<std::uint16_t>((address + by) & 0x1ffu);
+}
+
+constexpr bool is_skip(const Mnemonic mnemonic) {
+  return mnemonic == Mnemonic::DECFSZ || mnemonic == Mnemonic::INCFSZ ||
+         mnemonic == Mnemonic::BTFSC || mnemonic == Mnemonic::BTFSS;
+}
+
+constexpr bool writes_pc(const Instruction &instruction) {
+  return has_file_operand(instruction.mnemonic) && instruction.f == 2u &&
+         writes_file(instruction);
+}
+
+// Finds the table a write to pc at `address` dispatches through
+inline bool find_jump_table(const std::array<Instruction, 512> &program,
+                            const std::uint16_t address, JumpTable &table) {
+  const auto is_entry = [&program](const std::size_t at, const bool gotos) {
+    const auto mnemonic = program[at].mnemonic;
+    return mnemonic == Mnemonic::RETLW ||
+           (gotos && mnemonic == Mnemonic::GOTO);
+  };
+  // pc writes only reach the first 256 addresses
+  if (program[address].mnemonic == Mnemonic::MOVWF && address > 0 &&
+      is_entry(address - 1u, false)) {
+    auto first = address - 1u;
+    while (first > 0 && is_entry(first - 1u, false)) {
+      --first;
+    }
+    table = {address, static_cast<std::uint16_t>(first),
+             static_cast<std::uint16_t>(address - 1u)};
+    return true;
+  }
+  if (address + 1u < 256u && is_entry(address + 1u, true)) {
+    auto last = address + 1u;
+    while (last + 1u < 256u && is_entry(last + 1u, true)) {
+      ++last;
+    }
+    table = {address, static_cast<std::uint16_t>(address + 1u),
+             static_cast<std::uint16_t>(last)};
+    return true;
+  }
+  return false;
+}
+
+inline ControlFlow analyse(const std::array<Instruction, 512> &program) {
+  ControlFlow flow;
+  std::array<bool, 512> leader{};
+  std::array<bool, 512> has_table{};
+  std::array<JumpTable, 512> table_at{};
+
+  const auto edge = [&](const std::uint16_t from, const std::uint16_t to) {
+    flow.xrefs[to].push_back(from);
+    leader[to] = true;
+  };
+
+  // Follows every path from reset, marking leaders as it goes
+  std::vector<std::uint16_t> pending{ControlFlow::reset_vector};
+  leader[ControlFlow::reset_vector] = true;
+  while (!std::empty(pending)) {
+    const auto address = pending.back();
+    pending.pop_back();
+    if (flow.reachable[address]) {
+      continue;
+    }
+    flow.reachable[address] = true;
+    const auto &instruction = program[address];
+    const auto go = [&](const std::uint16_t to) { pending.push_back(to); };
+
+    if (instruction.mnemonic == Mnemonic::GOTO) {
+      edge(address, instruction.k);
+      flow.jump_target[instruction.k] = true;
+      go(instruction.k);
+    } else if (instruction.mnemonic == Mnemonic::CALL) {
+      edge(address, instruction.k);
+      flow.subroutine[instruction.k] = true;
+      go(instruction.k);
+      leader[next_address(address)] = true;
+      go(next_address(address));
+    } else if (is_skip(instruction.mnemonic)) {
+      edge(address, next_address(address, 2));
+      leader[next_address(address)] = true;
+      go(next_address(address));
+      go(next_address(address, 2));
+    } else if (writes_pc(instruction)) {
+      JumpTable table;
+      if (find_jump_table(program, address, table)) {
+        has_table[address] = true;
+        table_at[address] = table;
+        flow.tables.push_back(table);
+        for (auto entry = table.first; entry <= table.last; ++entry) {
+          edge(address, entry);
+          flow.table_entry[entry] =
+              program[entry].mnemonic == Mnemonic::RETLW;
+          go(entry);
+        }
+      }
+    } else if (instruction.mnemonic != Mnemonic::RETLW &&
+               instruction.mnemonic != Mnemonic::ILLEGAL_INSTRUCTION) {
+      go(next_address(address));
+    }
+  }
+  std::ranges::sort(flow.tables, {}, &JumpTable::jump);
+  for (auto &from : flow.xrefs) {
+    std::ranges::sort(from);
+  }
+
+  // Blocks run from a leader to the next instruction that transfers control,
+  // or up to the next leader
+  for (std::size_t start = 0; start < std::size(program); ++start) {
+    if (!flow.reachable[start] || (start > 0 && flow.reachable[start - 1] &&
+                                   !leader[start] &&
+                                   !ends_block(program[start - 1]))) {
+      continue;
+    }
+    auto last = start;
+    while (!ends_block(program[last]) && last + 1 < std::size(program) &&
+           !leader[last + 1] && flow.reachable[last + 1]) {
+      ++last;
+    }
+    const auto &instruction = program[last];
+    BasicBlock block{.start = static_cast<std::uint16_t>(start),
+                     .length = static_cast<std::uint16_t>(last - start + 1),
+                     .exit = BlockExit::Fallthrough,
+                     .targets = {}};
+    if (instruction.mnemonic == Mnemonic::GOTO) {
+      block.exit = BlockExit::Goto;
+      block.targets = {instruction.k};
+    } else if (instruction.mnemonic == Mnemonic::CALL) {
+      block.exit = BlockExit::Call;
+      block.targets = {instruction.k, next_address(last)};
+    } else if (is_skip(instruction.mnemonic)) {
+      block.exit = BlockExit::Skip;
+      block.targets = {next_address(last), next_address(last, 2)};
+    } else if (instruction.mnemonic == Mnemonic::RETLW) {
+      block.exit = BlockExit::Return;
+    } else if (has_table[last]) {
+      block.exit = BlockExit::Computed;
+      for (auto entry = table_at[last].first; entry <= table_at[last].last;
+           ++entry) {
+        block.targets.push_back(entry);
+      }
+    } else if (ends_block(instruction)) {
+      block.exit = BlockExit::Unknown;
+    } else {
+      block.targets = {next_address(last)};
+    }
+    flow.blocks.push_back(std::move(block));
+  }
+  return flow;
+}
+
+// The label of an address in listings, or an empty string if it has none
+inline std::string label(const ControlFlow &flow, const std::size_t address) {
+  if (address == ControlFlow::reset_vector) {
+    return "reset";
+  }
+  if (flow.subroutine[address]) {
+    return std::format("sub_{:03X}", address);
+  }
+  if (std::ranges::any_of(flow.tables, [address](const JumpTable &table) {
+        return table.first == address;
+      })) {
+    return std::format("table_{:03X}", address);
+  }
+  if (!flow.table_entry[address] &&
+      (flow.jump_target[address] || !std::empty(flow.xrefs[address]))) {
+    return std::format("L_{:03X}", address);
+  }
+  return {};
+}
+
+// Writes the readcode listing with a label line before every labelled
+// address, listing where it is reached from, and the target of every jump,
+// call and skip. Table entries are marked as data, and code that can't be
+// reached from reset as unreached.
+inline void write_listing(std::ostream &os, const std::array<OpCode, 512> &rom,
+                          const ControlFlow &flow) {
+  std::stringstream ss;
+  OpCodeStream disassembler{ss};
+  for (auto pc = 0uz; pc < std::size(rom); ++pc) {
+    if (const auto name = label(flow, pc); !std::empty(name)) {
+      os << std::format("\n{:s}:", name);
+      if (!std::empty(flow.xrefs[pc])) {
+        os << "  ; from";
+        for (const auto from : flow.xrefs[pc]) {
+          os << std::format(" x{:03X}", from);
+        }
+      }
+      os << '\n';
+    }
+
+    ss.str("");
+    disassembler.dispatch(rom[pc]);
+    auto text = ss.str();
+    text.pop_back();
+    const auto instruction = BasicOpCodes<OpCodeStream>::decode(rom[pc]);
+    std::string comment;
+    if (flow.table_entry[pc]) {
+      const auto table = std::ranges::find_if(
+          flow.tables, [pc](const JumpTable &table) {
+            return table.first <= pc && pc <= table.last;
+          });
+      comment = std::format("data, {:s}[{:d}]", label(flow, table->first),
+                            pc - table->first);
+    } else if (!flow.reachable[pc]) {
+      comment = "unreached";
+    } else if (instruction.mnemonic == Mnemonic::GOTO ||
+               instruction.mnemonic == Mnemonic::CALL) {
+      comment = label(flow, instruction.k);
+    } else if (is_skip(instruction.mnemonic)) {
+      comment = std::format("skip to {:s}", label(flow, next_address(pc, 2)));
+    } else if (const auto table = std::ranges::find(flow.tables, pc,
+                                                    &JumpTable::jump);
+               table != std::end(flow.tables)) {
+      comment = std::format("jump through {:s}", label(flow, table->first));
+    }
+    if (std::empty(comment)) {
+      os << std::format("{:<3d} x{:03X}:   {:s}\n", pc, pc, text);
+    } else {
+      os << std::format("{:<3d} x{:03X}:   {:<36s}; {:s}\n", pc, pc, text,
+                        comment);
+    }
+  }
+}
+
+// Writes one CSV row per reachable block: its start, length, exit and the
+// addresses it may continue at, separated by spaces.
+inline void write_block_index(std::ostream &os, const ControlFlow &flow) {
+  os << "start,length,exit,targets\n";
+  for (const auto &block : flow.blocks) {
+    os << std::format("{:d},{:d},{:s},", block.start, block.length,
+                      to_string(block.exit));
+    for (auto i = 0uz; i < std::size(block.targets); ++i) {
+      os << std::format("{:s}{:d}", i == 0 ? "" : " ", block.targets[i]);
+    }
+    os << '\n';
+  }
+}
+
+} // namespace pic1650
@@ -0,0 +1,226 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <span>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "pic1650.hpp"
+
+namespace pic1650 {
+
+// What the emulator does when every chunk in the ring is still waiting to be
+// formatted or written.
+enum class Backpressure {
+  Block, // wait for the writer to free a chunk
+  Drop,  // throw the chunk's records away and count them
+};
+
+struct AsyncTraceOptions {
+  std::size_t formatter_threads{
+      std::max(std::thread::hardware_concurrency(), 2u) - 1};
+  std::size_t chunk_size{4096};
+  std::size_t chunks{64};
+  Backpressure backpressure{Backpressure::Block};
+};
+
+// Moves trace records off the emulation thread. Records are batched into
+// chunks in a ring; the emulator publishes chunks in sequence, formatter
+// threads each claim the next sequence number and render that chunk to text,
+// and a writer thread copies the text to the stream in sequence order. Every
+// chunk carries a stamp of sequence * 4 + phase, so each hand-off is a single
+// atomic store and nothing takes a lock.
+//
+// Formatter is default constructible and has the row() and static header()
+// of CsvTraceFormatter; each formatter thread gets its own instance.
+template <typename Formatter = CsvTraceFormatter> class AsyncTracer {
+private:
+  enum Phase : std::uint64_t { Free, Filled, Formatted };
+
+  struct Chunk {
+    std::atomic<std::uint64_t> stamp{};
+    std::vector<TraceRecord> records;
+    std::string text;
+    // Marks the chunks published by close(), one per formatter thread
+    bool last{};
+  };
+
+  std::ostream &os;
+  AsyncTraceOptions options;
+  std::unique_ptr<Chunk[]> ring;
+  std::vector<TraceRecord> pending;
+  std::uint64_t published{};
+  std::atomic<std::uint64_t> claimed{};
+  std::atomic<std::uint64_t> dropped_records{};
+  std::vector<std::thread> formatters;
+  std::thread writer;
+
+  Chunk &chunk(const std::uint64_t sequence) {
+    return ring[sequence % options.chunks];
+  }
+
+  static constexpr std::uint64_t stamp(const std::uint64_t sequence,
+                                       const Phase phase) {
+    return sequence * 4 + phase;
+  }
+
+  static void wait_for(const std::atomic<std::uint64_t> &stamp,
+                       const std::uint64_t expected) {
+    for (auto seen = stamp.load(std::memory_order_acquire); seen != expected;
+         seen = stamp.load(std::memory_order_acquire)) {
+      stamp.wait(seen, std::memory_order_acquire);
+    }
+  }
+
+  static void advance(std::atomic<std::uint64_t> &stamp,
+                      const std::uint64_t value) {
+    stamp.store(value, std::memory_order_release);
+    stamp.notify_all();
+  }
+
+  void publish(const bool last) {
+    auto &next = chunk(published);
+    if (next.stamp.load(std::memory_order_acquire) !=
+        stamp(published, Free)) {
+      if (options.backpressure == Backpressure::Drop && !last) {
+        dropped_records.fetch_add(std::size(pending),
+                                  std::memory_order_relaxed);
+        pending.clear();
+        return;
+      }
+      wait_for(next.stamp, stamp(published, Free));
+    }
+    std::swap(next.records, pending);
+    pending.clear();
+    next.last = last;
+    advance(next.stamp, stamp(published, Filled));
+    ++published;
+  }
+
+  void format() {
+    Formatter formatter{};
+    std::ostringstream ss;
+    while (true) {
+      const auto sequence = claimed.fetch_add(1, std::memory_order_relaxed);
+      auto &claim = chunk(sequence);
+      wait_for(claim.stamp, stamp(sequence, Filled));
+      if (!claim.last) {
+        ss.str("");
+        for (const auto &record : claim.records) {
+          formatter.row(ss, record);
+        }
+        claim.text = std::move(ss).str();
+      }
+      const auto last = claim.last;
+      advance(claim.stamp, stamp(sequence, Formatted));
+      if (last) {
+        return;
+      }
+    }
+  }
+
+  void write() {
+    auto remaining = std::size(formatters);
+    for (std::uint64_t sequence = 0; remaining > 0; ++sequence) {
+      auto &next = chunk(sequence);
+      wait_for(next.stamp, stamp(sequence, Formatted));
+      if (next.last) {
+        --remaining;
+      } else {
+        os.write(std::data(next.text),
+                 static_cast<std::streamsize>(std::size(next.text)));
+        os.flush();
+      }
+      next.text.clear();
+      advance(next.stamp, stamp(sequence + options.chunks, Free));
+    }
+  }
+
+public:
+  AsyncTracer(std::ostream &os, const AsyncTraceOptions &options = {})
+      : os{os}, options{options} {
+    this->options.formatter_threads =
+        std::max<std::size_t>(this->options.formatter_threads, 1);
+    this->options.chunk_size =
+        std::max<std::size_t>(this->options.chunk_size, 1);
+    this->options.chunks = std::max<std::size_t>(this->options.chunks, 2);
+    ring = std::make_unique<Chunk[]>(this->options.chunks);
+    for (auto i = 0uz; i < this->options.chunks; ++i) {
+      ring[i].stamp.store(stamp(i, Free), std::memory_order_relaxed);
+      ring[i].records.reserve(this->options.chunk_size);
+    }
+    pending.reserve(this->options.chunk_size);
+
+    Formatter::header(os);
+    for (auto i = 0uz; i < this->options.formatter_threads; ++i) {
+      formatters.emplace_back(&AsyncTracer::format, this);
+    }
+    writer = std::thread{&AsyncTracer::write, this};
+  }
+
+  AsyncTracer(const AsyncTracer &) = delete;
+  AsyncTracer &operator=(const AsyncTracer &) = delete;
+
+  ~AsyncTracer() { close(); }
+
+  void push(const TraceRecord &record) {
+    pending.push_back(record);
+    if (std::size(pending) == options.chunk_size) {
+      publish(false);
+    }
+  }
+
+  // Publishes any partial chunk and waits until everything has been written
+  void close() {
+    if (!writer.joinable()) {
+      return;
+    }
+    if (!std::empty(pending)) {
+      const auto backpressure = std::exchange(options.backpressure,
+                                              Backpressure::Block);
+      publish(false);
+      options.backpressure = backpressure;
+    }
+    for (auto i = 0uz; i < std::size(formatters); ++i) {
+      publish(true);
+    }
+    for (auto &formatter : formatters) {
+      formatter.join();
+    }
+    writer.join();
+  }
+
+  std::uint64_t dropped() const {
+    return dropped_records.load(std::memory_order_relaxed);
+  }
+};
+
+// LoudEmulator with the formatting and writing done on other threads
+template <typename Formatter = CsvTraceFormatter>
+class AsyncTraceEmulator final
+    : public BasicTracingEmulator<AsyncTraceEmulator<Formatter>> {
+private:
+  AsyncTracer<Formatter> tracer;
+
+public:
+  AsyncTraceEmulator(const std::array<OpCode, 512> &rom, std::ostream &os,
+                     const AsyncTraceOptions &options = {})
+      : BasicTracingEmulator<AsyncTraceEmulator>{rom}, tracer{os, options} {}
+
+  void record(const TraceRecord &record) { tracer.push(record); }
+
+  void close() { tracer.close(); }
+
+  std::uint64_t dropped() const { return tracer.dropped(); }
+};
+
+} // namespace pic1650
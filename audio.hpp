@@ -0,0 +1,346 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <numbers>
+#include <ostream>
+#include <span>
+#include <vector>
+
+#include "pic1650.hpp"
+
+namespace pic1650 {
+
+struct AudioOptions {
+  // The instruction rate is clock_hz / clocks_per_instruction, as in pacing
+  double clock_hz{1'000'000.0};
+  std::uint32_t clocks_per_instruction{4};
+  std::uint32_t sample_rate{44'100};
+  // The latch bit driving the speaker: the baseball ROM toggles port A bit 0
+  // (XORWF F5 at 0x036)
+  std::uint8_t port{0};
+  std::uint8_t bit{0};
+  // Output for a latch swing from low to high, as a fraction of full scale
+  double volume{0.5};
+  // Passband edge of the resampler as a fraction of the sample rate
+  double cutoff{0.45};
+  // Corner of the high-pass filter that removes the DC left by a latch held
+  // high, in Hz, or 0 to keep it
+  double dc_cutoff_hz{20.0};
+};
+
+// Resamples a signal made of steps at arbitrary times to PCM. Each step is
+// added as a band-limited step: the integral of a Blackman-windowed sinc,
+// tabulated at `phases` fractional positions per sample and interpolated, so
+// the cost is per step rather than per input cycle, and nothing aliases
+// back from above the cutoff. Between steps, producing a sample costs a few
+// adds.
+class BandLimitedSynth {
+private:
+  // Zero crossings of the sinc on each side of a step, in output samples
+  static constexpr std::int64_t half = 16;
+  static constexpr std::int64_t phases = 64;
+  // Samples a step can still affect, rounded up to a power of two
+  static constexpr std::size_t ring_size =
+      std::bit_ceil(static_cast<std::size_t>(2 * half + 2));
+
+  // The band-limited step from -half to half samples around the step
+  std::vector<float> table;
+  // Per pending sample: the step residuals added to it, and the changes of
+  // the naive level that take effect on it
+  std::array<float, ring_size> residuals{};
+  std::array<float, ring_size> changes{};
+  // The first sample not yet produced
+  std::int64_t next{};
+  double level{};
+  double gain;
+  // One-pole DC blocker, passing everything through when the pole is 1
+  double pole;
+  double last_in{};
+  double last_out{};
+  std::vector<std::int16_t> produced;
+
+  static constexpr std::size_t slot(const std::int64_t sample) {
+    return static_cast<std::size_t>(sample) & (ring_size - 1u);
+  }
+
+  // The band-limited step minus the ideal one, x samples after the step
+  float residual(const double x) const {
+    const auto position = (x + static_cast<double>(half)) * phases;
+    const auto i = std::min(static_cast<std::size_t>(position),
+                            std::size(table) - 2u);
+    const auto fraction = static_cast<float>(position - static_cast<double>(i));
+    return table[i] + fraction * (table[i + 1u] - table[i]) -
+           (x >= 0.0 ? 1.0f : 0.0f);
+  }
+
+public:
+  BandLimitedSynth(const double cutoff, const double dc_pole,
+                   const double gain, const double level = 0.0)
+      : table(static_cast<std::size_t>(2 * half * phases + 1)),
+        level{level}, gain{gain}, pole{dc_pole}, last_in{level},
+        last_out{dc_pole >= 1.0 ? level : 0.0} {
+    // Integrates the kernel with the trapezium rule, several substeps to each
+    // entry, then scales the far end to exactly one
+    constexpr std::int64_t substeps = 8;
+    const auto kernel = [cutoff](const double x) {
+      const auto window =
+          0.42 + 0.5 * std::cos(std::numbers::pi * x / half) +
+          0.08 * std::cos(2.0 * std::numbers::pi * x / half);
+      const auto t = 2.0 * cutoff * x;
+      const auto sinc = t == 0.0 ? 1.0
+                                 : std::sin(std::numbers::pi * t) /
+                                       (std::numbers::pi * t);
+      return 2.0 * cutoff * sinc * window;
+    };
+    const double dx = 1.0 / static_cast<double>(phases * substeps);
+    double sum = 0.0;
+    auto x = -static_cast<double>(half);
+    auto previous = kernel(x);
+    for (std::size_t i = 1; i < std::size(table); ++i) {
+      for (std::int64_t step = 0; step < substeps; ++step) {
+        x += dx;
+        const auto value = kernel(x);
+        sum += 0.5 * (previous + value) * dx;
+        previous = value;
+      }
+      table[i] = static_cast<float>(sum);
+    }
+    for (auto &entry : table) {
+      entry = static_cast<float>(entry / sum);
+    }
+  }
+
+  // Produces every sample before time - half, which no later step can reach
+  void advance(const double time) {
+    for (; static_cast<double>(next + half) <= time; ++next) {
+      const auto i = slot(next);
+      level += changes[i];
+      const auto in = level + residuals[i];
+      changes[i] = 0.0f;
+      residuals[i] = 0.0f;
+      last_out = in - last_in + pole * last_out;
+      last_in = in;
+      // Long silences would decay into denormals, which are very slow
+      if (std::abs(last_out) < 1e-20) {
+        last_out = 0.0;
+      }
+      produced.push_back(static_cast<std::int16_t>(
+          std::clamp(std::lround(last_out * gain * 32767.0), -32768l, 32767l)));
+    }
+  }
+
+  // Produces every sample up to `time`, as if no step came after it
+  void finish(const double time) { advance(time + static_cast<double>(half)); }
+
+  // Adds a step of `delta` at `time`, in samples; times must not decrease
+  void step(const double time, const float delta) {
+    advance(time);
+    for (auto sample = next; static_cast<double>(sample) < time + half;
+         ++sample) {
+      residuals[slot(sample)] +=
+          delta * residual(static_cast<double>(sample) - time);
+    }
+    changes[slot(static_cast<std::int64_t>(std::ceil(time)))] += delta;
+  }
+
+  // Hands the samples produced so far to on_samples(span) and forgets them
+  template <typename OnSamples> void flush(OnSamples on_samples) {
+    if (!std::empty(produced)) {
+      on_samples(std::span<const std::int16_t>{produced});
+      produced.clear();
+    }
+  }
+};
+
+// Runs an emulator while turning every change of one latch bit into a step
+// for a BandLimitedSynth, timed by the cycle count. The predicate given to
+// run_until() compares one byte, and nothing else is done until the bit
+// changes. Like DisplayWatcher, the emulator must only be run through the
+// watcher from then on, so that its cycle count stays right.
+template <typename Machine> class AudioWatcher {
+private:
+  Machine &emulator;
+  std::size_t port;
+  std::uint8_t mask;
+  // Output samples per instruction
+  double ratio;
+  std::uint8_t last;
+  BandLimitedSynth synth;
+  std::uint64_t now{};
+
+  std::uint8_t latch(const Machine &running) const {
+    switch (port) {
+    case 0:
+      return running.a() & mask;
+    case 1:
+      return running.b() & mask;
+    case 2:
+      return running.c() & mask;
+    default:
+      return running.d() & mask;
+    }
+  }
+
+  static double dc_pole(const AudioOptions &options) {
+    return options.dc_cutoff_hz > 0.0
+               ? std::exp(-2.0 * std::numbers::pi * options.dc_cutoff_hz /
+                          options.sample_rate)
+               : 1.0;
+  }
+
+public:
+  AudioWatcher(Machine &emulator, const AudioOptions &options = {})
+      : emulator{emulator}, port{options.port & 0b11u},
+        mask{static_cast<std::uint8_t>(1u << (options.bit & 0b111u))},
+        ratio{static_cast<double>(options.sample_rate) *
+              std::max<std::uint32_t>(options.clocks_per_instruction, 1) /
+              options.clock_hz},
+        last{latch(emulator)},
+        synth{options.cutoff, dc_pole(options), options.volume,
+              last != 0u ? 1.0 : 0.0} {}
+
+  // Runs `cycles` instructions, handing the samples they complete to
+  // on_samples(span)
+  template <typename OnSamples>
+  void run(const std::uint64_t cycles, OnSamples on_samples) {
+    const auto end = now + cycles;
+    while (now < end) {
+      now += emulator.run_until(
+          [this](const Machine &running) { return latch(running) != last; },
+          end - now);
+      if (const auto bit = latch(emulator); bit != last) {
+        last = bit;
+        synth.step(static_cast<double>(now) * ratio, bit != 0u ? 1.0f : -1.0f);
+      }
+    }
+    synth.advance(static_cast<double>(now) * ratio);
+    synth.flush(on_samples);
+  }
+
+  // Produces the samples still waiting for steps, as if the latch stayed put
+  template <typename OnSamples> void finish(OnSamples on_samples) {
+    synth.finish(static_cast<double>(now) * ratio);
+    synth.flush(on_samples);
+  }
+
+  std::uint64_t cycle() const { return now; }
+};
+
+// Writes 16-bit mono PCM as a WAV file as it arrives. The sizes in the header
+// are patched by finish() when the stream can seek; otherwise they are left
+// at the maximum, which players take as a stream of unknown length.
+class WavWriter {
+private:
+  std::ostream &os;
+  std::ostream::pos_type start;
+  std::uint64_t bytes{};
+  // Little-endian samples on their way to the stream
+  std::vector<char> buffer;
+
+  void put16(const std::uint16_t x) {
+    os.put(static_cast<char>(x & 0xffu)).put(static_cast<char>(x >> 8));
+  }
+
+  void put32(const std::uint32_t x) {
+    put16(static_cast<std::uint16_t>(x & 0xffffu));
+    put16(static_cast<std::uint16_t>(x >> 16));
+  }
+
+public:
+  WavWriter(std::ostream &os, const std::uint32_t sample_rate)
+      : os{os}, start{os.tellp()} {
+    os.write("RIFF", 4);
+    put32(0xffff'ffffu);
+    os.write("WAVEfmt ", 8);
+    put32(16);
+    put16(1); // PCM
+    put16(1); // mono
+    put32(sample_rate);
+    put32(sample_rate * 2u);
+    put16(2);
+    put16(16);
+    os.write("data", 4);
+    put32(0xffff'ffffu);
+  }
+
+  void write(const std::span<const std::int16_t> samples) {
+    buffer.resize(2u * std::size(samples));
+    for (std::size_t i = 0; i < std::size(samples); ++i) {
+      const auto sample = static_cast<std::uint16_t>(samples[i]);
+      buffer[2u * i] = static_cast<char>(sample & 0xffu);
+      buffer[2u * i + 1u] = static_cast<char>(sample >> 8);
+    }
+    os.write(std::data(buffer),
+             static_cast<std::streamsize>(std::size(buffer)));
+    bytes += std::size(buffer);
+  }
+
+  void finish() {
+    os.flush();
+    if (start == std::ostream::pos_type(-1)) {
+      return;
+    }
+    const auto end = os.tellp();
+    const auto data = static_cast<std::uint32_t>(
+        std::min<std::uint64_t>(bytes, 0xffff'ffffu - 36u));
+    os.seekp(start + std::streamoff{4});
+    put32(data + 36u);
+    os.seekp(start + std::streamoff{40});
+    put32(data);
+    os.seekp(end);
+    os.flush();
+  }
+};
+
+// Single-producer single-consumer ring of samples, for handing audio to a
+// real-time callback. push() never waits: samples that don't fit are dropped
+// and counted, so a stalled consumer can't stall the emulator.
+class AudioRing {
+private:
+  std::vector<std::int16_t> samples;
+  alignas(64) std::atomic<std::uint64_t> written{};
+  alignas(64) std::atomic<std::uint64_t> read{};
+  std::atomic<std::uint64_t> dropped{};
+
+public:
+  explicit AudioRing(const std::size_t capacity)
+      : samples(std::bit_ceil(std::max<std::size_t>(capacity, 1))) {}
+
+  // Called by the producer; returns the number of samples queued
+  std::size_t push(const std::span<const std::int16_t> in) {
+    const auto head = written.load(std::memory_order_relaxed);
+    const auto space = std::size(samples) -
+                       (head - read.load(std::memory_order_acquire));
+    const auto count = std::min<std::size_t>(std::size(in), space);
+    for (std::size_t i = 0; i < count; ++i) {
+      samples[(head + i) & (std::size(samples) - 1u)] = in[i];
+    }
+    written.store(head + count, std::memory_order_release);
+    dropped.fetch_add(std::size(in) - count, std::memory_order_relaxed);
+    return count;
+  }
+
+  // Called by the consumer; returns the number of samples taken
+  std::size_t pop(const std::span<std::int16_t> out) {
+    const auto tail = read.load(std::memory_order_relaxed);
+    const auto count = std::min<std::size_t>(
+        std::size(out), written.load(std::memory_order_acquire) - tail);
+    for (std::size_t i = 0; i < count; ++i) {
+      out[i] = samples[(tail + i) & (std::size(samples) - 1u)];
+    }
+    read.store(tail + count, std::memory_order_release);
+    return count;
+  }
+
+  std::uint64_t dropped_samples() const {
+    return dropped.load(std::memory_order_relaxed);
+  }
+};
+
+} // namespace pic1650
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <initializer_list>
+#include <optional>
+
+#include "pic1650.hpp"
+
+namespace pic1650 {
+
+// Where boot() stops: after `cycles` instructions, or on reaching pc first
+struct BootOptions {
+  std::uint64_t cycles{};
+  std::optional<std::uint16_t> pc{};
+};
+
+// A state reached from reset with no inputs, and the instructions it took
+struct BootSnapshot {
+  State state{};
+  std::uint64_t cycles{};
+
+  bool operator==(const BootSnapshot &) const = default;
+};
+
+// Runs a ROM from reset. Emulator can run in constant evaluation, one tick()
+// at a time, so a build can bake the state a ROM boots into:
+//
+//   constexpr auto booted = boot(rom, {.cycles = 300'000});
+//
+// and every run starting from it is then a restore() rather than a replay of
+// the firmware's start-up. Each run_until() is kept to a block of
+// instructions, so that no loop outgrows the compiler's iteration limit.
+constexpr BootSnapshot boot(const std::array<OpCode, 512> &rom,
+                            const BootOptions &options = {}) {
+  Emulator emulator{rom};
+  if (!options.pc) {
+    emulator.run(options.cycles);
+    return {.state = emulator.snapshot(), .cycles = options.cycles};
+  }
+  constexpr std::uint64_t block = 1u << 15;
+  const auto at = [target = *options.pc](const Emulator &running) {
+    return running.PC() == target;
+  };
+  std::uint64_t cycles = 0;
+  while (cycles < options.cycles && !at(emulator)) {
+    cycles += emulator.run_until(at, std::min(options.cycles - cycles, block));
+  }
+  return {.state = emulator.snapshot(), .cycles = cycles};
+}
+
+namespace detail {
+
+// The state after `cycles` instructions of `code`, placed at address 0 and
+// entered from reset, with w preset by a MOVLW
+constexpr State run_code(const std::uint8_t w,
+                         const std::initializer_list<OpCode> code,
+                         const std::uint64_t cycles) {
+  std::array<OpCode, 512> rom{};
+  rom[0] = 0b1100'0000'0000u | w;
+  std::ranges::copy(code, std::begin(rom) + 1);
+  rom[0x1ffu] = 0b1010'0000'0000u; // GOTO 0
+  Emulator emulator{rom};
+  emulator.run(2u + cycles);
+  return emulator.snapshot();
+}
+
+} // namespace detail
+
+// Instruction semantics checked in constant evaluation, which also keeps the
+// constexpr path of Emulator compiling
+static_assert([] {
+  // ADDWF f9,0 with 0x0f in f9 and 0xf1 in w: carry, digit carry and zero
+  const auto added = detail::run_code(
+      0x0fu, {0b0000'0010'1001u, 0b1100'1111'0001u, 0b0001'1100'1001u}, 3);
+  return added.w == 0x00u && added.status == 0b111u &&
+         added.general_purpose_registers[0] == 0x0fu;
+}());
+static_assert([] {
+  // SUBWF f9,1 with 0x10 in f9 and 0x20 in w: a borrow clears C, and the
+  // low digits borrow nothing, which sets DC
+  const auto subtracted = detail::run_code(
+      0x10u, {0b0000'0010'1001u, 0b1100'0010'0000u, 0b0000'1010'1001u}, 3);
+  return subtracted.general_purpose_registers[0] == 0xf0u &&
+         subtracted.status == 0b010u;
+}());
+static_assert([] {
+  // CALL 4, where RETLW 0x5a returns past the CALL with w set
+  const auto returned = detail::run_code(
+      0x00u, {0b1001'0000'0100u, 0b0000'0000'0000u, 0b0000'0000'0000u,
+              0b1000'0101'1010u},
+      2);
+  return returned.pc == 2u && returned.w == 0x5au &&
+         returned.stack[0] == 0xffffu;
+}());
+static_assert([] {
+  // A DECFSZ f9,1 loop from 3 leaves past its GOTO on the third pass. run()
+  // skips such idle loops, and must land where running them would
+  const auto counted = detail::run_code(
+      0x03u,
+      {0b0000'0010'1001u, 0b0010'1110'1001u, 0b1010'0000'0010u},
+      1u + 3u * 2u - 1u);
+  return counted.general_purpose_registers[0] == 0u && counted.pc == 4u;
+}());
+
+} // namespace pic1650
@@ -0,0 +1,18 @@
+// The state the bundled ROM boots into, baked while compiling. It takes the
+// compiler a while, so it lives apart from pic1650-batch.cpp and is only
+// rebuilt when the ROM, the emulator or the boot settings change.
+
+#include "pic1650.hpp"
+#include "boot.hpp"
+#include "bundled_rom.hpp"
+
+namespace pic1650::bundled {
+
+constinit const BootSnapshot booted = boot(rom, {
+    .cycles = PIC1650_BOOT_CYCLES,
+#ifdef PIC1650_BOOT_PC
+    .pc = PIC1650_BOOT_PC,
+#endif
+});
+
+} // namespace pic1650::bundled
@@ -0,0 +1,361 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "pic1650.hpp"
+
+namespace pic1650 {
+
+enum class Comparison : std::uint8_t {
+  Equal,
+  NotEqual,
+  Less,
+  LessEqual,
+  Greater,
+  GreaterEqual,
+  AnySet, // any of the bits in the value are set
+};
+
+// A test of w or of one file, such as w == 0x12 or file 5 (latch A) & 0x01.
+// Files read as the program would see them, except that the ports read as
+// their latches and file 0 as zero, so that testing one has no effects.
+struct Condition {
+  bool w{};
+  std::uint8_t file{};
+  Comparison comparison{Comparison::Equal};
+  std::uint8_t value{};
+};
+
+// Accesses a watchpoint stops on, as bits
+enum class Access : std::uint8_t {
+  Read = 0b01u,
+  Write = 0b10u,
+  ReadWrite = 0b11u,
+};
+
+enum class StopReason : std::uint8_t {
+  Budget,     // the cycle budget ran out
+  Breakpoint, // before the instruction at a breakpoint
+  Watchpoint, // after an instruction accessed a watched file
+  Condition,  // after an instruction made a condition true
+  Stepped,    // after one instruction
+  Returned,   // after the call stepped over, or the function stepped out of
+};
+
+constexpr const char *to_string(const StopReason reason) {
+  switch (reason) {
+  case StopReason::Budget:
+    return "budget";
+  case StopReason::Breakpoint:
+    return "breakpoint";
+  case StopReason::Watchpoint:
+    return "watchpoint";
+  case StopReason::Condition:
+    return "condition";
+  case StopReason::Stepped:
+    return "stepped";
+  case StopReason::Returned:
+    break;
+  }
+  return "returned";
+}
+
+struct Stop {
+  StopReason reason{StopReason::Budget};
+  // Instructions run before stopping
+  std::uint64_t cycles{};
+  // The breakpoint or the instruction that accessed the watched file, and
+  // otherwise pc where the run stopped
+  std::uint16_t address{};
+  // The watched file and how it was accessed, or the index of the condition
+  std::uint8_t file{};
+  Access access{};
+  std::size_t condition{};
+};
+
+// Emulator with pc breakpoints, watchpoints on the files and conditional
+// breaks. It doesn't wrap tick(), so run() keeps the full speed of Emulator,
+// and so does resume() while nothing is armed. Otherwise resume() runs
+// through run_until() with a predicate compiled for just what is armed: with
+// only pc breakpoints, that is one bit test per instruction.
+//
+// Breakpoints stop before their instruction runs, and may have a condition
+// that must hold there. Watchpoints stop after the instruction that read or
+// wrote the file, directly or through file 0; flag updates count as writes
+// of STATUS, and the count kept in rtcc doesn't count as a write. Conditions
+// stop after the instruction that makes them true, so one that already holds
+// when resuming must stop holding first.
+class DebuggingEmulator final : public BasicEmulator<DebuggingEmulator> {
+private:
+  static constexpr std::size_t max_conditions = 64;
+
+  std::bitset<512> breaks{};
+  std::array<std::optional<Condition>, 512> guards{};
+  std::array<std::uint8_t, 32> watches{};
+  bool watching{};
+  std::vector<Condition> conditions{};
+  // The conditions that held after the last instruction, as bits
+  std::uint64_t held{};
+
+  std::uint8_t peek(const std::uint8_t f) const {
+    return f == PCL ? static_cast<std::uint8_t>(pc & 0xffu) : registers[f];
+  }
+
+  bool holds(const Condition &condition) const {
+    const auto x = condition.w ? w : peek(condition.file);
+    switch (condition.comparison) {
+    case Comparison::Equal:
+      return x == condition.value;
+    case Comparison::NotEqual:
+      return x != condition.value;
+    case Comparison::Less:
+      return x < condition.value;
+    case Comparison::LessEqual:
+      return x <= condition.value;
+    case Comparison::Greater:
+      return x > condition.value;
+    case Comparison::GreaterEqual:
+      return x >= condition.value;
+    case Comparison::AnySet:
+      break;
+    }
+    return (x & condition.value) != 0u;
+  }
+
+  std::uint64_t conditions_held() const {
+    std::uint64_t bits = 0;
+    for (std::size_t i = 0; i < std::size(conditions); ++i) {
+      bits |= holds(conditions[i]) ? std::uint64_t{1} << i : 0u;
+    }
+    return bits;
+  }
+
+  // Whether the instruction at pc will access a watched file, and if so
+  // which and how
+  bool watched(Stop &stop) const {
+    const auto &instruction = program[pc];
+    std::uint8_t file = STATUS;
+    std::uint8_t access = 0;
+    if (has_file_operand(instruction.mnemonic)) {
+      file = instruction.f == INDF ? fsr() : instruction.f;
+      access = static_cast<std::uint8_t>(
+          ((reads_file(instruction.mnemonic) ? 0b01u : 0u) |
+           (writes_file(instruction) ? 0b10u : 0u)) &
+          watches[file]);
+    }
+    const auto flags = static_cast<std::uint8_t>(
+        ((reads_status(instruction.mnemonic) != 0u ? 0b01u : 0u) |
+         (writes_status(instruction.mnemonic) != 0u ? 0b10u : 0u)) &
+        watches[STATUS]);
+    if (flags != 0u && (access == 0u || file == STATUS)) {
+      file = STATUS;
+      access |= flags;
+    }
+    if (access == 0u) {
+      return false;
+    }
+    stop = {.reason = StopReason::Watchpoint,
+            .address = pc,
+            .file = file,
+            .access = static_cast<Access>(access)};
+    return true;
+  }
+
+  // Checks after an instruction whether to stop, with the checks for what
+  // isn't armed compiled out
+  template <bool Breaks, bool Watches, bool Conditions>
+  bool should_stop(Stop &stop) {
+    if constexpr (Conditions) {
+      const auto now = conditions_held();
+      const auto became = now & ~held;
+      held = now;
+      if (became != 0u) {
+        stop = {.reason = StopReason::Condition,
+                .address = pc,
+                .condition = static_cast<std::size_t>(std::countr_zero(became))};
+        return true;
+      }
+    }
+    if constexpr (Breaks) {
+      if (breaks[pc] && (!guards[pc] || holds(*guards[pc]))) {
+        stop = {.reason = StopReason::Breakpoint, .address = pc};
+        return true;
+      }
+    }
+    if constexpr (Watches) {
+      return watched(stop);
+    }
+    return false;
+  }
+
+  // Runs up to max_cycles instructions until something armed stops it or
+  // done() holds after an instruction. The instruction at pc runs whatever
+  // breakpoint is there, since that is where the last run stopped. A
+  // watchpoint finishes the access that triggered it, which may run one
+  // instruction past the budget.
+  template <bool Breaks, bool Watches, bool Conditions, typename Done>
+  Stop resume_with(const std::uint64_t max_cycles, Done done) {
+    Stop stop{.address = pc};
+    if (max_cycles != 0u && !(Watches && watched(stop))) {
+      if constexpr (Conditions) {
+        held = conditions_held();
+      }
+      tick();
+      auto predicate = [&](const DebuggingEmulator &) {
+        if (done()) {
+          stop = {.reason = StopReason::Returned, .address = pc};
+          return true;
+        }
+        return should_stop<Breaks, Watches, Conditions>(stop);
+      };
+      const auto cycles =
+          predicate(*this) ? 1u : 1u + run_until(predicate, max_cycles - 1u);
+      if (stop.reason == StopReason::Budget) {
+        stop.address = pc;
+      }
+      stop.cycles = cycles;
+    }
+    if (stop.reason == StopReason::Watchpoint) {
+      tick();
+      ++stop.cycles;
+    }
+    return stop;
+  }
+
+  template <typename Done>
+  Stop resume_until(const std::uint64_t max_cycles, Done done) {
+    switch ((breaks.any() ? 0b100u : 0u) | (watching ? 0b010u : 0u) |
+            (std::empty(conditions) ? 0u : 0b001u)) {
+    case 0b000u:
+      return resume_with<false, false, false>(max_cycles, done);
+    case 0b001u:
+      return resume_with<false, false, true>(max_cycles, done);
+    case 0b010u:
+      return resume_with<false, true, false>(max_cycles, done);
+    case 0b011u:
+      return resume_with<false, true, true>(max_cycles, done);
+    case 0b100u:
+      return resume_with<true, false, false>(max_cycles, done);
+    case 0b101u:
+      return resume_with<true, false, true>(max_cycles, done);
+    case 0b110u:
+      return resume_with<true, true, false>(max_cycles, done);
+    default:
+      return resume_with<true, true, true>(max_cycles, done);
+    }
+  }
+
+public:
+  using BasicEmulator::BasicEmulator;
+
+  // Breakpoints, optionally stopping only when `condition` holds there
+  void set_breakpoint(const std::uint16_t address,
+                      const std::optional<Condition> condition = {}) {
+    breaks.set(address & 0x1ffu);
+    guards[address & 0x1ffu] = condition;
+  }
+
+  void clear_breakpoint(const std::uint16_t address) {
+    breaks.reset(address & 0x1ffu);
+    guards[address & 0x1ffu].reset();
+  }
+
+  const std::bitset<512> &breakpoints() const { return breaks; }
+
+  const std::optional<Condition> &guard(const std::uint16_t address) const {
+    return guards[address & 0x1ffu];
+  }
+
+  void watch(const std::uint8_t file, const Access access) {
+    watches[file & 0x1fu] |= std::to_underlying(access);
+    watching = true;
+  }
+
+  void unwatch(const std::uint8_t file) {
+    watches[file & 0x1fu] = 0;
+    watching = std::ranges::any_of(watches, [](auto x) { return x != 0u; });
+  }
+
+  // The accesses watched on each file, as Access bits
+  const std::array<std::uint8_t, 32> &watchpoints() const { return watches; }
+
+  // Adds a condition that stops a run when it becomes true, and returns its
+  // index
+  std::size_t add_condition(const Condition &condition) {
+    if (std::size(conditions) == max_conditions) {
+      throw std::length_error(
+          std::format("more than {:d} conditions", max_conditions));
+    }
+    conditions.push_back(condition);
+    return std::size(conditions) - 1u;
+  }
+
+  void clear_conditions() { conditions.clear(); }
+
+  const std::vector<Condition> &break_conditions() const { return conditions; }
+
+  bool armed() const {
+    return breaks.any() || watching || !std::empty(conditions);
+  }
+
+  // Calls in progress, up to the two the stack holds
+  std::size_t depth() const {
+    return (stack[0] != 0xffffu ? 1u : 0u) + (stack[1] != 0xffffu ? 1u : 0u);
+  }
+
+  // Runs until something armed stops it, or for max_cycles instructions
+  Stop resume(const std::uint64_t max_cycles) {
+    if (!armed()) {
+      run(max_cycles);
+      return {.cycles = max_cycles, .address = pc};
+    }
+    return resume_until(max_cycles, [] { return false; });
+  }
+
+  // Runs the instruction at pc, whatever is armed
+  Stop step() {
+    const auto address = pc;
+    tick();
+    return {.reason = StopReason::Stepped, .cycles = 1, .address = address};
+  }
+
+  // Runs the instruction at pc, and when it is a CALL, the whole call
+  Stop step_over(const std::uint64_t max_cycles) {
+    if (program[pc].mnemonic != Mnemonic::CALL) {
+      return step();
+    }
+    const auto back = static_cast<std::uint16_t>((pc + 1u) & 0x1ffu);
+    const auto caller = stack[0];
+    return resume_until(max_cycles, [this, back, caller] {
+      return pc == back && stack[0] == caller;
+    });
+  }
+
+  // Runs until the function pc is in returns. At the top level there is
+  // nothing to return from, and nothing runs. A call nested two deeper than
+  // this function pushes its return address off the two-level stack; the
+  // function can't return then, and the run ends at its budget.
+  Stop step_out(const std::uint64_t max_cycles) {
+    if (depth() == 0u) {
+      return {.address = pc};
+    }
+    const auto back = stack[0];
+    const auto caller = stack[1];
+    return resume_until(max_cycles, [this, back, caller] {
+      return pc == back && stack[0] == caller;
+    });
+  }
+
+};
+
+} // namespace pic1650
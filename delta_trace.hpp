@@ -0,0 +1,434 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <istream>
+#include <iterator>
+#include <ostream>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#include "pic1650.hpp"
+#include "trace.hpp"
+
+namespace pic1650 {
+
+// Delta traces start with a DeltaTraceHeader, which carries the ROM so that
+// starting_pc, opcode and cnt never have to be stored. Each record is either a
+// keyframe (KEYFRAME followed by a raw TraceRecord) or a delta: a byte of the
+// DeltaField flags below followed by the new values of the fields it names.
+// Fields left out of a delta keep their predicted value: the previous record's
+// state, with pc and rtcc advanced by one. A finished trace ends with END, an
+// index of every keyframe and a DeltaTraceTrailer, so readers can seek without
+// scanning; traces cut short are indexed on the fly instead.
+struct DeltaTraceHeader {
+  TraceHeader trace{.magic = {'P', 'I', 'C', '1', '6', '5', '0', 'D'}};
+  std::uint32_t keyframe_interval{};
+  std::uint32_t reserved{};
+  std::array<OpCode, 512> rom{};
+};
+
+static_assert(sizeof(DeltaTraceHeader) == 1048);
+
+struct DeltaTraceKeyframe {
+  std::uint64_t tick{};
+  std::uint64_t offset{};
+};
+
+struct DeltaTraceTrailer {
+  std::uint64_t index_offset{};
+  std::uint64_t keyframes{};
+  std::uint64_t records{};
+  std::array<char, 8> magic{'P', 'I', 'C', '1', '6', '5', '0', 'I'};
+};
+
+static_assert(sizeof(DeltaTraceTrailer) == 32);
+
+namespace DeltaField {
+constexpr std::uint8_t PC = 1u << 0;         // u16, pc didn't just advance
+constexpr std::uint8_t W = 1u << 1;          // u8
+constexpr std::uint8_t STATUS = 1u << 2;     // u8
+constexpr std::uint8_t FSR = 1u << 3;        // u8
+constexpr std::uint8_t RTCC = 1u << 4;       // u8, rtcc didn't just advance
+constexpr std::uint8_t STACK = 1u << 5;      // u16 x 2
+constexpr std::uint8_t ONE_FILE = 1u << 6;   // u8 file index, u8 value
+constexpr std::uint8_t MANY_FILES = 1u << 7; // u32 file mask, u8 per file
+// No delta sets both ONE_FILE and MANY_FILES, so those combinations are free
+// to mark a keyframe and the end of the records
+constexpr std::uint8_t KEYFRAME = ONE_FILE | MANY_FILES;
+constexpr std::uint8_t END = 0xff;
+} // namespace DeltaField
+
+// The output latches and general purpose registers are numbered 0 to 3 and 4
+// to 26 for ONE_FILE and MANY_FILES.
+constexpr std::size_t delta_trace_files = 27;
+
+template <typename Record>
+auto &delta_trace_file(Record &record, const std::size_t index) {
+  return index < std::size(record.output_latches)
+             ? record.output_latches[index]
+             : record.general_purpose_registers[index -
+                                                std::size(
+                                                    record.output_latches)];
+}
+
+inline TraceRecord predict_delta_trace_record(
+    const TraceRecord &previous, const std::array<OpCode, 512> &rom) {
+  auto record = previous;
+  record.cnt = previous.cnt + 1;
+  record.starting_pc = previous.pc;
+  record.pc = (previous.pc + 1) & 0x1ffu;
+  record.opcode = rom[record.starting_pc & 0x1ffu];
+  record.rtcc = static_cast<std::uint8_t>(previous.rtcc + 1);
+  return record;
+}
+
+class DeltaTraceWriter {
+private:
+  std::ostream &os;
+  DeltaTraceHeader header;
+  std::vector<char> buffer;
+  std::size_t buffer_size;
+  std::vector<DeltaTraceKeyframe> keyframes;
+  std::uint64_t offset{sizeof(DeltaTraceHeader)};
+  std::uint64_t records{};
+  TraceRecord previous{};
+  bool finished{};
+
+  template <typename T> void put(const T value) {
+    const auto at = std::size(buffer);
+    buffer.resize(at + sizeof(value));
+    std::memcpy(std::data(buffer) + at, &value, sizeof(value));
+  }
+
+  void keyframe(const TraceRecord &record) {
+    keyframes.push_back({.tick = records, .offset = offset});
+    put(DeltaField::KEYFRAME);
+    put(record);
+  }
+
+  void delta(const TraceRecord &record, const TraceRecord &predicted) {
+    std::uint32_t files{};
+    for (auto i = 0uz; i < delta_trace_files; ++i) {
+      if (delta_trace_file(record, i) != delta_trace_file(predicted, i)) {
+        files |= 1u << i;
+      }
+    }
+
+    std::uint8_t mask{};
+    mask |= record.pc != predicted.pc ? DeltaField::PC : 0;
+    mask |= record.w != predicted.w ? DeltaField::W : 0;
+    mask |= record.status != predicted.status ? DeltaField::STATUS : 0;
+    mask |= record.fsr != predicted.fsr ? DeltaField::FSR : 0;
+    mask |= record.rtcc != predicted.rtcc ? DeltaField::RTCC : 0;
+    mask |= record.stack != predicted.stack ? DeltaField::STACK : 0;
+    if (files != 0) {
+      mask |= std::has_single_bit(files) ? DeltaField::ONE_FILE
+                                         : DeltaField::MANY_FILES;
+    }
+
+    put(mask);
+    if (mask & DeltaField::PC) {
+      put(record.pc);
+    }
+    if (mask & DeltaField::W) {
+      put(record.w);
+    }
+    if (mask & DeltaField::STATUS) {
+      put(record.status);
+    }
+    if (mask & DeltaField::FSR) {
+      put(record.fsr);
+    }
+    if (mask & DeltaField::RTCC) {
+      put(record.rtcc);
+    }
+    if (mask & DeltaField::STACK) {
+      put(record.stack);
+    }
+    if (mask & DeltaField::ONE_FILE) {
+      const auto index = std::countr_zero(files);
+      put(static_cast<std::uint8_t>(index));
+      put(delta_trace_file(record, index));
+    } else if (mask & DeltaField::MANY_FILES) {
+      put(files);
+      for (auto i = 0uz; i < delta_trace_files; ++i) {
+        if (files & (1u << i)) {
+          put(delta_trace_file(record, i));
+        }
+      }
+    }
+  }
+
+public:
+  static constexpr std::uint32_t default_keyframe_interval = 4096;
+
+  DeltaTraceWriter(std::ostream &os, const std::array<OpCode, 512> &rom,
+                   const std::uint32_t keyframe_interval =
+                       default_keyframe_interval,
+                   const std::size_t buffer_size =
+                       TraceWriter::default_buffer_size)
+      : os{os}, header{.keyframe_interval = std::max(keyframe_interval, 1u),
+                       .rom = rom},
+        buffer_size{buffer_size} {
+    buffer.reserve(buffer_size + sizeof(TraceRecord) + 1);
+    os.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  }
+
+  DeltaTraceWriter(const DeltaTraceWriter &) = delete;
+  DeltaTraceWriter &operator=(const DeltaTraceWriter &) = delete;
+
+  ~DeltaTraceWriter() { finish(); }
+
+  void write(const TraceRecord &record) {
+    if (finished) {
+      throw std::logic_error("delta trace already finished");
+    }
+    const auto at = std::size(buffer);
+    const auto predicted = predict_delta_trace_record(previous, header.rom);
+    // Anything a delta can't express starts a new keyframe early
+    if (records % header.keyframe_interval == 0 ||
+        record.cnt != predicted.cnt ||
+        record.starting_pc != predicted.starting_pc ||
+        record.opcode != predicted.opcode) {
+      keyframe(record);
+    } else {
+      delta(record, predicted);
+    }
+    offset += std::size(buffer) - at;
+    previous = record;
+    ++records;
+    if (std::size(buffer) >= buffer_size) {
+      flush();
+    }
+  }
+
+  void flush() {
+    os.write(std::data(buffer),
+             static_cast<std::streamsize>(std::size(buffer)));
+    os.flush();
+    buffer.clear();
+  }
+
+  // Appends the keyframe index and trailer; the trace can't be written to
+  // afterwards.
+  void finish() {
+    if (finished) {
+      return;
+    }
+    finished = true;
+    put(DeltaField::END);
+    const DeltaTraceTrailer trailer{.index_offset = offset + 1,
+                                    .keyframes = std::size(keyframes),
+                                    .records = records};
+    for (const auto &keyframe : keyframes) {
+      put(keyframe);
+    }
+    put(trailer);
+    flush();
+  }
+};
+
+// Reads delta traces sequentially, and seeks to any tick by decoding forward
+// from the nearest keyframe at or before it.
+class DeltaTraceReader {
+private:
+  std::istream &is;
+  std::istream::pos_type start;
+  DeltaTraceHeader header{};
+  std::vector<DeltaTraceKeyframe> keyframes;
+  // How far keyframes is known to be complete, in bytes and records
+  std::uint64_t indexed_offset{};
+  std::uint64_t offset{sizeof(DeltaTraceHeader)};
+  std::uint64_t tick{};
+  TraceRecord current{};
+
+  template <typename T> T get() {
+    T value;
+    const auto n =
+        is.rdbuf()->sgetn(reinterpret_cast<char *>(&value), sizeof(value));
+    if (n != sizeof(value)) {
+      throw std::runtime_error("truncated delta trace");
+    }
+    offset += sizeof(value);
+    return value;
+  }
+
+  void load_index() {
+    if (start == std::istream::pos_type(-1)) {
+      return;
+    }
+    is.seekg(0, std::ios::end);
+    const auto size = static_cast<std::uint64_t>(is.tellg() - start);
+    DeltaTraceTrailer trailer{};
+    if (is && size >= sizeof(DeltaTraceHeader) + sizeof(trailer)) {
+      is.seekg(start + std::streamoff(size - sizeof(trailer)));
+      is.read(reinterpret_cast<char *>(&trailer), sizeof(trailer));
+    }
+    if (is && trailer.magic == DeltaTraceTrailer{}.magic &&
+        trailer.index_offset + trailer.keyframes * sizeof(DeltaTraceKeyframe) +
+                sizeof(trailer) ==
+            size) {
+      keyframes.resize(trailer.keyframes);
+      is.seekg(start + std::streamoff(trailer.index_offset));
+      is.read(reinterpret_cast<char *>(std::data(keyframes)),
+              static_cast<std::streamsize>(std::size(keyframes) *
+                                           sizeof(DeltaTraceKeyframe)));
+      indexed_offset = trailer.index_offset;
+    }
+    is.clear();
+    is.seekg(start + std::streamoff(offset));
+  }
+
+  // Decodes the next record into current
+  bool advance() {
+    const auto next = is.rdbuf()->sgetc();
+    if (next == std::istream::traits_type::eof() || next == DeltaField::END) {
+      return false;
+    }
+    const auto record_offset = offset;
+    const auto mask = get<std::uint8_t>();
+    if (mask == DeltaField::KEYFRAME) {
+      if (record_offset >= indexed_offset) {
+        keyframes.push_back({.tick = tick, .offset = record_offset});
+      }
+      current = get<TraceRecord>();
+    } else if ((mask & DeltaField::KEYFRAME) == DeltaField::KEYFRAME) {
+      throw std::runtime_error(
+          std::format("bad record {:#04x} in delta trace", mask));
+    } else {
+      if (tick == 0) {
+        throw std::runtime_error("delta trace doesn't start with a keyframe");
+      }
+      current = predict_delta_trace_record(current, header.rom);
+      if (mask & DeltaField::PC) {
+        current.pc = get<std::uint16_t>();
+      }
+      if (mask & DeltaField::W) {
+        current.w = get<std::uint8_t>();
+      }
+      if (mask & DeltaField::STATUS) {
+        current.status = get<std::uint8_t>();
+      }
+      if (mask & DeltaField::FSR) {
+        current.fsr = get<std::uint8_t>();
+      }
+      if (mask & DeltaField::RTCC) {
+        current.rtcc = get<std::uint8_t>();
+      }
+      if (mask & DeltaField::STACK) {
+        current.stack = get<std::array<std::uint16_t, 2>>();
+      }
+      if (mask & DeltaField::ONE_FILE) {
+        const auto index = get<std::uint8_t>();
+        if (index >= delta_trace_files) {
+          throw std::runtime_error(
+              std::format("bad file {:d} in delta trace", index));
+        }
+        delta_trace_file(current, index) = get<std::uint8_t>();
+      } else if (mask & DeltaField::MANY_FILES) {
+        const auto files = get<std::uint32_t>();
+        for (auto i = 0uz; i < delta_trace_files; ++i) {
+          if (files & (1u << i)) {
+            delta_trace_file(current, i) = get<std::uint8_t>();
+          }
+        }
+      }
+    }
+    indexed_offset = std::max(indexed_offset, offset);
+    ++tick;
+    return true;
+  }
+
+public:
+  explicit DeltaTraceReader(std::istream &is)
+      : DeltaTraceReader{is, read_trace_header(is)} {}
+
+  DeltaTraceReader(std::istream &is, const TraceHeader &trace)
+      : is{is}, start{is.tellg()} {
+    if (trace.magic != DeltaTraceHeader{}.trace.magic) {
+      throw std::runtime_error("not a delta trace");
+    }
+    if (trace.version != DeltaTraceHeader{}.trace.version ||
+        trace.record_size != sizeof(TraceRecord)) {
+      throw std::runtime_error(std::format(
+          "unsupported delta trace version {:d} with {:d} byte records",
+          trace.version, trace.record_size));
+    }
+    header.trace = trace;
+    is.read(reinterpret_cast<char *>(&header) + sizeof(trace),
+            sizeof(header) - sizeof(trace));
+    if (!is) {
+      throw std::runtime_error("truncated delta trace header");
+    }
+    if (start != std::istream::pos_type(-1)) {
+      start -= std::streamoff(sizeof(trace));
+    }
+    indexed_offset = offset;
+    load_index();
+  }
+
+  const std::array<OpCode, 512> &rom() const { return header.rom; }
+
+  // The tick the next read() starts at
+  std::uint64_t position() const { return tick; }
+
+  // Reads up to std::size(records) records, returning how many were read
+  std::size_t read(std::span<TraceRecord> records) {
+    auto n = 0uz;
+    while (n < std::size(records) && advance()) {
+      records[n++] = current;
+    }
+    return n;
+  }
+
+  // Positions the reader so the next record read is the one for target.
+  // Seeking backwards needs a seekable stream; forwards works on any stream.
+  void seek(const std::uint64_t target) {
+    const auto keyframe = std::ranges::upper_bound(
+        keyframes, target, {}, &DeltaTraceKeyframe::tick);
+    if (keyframe != std::begin(keyframes) &&
+        (target < tick || std::prev(keyframe)->tick > tick)) {
+      const auto [at, at_offset] = *std::prev(keyframe);
+      is.clear();
+      is.seekg(start + std::streamoff(at_offset));
+      if (!is) {
+        throw std::runtime_error("delta trace isn't seekable");
+      }
+      offset = at_offset;
+      tick = at;
+    } else if (target < tick) {
+      throw std::runtime_error(
+          std::format("can't seek back to tick {:d}", target));
+    }
+    while (tick < target && advance()) {
+    }
+  }
+};
+
+// Emulator that writes a delta trace
+class DeltaTraceEmulator final
+    : public BasicTracingEmulator<DeltaTraceEmulator> {
+private:
+  DeltaTraceWriter writer;
+
+public:
+  DeltaTraceEmulator(const std::array<OpCode, 512> &rom, std::ostream &os,
+                     const std::uint32_t keyframe_interval =
+                         DeltaTraceWriter::default_keyframe_interval)
+      : BasicTracingEmulator{rom}, writer{os, rom, keyframe_interval} {}
+
+  void record(const TraceRecord &record) { writer.write(record); }
+
+  void flush() { writer.flush(); }
+
+  void finish() { writer.finish(); }
+};
+
+} // namespace pic1650
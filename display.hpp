@@ -0,0 +1,177 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <string>
+
+#include "pic1650.hpp"
+
+namespace pic1650 {
+
+// The baseball display is multiplexed: the ROM's display routine (0x05C)
+// clears bits 0 to 5 of port D one at a time to strobe a column, drives that
+// column's 7-segment digit on port C (active low) and its LEDs on port B.
+constexpr std::size_t display_columns = 6;
+
+// What the display shows: for each column, the lit segments in the ROM's
+// digit table layout (segment a in bit 7 down to the decimal point in bit 0)
+// and the lit LEDs.
+struct Frame {
+  std::array<std::uint8_t, display_columns> segments{};
+  std::array<std::uint8_t, display_columns> leds{};
+
+  bool operator==(const Frame &) const = default;
+};
+
+// The digit table at the start of the ROM (RETLW 0xFC ... at 0x000-0x009)
+constexpr std::array<std::uint8_t, 10> digit_segments{
+    0xfc, 0x60, 0xda, 0xf2, 0x66, 0xb6, 0xbe, 0xe0, 0xfe, 0xe6};
+
+// The digit drawn by `segments`, a space when blank or ? for other patterns
+constexpr char digit(const std::uint8_t segments) {
+  if (segments == 0u) {
+    return ' ';
+  }
+  for (std::size_t value = 0; value < std::size(digit_segments); ++value) {
+    if (digit_segments[value] == segments) {
+      return static_cast<char>('0' + value);
+    }
+  }
+  return '?';
+}
+
+// Renders a frame as its digits, leftmost column first, then each column's
+// LEDs in hex.
+inline std::string to_string(const Frame &frame) {
+  std::string text;
+  for (auto column = display_columns; column-- > 0;) {
+    text += digit(frame.segments[column]);
+  }
+  for (auto column = display_columns; column-- > 0;) {
+    text += std::format(" {:02x}", frame.leds[column]);
+  }
+  return text;
+}
+
+// Rebuilds complete frames from the output latches. Each column shows what
+// the latches held for longest while it was strobed, so the brief blank and
+// half-written states between strobes don't count. Once every column has been
+// strobed, the frame is complete and is published if it differs from the
+// last one published.
+class Display {
+private:
+  std::array<std::uint8_t, 4> latches{};
+  std::uint64_t since{};
+  // The longest held segments and LEDs in the current strobe
+  std::uint64_t strobe_held{};
+  std::uint8_t strobe_segments{};
+  std::uint8_t strobe_leds{};
+  // Columns strobed since the last complete frame, one bit each
+  std::uint8_t scanned{};
+  Frame pending{};
+  Frame published{};
+  std::uint64_t published_cycle{};
+  bool any_published{};
+
+  // The column port D strobes, or display_columns when it strobes none
+  static constexpr std::size_t column(const std::uint8_t d) {
+    const auto strobed = static_cast<std::uint8_t>(~d & 0b11'1111u);
+    return std::popcount(strobed) == 1 ? std::countr_zero(strobed)
+                                       : display_columns;
+  }
+
+  bool end_strobe(const std::uint64_t cycle) {
+    const auto strobed = column(latches[3]);
+    if (strobed == display_columns) {
+      return false;
+    }
+    pending.segments[strobed] = strobe_segments;
+    pending.leds[strobed] = strobe_leds;
+    strobe_held = 0;
+    scanned |= static_cast<std::uint8_t>(1u << strobed);
+    if (scanned != (1u << display_columns) - 1u) {
+      return false;
+    }
+    scanned = 0;
+    if (any_published && pending == published) {
+      return false;
+    }
+    published = pending;
+    published_cycle = cycle;
+    any_published = true;
+    return true;
+  }
+
+public:
+  // Takes the latches as they are after `cycle` instructions, returning true
+  // when that completes a frame that differs from the last one published.
+  bool update(const std::uint64_t cycle,
+              const std::array<std::uint8_t, 4> &now) {
+    if (const auto held = cycle - since; held >= strobe_held) {
+      strobe_held = held;
+      strobe_segments = static_cast<std::uint8_t>(~latches[2]);
+      strobe_leds = latches[1];
+    }
+    const bool changed =
+        column(now[3]) != column(latches[3]) && end_strobe(cycle);
+    latches = now;
+    since = cycle;
+    return changed;
+  }
+
+  const Frame &frame() const { return published; }
+
+  // The cycle on which frame() was completed
+  std::uint64_t cycle() const { return published_cycle; }
+};
+
+// Runs an emulator while feeding a Display every change to ports B to D, and
+// hands each new frame to on_frame(cycle, frame). The emulator must only be
+// run through the watcher from then on, so that its cycle count stays right.
+template <typename Machine> class DisplayWatcher {
+private:
+  Machine &emulator;
+  Display display{};
+  std::uint64_t now{};
+
+  static std::array<std::uint8_t, 4> latches(const Machine &running) {
+    return {running.a(), running.b(), running.c(), running.d()};
+  }
+
+  static bool same_display(const std::array<std::uint8_t, 4> &x,
+                           const std::array<std::uint8_t, 4> &y) {
+    return x[1] == y[1] && x[2] == y[2] && x[3] == y[3];
+  }
+
+public:
+  explicit DisplayWatcher(Machine &emulator) : emulator{emulator} {
+    display.update(0, latches(emulator));
+  }
+
+  template <typename OnFrame>
+  void run(const std::uint64_t cycles, OnFrame on_frame) {
+    const auto end = now + cycles;
+    while (now < end) {
+      const auto before = latches(emulator);
+      now += emulator.run_until(
+          [&before](const Machine &running) {
+            return !same_display(latches(running), before);
+          },
+          end - now);
+      const auto after = latches(emulator);
+      if (!same_display(after, before) && display.update(now, after)) {
+        on_frame(display.cycle(), display.frame());
+      }
+    }
+  }
+
+  std::uint64_t cycle() const { return now; }
+
+  // The last frame published, all blank before the first
+  const Frame &frame() const { return display.frame(); }
+};
+
+} // namespace pic1650
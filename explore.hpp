@@ -0,0 +1,445 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <format>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "pic1650.hpp"
+#include "work_stealing.hpp"
+
+namespace pic1650 {
+
+// A State without its inputs, packed into 40 bytes: pc, the stack (with
+// 0x3ff for an empty entry), fsr, status, rtcc and w in the first word, then
+// the output latches and general purpose registers. Explorers choose the
+// inputs afresh on every transition, so they aren't part of the key.
+using StateKey = std::array<std::uint64_t, 5>;
+
+inline StateKey compact(const State &state) {
+  const auto entry = [](const std::uint16_t address) -> std::uint64_t {
+    return address > 0x1ffu ? 0x3ffu : address;
+  };
+  std::array<std::uint8_t, 32> bytes{};
+  std::ranges::copy(state.output_latches, std::begin(bytes));
+  std::ranges::copy(state.general_purpose_registers, std::begin(bytes) + 4);
+  const auto words = std::bit_cast<std::array<std::uint64_t, 4>>(bytes);
+  return {std::uint64_t{state.pc} | (entry(state.stack[0]) << 9) |
+              (entry(state.stack[1]) << 19) |
+              (std::uint64_t{state.fsr} << 29) |
+              (std::uint64_t{state.status} << 34) |
+              (std::uint64_t{state.rtcc} << 37) |
+              (std::uint64_t{state.w} << 45),
+          words[0], words[1], words[2], words[3]};
+}
+
+inline State expand(const StateKey &key,
+                    const std::array<std::uint8_t, 4> &inputs) {
+  const auto entry = [](const std::uint64_t address) {
+    return static_cast<std::uint16_t>(address == 0x3ffu ? 0xffffu : address);
+  };
+  const auto bytes = std::bit_cast<std::array<std::uint8_t, 32>>(
+      std::array<std::uint64_t, 4>{key[1], key[2], key[3], key[4]});
+  State state{
+      .pc = static_cast<std::uint16_t>(key[0] & 0x1ffu),
+      .stack = {entry((key[0] >> 9) & 0x3ffu), entry((key[0] >> 19) & 0x3ffu)},
+      .rtcc = static_cast<std::uint8_t>(key[0] >> 37),
+      .w = static_cast<std::uint8_t>(key[0] >> 45),
+      .fsr = static_cast<std::uint8_t>((key[0] >> 29) & 0x1fu),
+      .status = static_cast<std::uint8_t>((key[0] >> 34) & 0b111u),
+      .general_purpose_registers = {},
+      .inputs = inputs,
+      .output_latches = {},
+  };
+  std::copy_n(std::begin(bytes), 4, std::begin(state.output_latches));
+  std::copy_n(std::begin(bytes) + 4, 23,
+              std::begin(state.general_purpose_registers));
+  return state;
+}
+
+// Fixed capacity set of StateKeys that any number of threads can insert into
+// at once without locks. Slots are claimed by a compare-and-swap on their
+// tag, the key's hash with the low bit set, marked busy while the claiming
+// thread writes the key. A thread that meets a busy slot with its own tag
+// waits for the key before comparing; every other slot is passed over, so
+// inserts only ever wait on an insert of a key with the same hash.
+class ConcurrentStateSet {
+private:
+  static constexpr std::uint64_t busy = std::uint64_t{1} << 63;
+
+  std::size_t capacity;
+  std::size_t mask;
+  std::unique_ptr<std::atomic<std::uint64_t>[]> tags;
+  std::unique_ptr<StateKey[]> keys;
+  std::atomic<std::size_t> count{};
+
+  static std::uint64_t hash(const StateKey &key) {
+    std::uint64_t h = 0x9e37'79b9'7f4a'7c15u;
+    for (const auto word : key) {
+      h = (h ^ word) * 0xbf58'476d'1ce4'e5b9u;
+      h ^= h >> 31;
+    }
+    return (h & ~busy) | 1u;
+  }
+
+public:
+  // Holds up to `capacity` keys, in a table of at least twice that many
+  // slots so that probes stay short
+  explicit ConcurrentStateSet(const std::size_t capacity)
+      : capacity{capacity}, mask{std::bit_ceil(std::max(capacity, 1uz) * 2) -
+                                 1u},
+        tags{std::make_unique<std::atomic<std::uint64_t>[]>(mask + 1u)},
+        keys{std::make_unique_for_overwrite<StateKey[]>(mask + 1u)} {}
+
+  // Adds key, returning false if it was already there. Throws once the set
+  // holds `capacity` keys.
+  bool insert(const StateKey &key) {
+    const auto tag = hash(key);
+    for (auto slot = tag & mask;; slot = (slot + 1u) & mask) {
+      auto found = tags[slot].load(std::memory_order_acquire);
+      if (found == 0u) {
+        if (count.load(std::memory_order_relaxed) >= capacity) {
+          throw std::length_error(std::format(
+              "more than {:d} states; raise the state limit", capacity));
+        }
+        if (tags[slot].compare_exchange_strong(found, tag | busy,
+                                               std::memory_order_acq_rel)) {
+          keys[slot] = key;
+          tags[slot].store(tag, std::memory_order_release);
+          count.fetch_add(1, std::memory_order_relaxed);
+          return true;
+        }
+      }
+      if ((found & ~busy) == tag) {
+        while (found & busy) {
+          found = tags[slot].load(std::memory_order_acquire);
+        }
+        if (keys[slot] == key) {
+          return false;
+        }
+      }
+    }
+  }
+
+  std::size_t size() const { return count.load(std::memory_order_relaxed); }
+
+  std::size_t memory() const {
+    return (mask + 1u) * (sizeof(tags[0]) + sizeof(keys[0]));
+  }
+};
+
+// The states one level of a breadth-first search has still to expand.
+// Appends from many threads are serialized by a lock; past `limit` states
+// held in memory, the rest go to a spill file in `directory`, or to an
+// anonymous temporary file when it's empty.
+class Frontier {
+private:
+  std::size_t limit;
+  std::string directory;
+  // The spill file's path, when it has one
+  std::string path;
+  std::vector<StateKey> states;
+  std::unique_ptr<std::FILE, int (*)(std::FILE *)> spill{nullptr, std::fclose};
+  std::uint64_t spilled{};
+  std::mutex mutex;
+
+  void open() {
+    if (std::empty(directory)) {
+      spill.reset(std::tmpfile());
+    } else {
+      static std::atomic<std::uint64_t> files{};
+      path = (std::filesystem::path{directory} /
+              std::format("frontier-{:d}.bin", files.fetch_add(1)))
+                 .string();
+      spill.reset(std::fopen(path.c_str(), "w+b"));
+    }
+    if (!spill) {
+      throw std::runtime_error(
+          std::format("can't create a spill file in '{:s}'", directory));
+    }
+  }
+
+public:
+  Frontier(const std::size_t limit, std::string directory)
+      : limit{std::max(limit, 1uz)}, directory{std::move(directory)} {}
+
+  Frontier(const Frontier &) = delete;
+  Frontier &operator=(const Frontier &) = delete;
+
+  ~Frontier() {
+    spill.reset();
+    if (!std::empty(path)) {
+      std::remove(path.c_str());
+    }
+  }
+
+  void append(const std::span<const StateKey> keys) {
+    const std::lock_guard lock{mutex};
+    const auto room = std::min(std::size(keys), limit - std::size(states));
+    states.insert(std::end(states), std::begin(keys),
+                  std::begin(keys) + static_cast<std::ptrdiff_t>(room));
+    if (room == std::size(keys)) {
+      return;
+    }
+    if (!spill) {
+      open();
+    }
+    const auto rest = keys.subspan(room);
+    if (std::fwrite(std::data(rest), sizeof(StateKey), std::size(rest),
+                    spill.get()) != std::size(rest)) {
+      throw std::runtime_error("can't write to the spill file");
+    }
+    spilled += std::size(rest);
+  }
+
+  std::uint64_t size() const { return std::size(states) + spilled; }
+
+  std::uint64_t spilled_states() const { return spilled; }
+
+  // Calls visit() with every state, in spans of up to `chunk`: first those
+  // held in memory, then those read back from the spill file.
+  template <typename Visit>
+  void for_each_chunk(const std::size_t chunk, Visit visit) {
+    for (std::size_t first = 0; first < std::size(states); first += chunk) {
+      visit(std::span<const StateKey>{std::data(states) + first,
+                                      std::min(chunk,
+                                               std::size(states) - first)});
+    }
+    if (spilled == 0u) {
+      return;
+    }
+    std::rewind(spill.get());
+    std::vector<StateKey> buffer(chunk);
+    for (auto left = spilled; left != 0u;) {
+      const auto n = static_cast<std::size_t>(std::min<std::uint64_t>(
+          left, chunk));
+      if (std::fread(std::data(buffer), sizeof(StateKey), n, spill.get()) !=
+          n) {
+        throw std::runtime_error("can't read back the spill file");
+      }
+      visit(std::span<const StateKey>{std::data(buffer), n});
+      left -= n;
+    }
+  }
+};
+
+// The input vectors with nothing pressed and with each input bit in `mask`
+// (bit 8 * port + bit) pulled low on its own
+inline std::vector<std::array<std::uint8_t, 4>>
+single_inputs(const std::uint32_t mask = 0xffff'ffffu) {
+  std::vector<std::array<std::uint8_t, 4>> inputs{{0xffu, 0xffu, 0xffu, 0xffu}};
+  for (std::size_t pin = 0; pin < 32; ++pin) {
+    if ((mask >> pin) & 1u) {
+      auto vector = inputs.front();
+      vector[pin / 8] &= static_cast<std::uint8_t>(~(1u << (pin % 8)));
+      inputs.push_back(vector);
+    }
+  }
+  return inputs;
+}
+
+struct ExploreOptions {
+  // Input vectors tried from every state, each held for one transition
+  std::vector<std::array<std::uint8_t, 4>> inputs{single_inputs()};
+  std::uint64_t cycles_per_step{10'000};
+  std::size_t max_depth{8};
+  std::size_t threads{std::max(std::thread::hardware_concurrency(), 1u)};
+  // Distinct states the search may find before it gives up
+  std::size_t max_states{1uz << 20};
+  // Frontier states held in memory per level before spilling to disk
+  std::size_t frontier_memory{1uz << 22};
+  // Where spill files go; an anonymous temporary file is used when empty
+  std::string spill_directory{};
+  // How many stuck and faulting states to keep as examples
+  std::size_t examples{8};
+};
+
+struct ExploreReport {
+  // Distinct states, including the start, and transitions tried
+  std::uint64_t states{};
+  std::uint64_t transitions{};
+  // New states found at each depth, the start being depth 0
+  std::vector<std::uint64_t> levels;
+  // True when no new states were left to expand before max_depth
+  bool exhausted{};
+  // Addresses executed, or about to be, on some transition
+  std::array<bool, 512> reached{};
+  // States that no input vector moves anywhere but rtcc, and transitions
+  // that stopped short at an indirect access with fsr 0, which the
+  // emulator can't execute
+  std::uint64_t stuck{};
+  std::uint64_t faults{};
+  std::vector<State> stuck_examples;
+  std::vector<State> fault_examples;
+  std::uint64_t spilled{};
+  std::size_t set_memory{};
+};
+
+// Emulator that can tell, before running it, whether the next instruction
+// goes through the indirect file 0 with fsr 0
+class ExploringEmulator final : public BasicEmulator<ExploringEmulator> {
+public:
+  using BasicEmulator::BasicEmulator;
+
+  bool faults_next() const {
+    const auto &instruction = program[pc];
+    return has_file_operand(instruction.mnemonic) && instruction.f == INDF &&
+           fsr() == 0u;
+  }
+};
+
+// Searches breadth first, to options.max_depth transitions, the states
+// reachable from `start` by holding each input vector for cycles_per_step
+// instructions. Every state is expanded once: new states are found with a
+// ConcurrentStateSet and expanded, one level at a time, by all
+// options.threads. visit(state, depth) is called, from any thread, for each
+// new state.
+template <typename Visit>
+ExploreReport explore(const std::array<OpCode, 512> &rom, const State &start,
+                      const ExploreOptions &options, Visit visit) {
+  struct Worker {
+    ExploringEmulator emulator;
+    std::vector<StateKey> found{};
+    std::array<bool, 512> reached{};
+    std::uint64_t transitions{};
+    std::uint64_t stuck{};
+    std::uint64_t faults{};
+    std::vector<State> stuck_examples{};
+    std::vector<State> fault_examples{};
+  };
+  constexpr std::size_t flush = 4096;
+  constexpr std::size_t chunk = 1uz << 16;
+  constexpr std::uint64_t rtcc_bits = std::uint64_t{0xffu} << 37;
+
+  ExploreReport report;
+  ConcurrentStateSet seen{options.max_states};
+  const auto threads = std::max(options.threads, 1uz);
+  const ExploringEmulator prototype{rom};
+  std::vector<Worker> workers;
+  for (auto i = 0uz; i < threads; ++i) {
+    workers.push_back({.emulator = prototype});
+  }
+
+  auto current = std::make_unique<Frontier>(options.frontier_memory,
+                                            options.spill_directory);
+  const auto first = compact(start);
+  seen.insert(first);
+  current->append({&first, 1});
+  report.levels.push_back(1);
+  visit(start, 0uz);
+
+  for (auto depth = 1uz; depth <= options.max_depth && current->size() != 0u;
+       ++depth) {
+    auto next = std::make_unique<Frontier>(options.frontier_memory,
+                                           options.spill_directory);
+    const auto expand_state = [&](const StateKey &key, Worker &worker) {
+      bool moved = false;
+      bool faulted = false;
+      auto &emulator = worker.emulator;
+      for (const auto &inputs : options.inputs) {
+        ++worker.transitions;
+        emulator.restore(expand(key, inputs));
+        worker.reached[emulator.PC()] = true;
+        const auto executed =
+            emulator.faults_next()
+                ? 0u
+                : emulator.run_until(
+                      [&worker](const ExploringEmulator &emulator) {
+                        worker.reached[emulator.PC()] = true;
+                        return emulator.faults_next();
+                      },
+                      options.cycles_per_step);
+        if (executed < options.cycles_per_step) {
+          faulted = true;
+          continue;
+        }
+        const auto state = emulator.snapshot();
+        const auto successor = compact(state);
+        moved = moved || (successor[0] & ~rtcc_bits) != (key[0] & ~rtcc_bits) ||
+                !std::equal(std::begin(key) + 1, std::end(key),
+                            std::begin(successor) + 1);
+        if (seen.insert(successor)) {
+          visit(state, depth);
+          worker.found.push_back(successor);
+          if (std::size(worker.found) >= flush) {
+            next->append(worker.found);
+            worker.found.clear();
+          }
+        }
+      }
+      const auto example = [&](std::vector<State> &examples) {
+        if (std::size(examples) < options.examples) {
+          examples.push_back(expand(key, options.inputs.front()));
+        }
+      };
+      if (faulted) {
+        ++worker.faults;
+        example(worker.fault_examples);
+      } else if (!moved) {
+        ++worker.stuck;
+        example(worker.stuck_examples);
+      }
+    };
+
+    current->for_each_chunk(chunk, [&](const std::span<const StateKey> keys) {
+      parallel_for(std::size(keys), threads,
+                   [&](const std::size_t index, const std::size_t worker) {
+                     expand_state(keys[index], workers[worker]);
+                   });
+    });
+    for (auto &worker : workers) {
+      next->append(worker.found);
+      worker.found.clear();
+    }
+    report.spilled += current->spilled_states();
+    report.levels.push_back(next->size());
+    current = std::move(next);
+  }
+  report.spilled += current->spilled_states();
+  report.exhausted = current->size() == 0u;
+
+  for (const auto &worker : workers) {
+    report.transitions += worker.transitions;
+    report.stuck += worker.stuck;
+    report.faults += worker.faults;
+    for (auto address = 0uz; address < std::size(report.reached);
+         ++address) {
+      report.reached[address] =
+          report.reached[address] || worker.reached[address];
+    }
+    for (const auto &state : worker.stuck_examples) {
+      if (std::size(report.stuck_examples) < options.examples) {
+        report.stuck_examples.push_back(state);
+      }
+    }
+    for (const auto &state : worker.fault_examples) {
+      if (std::size(report.fault_examples) < options.examples) {
+        report.fault_examples.push_back(state);
+      }
+    }
+  }
+  report.states = seen.size();
+  report.set_memory = seen.memory();
+  return report;
+}
+
+inline ExploreReport explore(const std::array<OpCode, 512> &rom,
+                             const State &start,
+                             const ExploreOptions &options = {}) {
+  return explore(rom, start, options, [](const State &, std::size_t) {});
+}
+
+} // namespace pic1650
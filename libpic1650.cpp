@@ -0,0 +1,259 @@
+// The C ABI of libpic1650.h over Emulator. Nothing may throw across it, so
+// allocation failures are caught and returned as PIC1650_OUT_OF_MEMORY.
+
+#include "libpic1650.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <new>
+#include <optional>
+#include <vector>
+
+#include "pic1650.hpp"
+
+// The layouts are part of the ABI
+static_assert(sizeof(pic1650_state) == 56);
+static_assert(sizeof(pic1650_input_event) == 16);
+static_assert(sizeof(pic1650_latch_change) == 16);
+
+struct pic1650_emulator {
+  std::optional<pic1650::Emulator> emulator;
+  std::uint64_t cycle{};
+  // Input events from next on are pending, in cycle order
+  std::vector<pic1650_input_event> events;
+  std::size_t next{};
+};
+
+namespace {
+
+std::array<std::uint8_t, 4> latches(const pic1650::Emulator &emulator) {
+  return {emulator.a(), emulator.b(), emulator.c(), emulator.d()};
+}
+
+void apply_due_inputs(pic1650_emulator &handle) {
+  for (; handle.next < std::size(handle.events) &&
+         handle.events[handle.next].cycle <= handle.cycle;
+       ++handle.next) {
+    const auto &event = handle.events[handle.next];
+    handle.emulator->input(event.port, event.bit, event.high != 0u);
+  }
+  if (handle.next == std::size(handle.events)) {
+    handle.events.clear();
+    handle.next = 0;
+  }
+}
+
+// Runs up to `cycles` instructions in segments that end at input events.
+// run_segment(budget) runs at most `budget` instructions and returns how
+// many it ran; running fewer ends the step there.
+template <typename RunSegment>
+void advance(pic1650_emulator &handle, const std::uint64_t cycles,
+             RunSegment run_segment) {
+  const auto end =
+      handle.cycle + std::min(cycles, std::numeric_limits<std::uint64_t>::max() -
+                                          handle.cycle);
+  while (true) {
+    apply_due_inputs(handle);
+    if (handle.cycle == end) {
+      return;
+    }
+    auto budget = end - handle.cycle;
+    if (handle.next < std::size(handle.events)) {
+      budget = std::min(budget, handle.events[handle.next].cycle - handle.cycle);
+    }
+    const auto ran = run_segment(budget);
+    handle.cycle += ran;
+    if (ran < budget) {
+      return;
+    }
+  }
+}
+
+} // namespace
+
+extern "C" {
+
+std::uint32_t pic1650_abi_version(void) { return PIC1650_ABI_VERSION; }
+
+pic1650_emulator *pic1650_create(void) {
+  return new (std::nothrow) pic1650_emulator{};
+}
+
+void pic1650_destroy(pic1650_emulator *emulator) { delete emulator; }
+
+pic1650_status pic1650_load_rom(pic1650_emulator *emulator, const void *image,
+                                const std::size_t size) {
+  std::array<pic1650::OpCode, 512> rom;
+  if (emulator == nullptr || image == nullptr || size != std::size(rom) * 2u) {
+    return PIC1650_BAD_ARGUMENT;
+  }
+  const auto bytes = static_cast<const std::uint8_t *>(image);
+  for (std::size_t i = 0; i < std::size(rom); ++i) {
+    rom[i] = static_cast<pic1650::OpCode>(bytes[2u * i] |
+                                          (bytes[2u * i + 1u] << 8));
+  }
+  emulator->emulator.emplace(rom);
+  emulator->cycle = 0;
+  emulator->events.clear();
+  emulator->next = 0;
+  return PIC1650_OK;
+}
+
+pic1650_status pic1650_submit_inputs(pic1650_emulator *emulator,
+                                     const pic1650_input_event *events,
+                                     const std::size_t count) {
+  if (emulator == nullptr || (events == nullptr && count != 0u)) {
+    return PIC1650_BAD_ARGUMENT;
+  }
+  if (!emulator->emulator) {
+    return PIC1650_NO_ROM;
+  }
+  const auto bad = [emulator](const pic1650_input_event &event) {
+    return event.cycle < emulator->cycle || event.port >= 4u ||
+           event.bit >= 8u;
+  };
+  if (std::any_of(events, events + count, bad)) {
+    return PIC1650_BAD_ARGUMENT;
+  }
+  try {
+    emulator->events.insert(std::end(emulator->events), events,
+                            events + count);
+  } catch (const std::bad_alloc &) {
+    return PIC1650_OUT_OF_MEMORY;
+  }
+  std::stable_sort(std::begin(emulator->events) +
+                       static_cast<std::ptrdiff_t>(emulator->next),
+                   std::end(emulator->events),
+                   [](const pic1650_input_event &x,
+                      const pic1650_input_event &y) { return x.cycle < y.cycle; });
+  return PIC1650_OK;
+}
+
+pic1650_status pic1650_step(pic1650_emulator *emulator,
+                            const std::uint64_t cycles) {
+  if (emulator == nullptr) {
+    return PIC1650_BAD_ARGUMENT;
+  }
+  if (!emulator->emulator) {
+    return PIC1650_NO_ROM;
+  }
+  advance(*emulator, cycles, [emulator](const std::uint64_t budget) {
+    emulator->emulator->run(budget);
+    return budget;
+  });
+  return PIC1650_OK;
+}
+
+pic1650_status pic1650_step_latches(pic1650_emulator *emulator,
+                                    const std::uint64_t cycles,
+                                    pic1650_latch_change *changes,
+                                    const std::size_t capacity,
+                                    std::size_t *written) {
+  if (emulator == nullptr || written == nullptr ||
+      (changes == nullptr && capacity != 0u)) {
+    return PIC1650_BAD_ARGUMENT;
+  }
+  *written = 0;
+  if (!emulator->emulator) {
+    return PIC1650_NO_ROM;
+  }
+  auto &machine = *emulator->emulator;
+  advance(*emulator, cycles, [&](const std::uint64_t budget) {
+    std::uint64_t ran = 0;
+    while (ran < budget && *written < capacity) {
+      const auto before = latches(machine);
+      ran += machine.run_until(
+          [&before](const pic1650::Emulator &running) {
+            return latches(running) != before;
+          },
+          budget - ran);
+      if (const auto after = latches(machine); after != before) {
+        auto &change = changes[(*written)++];
+        change = {.cycle = emulator->cycle + ran,
+                  .output_latches = {},
+                  .reserved = {}};
+        std::ranges::copy(after, change.output_latches);
+      }
+    }
+    return ran;
+  });
+  return PIC1650_OK;
+}
+
+pic1650_status pic1650_snapshot(const pic1650_emulator *emulator,
+                                pic1650_state *state) {
+  if (emulator == nullptr || state == nullptr) {
+    return PIC1650_BAD_ARGUMENT;
+  }
+  if (!emulator->emulator) {
+    return PIC1650_NO_ROM;
+  }
+  const auto snapshot = emulator->emulator->snapshot();
+  *state = {.cycle = emulator->cycle,
+            .pc = snapshot.pc,
+            .stack = {snapshot.stack[0], snapshot.stack[1]},
+            .rtcc = snapshot.rtcc,
+            .w = snapshot.w,
+            .fsr = snapshot.fsr,
+            .status = snapshot.status,
+            .general_purpose_registers = {},
+            .inputs = {},
+            .output_latches = {},
+            .reserved = {}};
+  std::ranges::copy(snapshot.general_purpose_registers,
+                    state->general_purpose_registers);
+  std::ranges::copy(snapshot.inputs, state->inputs);
+  std::ranges::copy(snapshot.output_latches, state->output_latches);
+  return PIC1650_OK;
+}
+
+pic1650_status pic1650_latches(const pic1650_emulator *emulator,
+                               std::uint8_t *latches) {
+  if (emulator == nullptr || latches == nullptr) {
+    return PIC1650_BAD_ARGUMENT;
+  }
+  if (!emulator->emulator) {
+    return PIC1650_NO_ROM;
+  }
+  std::ranges::copy(::latches(*emulator->emulator), latches);
+  return PIC1650_OK;
+}
+
+pic1650_status pic1650_restore(pic1650_emulator *emulator,
+                               const pic1650_state *state) {
+  if (emulator == nullptr || state == nullptr) {
+    return PIC1650_BAD_ARGUMENT;
+  }
+  if (!emulator->emulator) {
+    return PIC1650_NO_ROM;
+  }
+  const auto return_address = [](const std::uint16_t address) {
+    return address < 512u || address == 0xffffu;
+  };
+  if (state->pc >= 512u || !return_address(state->stack[0]) ||
+      !return_address(state->stack[1]) || state->fsr >= 32u ||
+      state->status >= 8u) {
+    return PIC1650_BAD_ARGUMENT;
+  }
+  pic1650::State restored{.pc = state->pc,
+                          .stack = {state->stack[0], state->stack[1]},
+                          .rtcc = state->rtcc,
+                          .w = state->w,
+                          .fsr = state->fsr,
+                          .status = state->status};
+  std::ranges::copy(state->general_purpose_registers,
+                    std::begin(restored.general_purpose_registers));
+  std::ranges::copy(state->inputs, std::begin(restored.inputs));
+  std::ranges::copy(state->output_latches,
+                    std::begin(restored.output_latches));
+  emulator->emulator->restore(restored);
+  emulator->cycle = state->cycle;
+  emulator->events.clear();
+  emulator->next = 0;
+  return PIC1650_OK;
+}
+
+} // extern "C"
@@ -0,0 +1,134 @@
+/* The emulator as a shared library with a C ABI, for driving it from other
+ * languages. Work is done in batches: queue the input events for a stretch
+ * of the game, run it with one call, and read back the state or every change
+ * of the output latches into buffers the caller owns.
+ *
+ * Every function taking an emulator returns PIC1650_BAD_ARGUMENT when it is
+ * NULL. A handle may be used from any thread, but from one at a time. */
+
+#ifndef LIBPIC1650_H
+#define LIBPIC1650_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#if defined(PIC1650_BUILDING_LIBRARY)
+#define PIC1650_API __declspec(dllexport)
+#else
+#define PIC1650_API __declspec(dllimport)
+#endif
+#elif defined(__GNUC__)
+#define PIC1650_API __attribute__((visibility("default")))
+#else
+#define PIC1650_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Bumped whenever a function or structure below changes incompatibly */
+#define PIC1650_ABI_VERSION 1
+
+typedef int32_t pic1650_status;
+
+#define PIC1650_OK 0
+#define PIC1650_BAD_ARGUMENT 1
+/* No ROM has been loaded yet */
+#define PIC1650_NO_ROM 2
+#define PIC1650_OUT_OF_MEMORY 3
+
+typedef struct pic1650_emulator pic1650_emulator;
+
+/* The whole machine state, and the number of instructions run since the ROM
+ * was loaded */
+typedef struct pic1650_state {
+  uint64_t cycle;
+  uint16_t pc;
+  /* Return addresses, most recent first, 0xFFFF when empty */
+  uint16_t stack[2];
+  uint8_t rtcc;
+  uint8_t w;
+  uint8_t fsr;
+  /* C, DC and Z in bits 0 to 2 */
+  uint8_t status;
+  /* Files 9 to 31 */
+  uint8_t general_purpose_registers[23];
+  /* Ports A to D: the levels driven onto the input pins, and the latches */
+  uint8_t inputs[4];
+  uint8_t output_latches[4];
+  uint8_t reserved[7];
+} pic1650_state;
+
+/* Sets input pin `bit` of `port` (0 to 3 for A to D) once `cycle`
+ * instructions have run since the ROM was loaded. The pins float high, and
+ * pressing a key pulls one low. */
+typedef struct pic1650_input_event {
+  uint64_t cycle;
+  uint8_t port;
+  uint8_t bit;
+  uint8_t high;
+  uint8_t reserved[5];
+} pic1650_input_event;
+
+/* The output latches of ports A to D after the instruction on `cycle`
+ * changed them */
+typedef struct pic1650_latch_change {
+  uint64_t cycle;
+  uint8_t output_latches[4];
+  uint8_t reserved[4];
+} pic1650_latch_change;
+
+PIC1650_API uint32_t pic1650_abi_version(void);
+
+/* Returns a new emulator with no ROM loaded, or NULL when out of memory */
+PIC1650_API pic1650_emulator *pic1650_create(void);
+
+PIC1650_API void pic1650_destroy(pic1650_emulator *emulator);
+
+/* Loads a ROM image laid out as tandybaseball.bin is: 512 little-endian
+ * 16-bit opcodes, 1024 bytes in all. The machine is reset to its power-on
+ * state at cycle 0, and pending input events are dropped. */
+PIC1650_API pic1650_status pic1650_load_rom(pic1650_emulator *emulator,
+                                            const void *image, size_t size);
+
+/* Queues `count` input events, which may be in any order but not before the
+ * current cycle. Events on the same cycle apply in the order submitted. On
+ * error none of them are queued. */
+PIC1650_API pic1650_status
+pic1650_submit_inputs(pic1650_emulator *emulator,
+                      const pic1650_input_event *events, size_t count);
+
+/* Runs `cycles` instructions, applying queued input events as their cycles
+ * come up */
+PIC1650_API pic1650_status pic1650_step(pic1650_emulator *emulator,
+                                        uint64_t cycles);
+
+/* Runs like pic1650_step(), and writes every change of the output latches
+ * to `changes`. Stops early once `capacity` changes have been written; the
+ * number written goes to `written`, and the cycle reached can be read with
+ * pic1650_snapshot(). */
+PIC1650_API pic1650_status pic1650_step_latches(pic1650_emulator *emulator,
+                                                uint64_t cycles,
+                                                pic1650_latch_change *changes,
+                                                size_t capacity,
+                                                size_t *written);
+
+PIC1650_API pic1650_status pic1650_snapshot(const pic1650_emulator *emulator,
+                                            pic1650_state *state);
+
+/* Writes the output latches of ports A to D to `latches[0..3]` */
+PIC1650_API pic1650_status pic1650_latches(const pic1650_emulator *emulator,
+                                           uint8_t *latches);
+
+/* Puts the machine back in a state taken by pic1650_snapshot(), dropping
+ * pending input events */
+PIC1650_API pic1650_status pic1650_restore(pic1650_emulator *emulator,
+                                           const pic1650_state *state);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,422 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "pic1650.hpp"
+
+namespace pic1650 {
+
+// Whether an instruction reads and writes w
+constexpr bool reads_w(const Mnemonic mnemonic) {
+  switch (mnemonic) {
+  case Mnemonic::MOVWF:
+  case Mnemonic::SUBWF:
+  case Mnemonic::IORWF:
+  case Mnemonic::ANDWF:
+  case Mnemonic::XORWF:
+  case Mnemonic::ADDWF:
+  case Mnemonic::IORLW:
+  case Mnemonic::ANDLW:
+  case Mnemonic::XORLW:
+    return true;
+  default:
+    return false;
+  }
+}
+
+constexpr bool writes_w(const Instruction &instruction) {
+  switch (instruction.mnemonic) {
+  case Mnemonic::CLRW:
+  case Mnemonic::RETLW:
+  case Mnemonic::MOVLW:
+  case Mnemonic::IORLW:
+  case Mnemonic::ANDLW:
+  case Mnemonic::XORLW:
+    return true;
+  case Mnemonic::MOVWF:
+  case Mnemonic::CLRF:
+  case Mnemonic::BCF:
+  case Mnemonic::BSF:
+  case Mnemonic::BTFSC:
+  case Mnemonic::BTFSS:
+    return false;
+  default:
+    return has_file_operand(instruction.mnemonic) && instruction.d == 0u;
+  }
+}
+
+struct MemoOptions {
+  // Cached calls, in sets of MemoizingEmulator::ways
+  std::size_t entries{4096};
+  // Calls that run longer than this before returning aren't cached, and
+  // their callee isn't recorded again
+  std::uint32_t max_cycles{65536};
+};
+
+struct MemoStats {
+  // CALLs looked up in the cache by run(), and those found there
+  std::uint64_t lookups{};
+  std::uint64_t hits{};
+  // Instructions stood in for by cache hits
+  std::uint64_t cycles_replayed{};
+  std::uint64_t recorded{};
+  // Recordings given up, for running too long, nesting deeper than the
+  // stack, or the inputs changing part way through
+  std::uint64_t abandoned{};
+  std::uint64_t evictions{};
+  // Bytes taken by the cache, which don't grow however long it runs
+  std::size_t memory{};
+
+  double hit_rate() const {
+    return lookups == 0u ? 0.0
+                         : static_cast<double>(hits) /
+                               static_cast<double>(lookups);
+  }
+};
+
+// Emulator that caches the effect of subroutines. The first time run() meets
+// a CALL whose result isn't cached, it records, instruction by instruction,
+// which files, w, STATUS bits and inputs the call reads before writing them,
+// and the final values of everything it writes, up to the matching RETLW.
+// The same call later, with the same values in what it read, can only take
+// the same path, so run() applies the recorded writes and cycle count instead
+// of executing it. Reads of pc are left out, being fixed by the path.
+//
+// Results are kept in a set associative cache keyed by callee and the values
+// of everything that callee has been seen to read on any path, so that a
+// lookup is one probe; a call that reads something new is recorded again
+// under the wider key. The least recently used entry of a set is evicted,
+// so memory stays fixed on long runs. tick() and run_until() always
+// execute, recording as they go, and calls made while recording are run
+// rather than looked up.
+class MemoizingEmulator final : public BasicEmulator<MemoizingEmulator> {
+public:
+  static constexpr std::size_t ways = 4;
+
+private:
+  // What a call read before writing it
+  struct Shape {
+    std::uint32_t files{};
+    std::uint8_t status{};
+    std::uint8_t inputs{};
+    bool w{};
+
+    bool operator==(const Shape &) const = default;
+  };
+
+  // The values read, packed in file order, then w, STATUS and the inputs,
+  // and padded with zeros
+  using Values = std::array<std::uint8_t, 40>;
+
+  struct Entry {
+    // Last use
+    std::uint64_t used{};
+    std::uint16_t callee{};
+    Shape shape{};
+    Values read{};
+    // What the call leaves behind. STATUS bits are in written_status and
+    // status, not in written.
+    std::uint32_t written{};
+    std::array<std::uint8_t, 32> files{};
+    std::uint8_t written_status{};
+    std::uint8_t status{};
+    bool written_w{};
+    std::uint8_t w{};
+    // Whether the call made a call of its own, which empties the stack
+    bool nested{};
+    std::uint32_t cycles{};
+  };
+
+  struct Recording {
+    std::uint16_t callee{};
+    std::array<std::uint8_t, 32> registers{};
+    std::uint8_t w{};
+    std::array<std::uint8_t, 4> inputs{};
+    Shape shape{};
+    std::uint32_t written{};
+    std::uint8_t written_status{};
+    bool written_w{};
+    bool nested{};
+    std::uint32_t depth{};
+    std::uint32_t cycles{};
+  };
+
+  MemoOptions options;
+  std::vector<Entry> cache;
+  // The hash of each entry's key, with the low bit set, or 0 when it's
+  // empty. Probes compare these, which for a set fit in one cache line,
+  // before touching the entries themselves.
+  std::vector<std::uint64_t> tags;
+  std::size_t sets;
+  // Everything each callee has been seen to read
+  std::array<Shape, 512> shapes{};
+  // Callees that ran too long or nested too deep when recorded
+  std::array<bool, 512> uncacheable{};
+  bool recording{};
+  Recording current{};
+  std::uint64_t clock{};
+  MemoStats stats{};
+
+  static Values gather(const Shape &shape,
+                       const std::array<std::uint8_t, 32> &registers,
+                       const std::uint8_t w,
+                       const std::array<std::uint8_t, 4> &inputs) {
+    Values values{};
+    std::size_t n = 0;
+    for (auto files = shape.files; files != 0u; files &= files - 1u) {
+      values[n++] = registers[std::countr_zero(files)];
+    }
+    if (shape.w) {
+      values[n++] = w;
+    }
+    values[n++] = registers[STATUS] & shape.status;
+    for (std::size_t port = 0; port < std::size(inputs); ++port) {
+      if ((shape.inputs >> port) & 1u) {
+        values[n++] = inputs[port];
+      }
+    }
+    return values;
+  }
+
+  static std::uint64_t hash(const std::uint16_t callee, const Shape &shape,
+                          const Values &values) {
+    std::uint64_t h = 0xcbf2'9ce4'8422'2325u;
+    const auto mix = [&h](const std::uint64_t x) {
+      h = (h ^ x) * 0x100'0000'01b3u;
+    };
+    mix(callee);
+    mix(shape.files);
+    mix(shape.status | (shape.inputs << 3) | (shape.w ? 0x80u : 0u));
+    for (const auto x : std::bit_cast<std::array<std::uint64_t, 5>>(values)) {
+      mix(x);
+    }
+    return (h ^ (h >> 32)) | 1u;
+  }
+
+  Entry *find(const std::uint16_t callee) {
+    const auto &shape = shapes[callee];
+    const auto read = gather(shape, registers, w, inputs);
+    const auto tag = hash(callee, shape, read);
+    const auto set = static_cast<std::size_t>(tag % sets);
+    for (auto way = set * ways; way < (set + 1u) * ways; ++way) {
+      auto &entry = cache[way];
+      if (tags[way] == tag && entry.callee == callee &&
+          entry.shape == shape && entry.read == read) {
+        return &entry;
+      }
+    }
+    return nullptr;
+  }
+
+  void apply(const Entry &entry) {
+    for (auto files = entry.written; files != 0u; files &= files - 1u) {
+      const auto f = std::countr_zero(files);
+      registers[f] = entry.files[f];
+    }
+    if ((entry.written & (1u << RTCC)) == 0u) {
+      registers[RTCC] += static_cast<std::uint8_t>(entry.cycles);
+    }
+    registers[STATUS] = static_cast<std::uint8_t>(
+        (registers[STATUS] & ~entry.written_status) | entry.status);
+    if (entry.written_w) {
+      w = entry.w;
+    }
+    // As the CALL and its RETLW would have left the stack
+    stack = {entry.nested ? std::uint16_t{0xffffu} : stack[0], 0xffffu};
+    increment_pc();
+  }
+
+  void start(const std::uint16_t callee) {
+    current = {.callee = callee,
+               .registers = registers,
+               .w = w,
+               .inputs = inputs,
+               .shape = {},
+               .written = 0,
+               .written_status = 0,
+               .written_w = false,
+               .nested = false,
+               .depth = 0,
+               .cycles = 0};
+    recording = true;
+  }
+
+  // Gives up a recording that can't be cached, and stops recording the callee
+  void abandon() {
+    recording = false;
+    uncacheable[current.callee] = true;
+    ++stats.abandoned;
+  }
+
+  void note_read(const std::uint8_t f) {
+    if (f == PCL) {
+      return;
+    }
+    if (f == STATUS) {
+      current.shape.status |= 0b111u & ~current.written_status;
+      return;
+    }
+    if ((current.written & (1u << f)) == 0u) {
+      current.shape.files |= 1u << f;
+    }
+    // Port reads see the inputs, whoever wrote the latch
+    if (f >= PORTA && f < GPR) {
+      current.shape.inputs |= 1u << (f - PORTA);
+    }
+  }
+
+  void note_write(const std::uint8_t f) {
+    if (f == STATUS) {
+      current.written_status = 0b111u;
+    } else if (f != PCL) {
+      current.written |= 1u << f;
+    }
+  }
+
+  void finish() {
+    recording = false;
+    if (inputs != current.inputs) {
+      ++stats.abandoned;
+      return;
+    }
+    const auto callee = current.callee;
+    auto &shape = shapes[callee];
+    shape.files |= current.shape.files;
+    shape.status |= current.shape.status;
+    shape.inputs |= current.shape.inputs;
+    shape.w = shape.w || current.shape.w;
+
+    // The values read, as they were when the call was made
+    const auto read =
+        gather(shape, current.registers, current.w, current.inputs);
+
+    const auto tag = hash(callee, shape, read);
+    const auto set = static_cast<std::size_t>(tag % sets);
+    // An empty way, or else the least recently used
+    auto victim = set * ways;
+    for (auto way = victim + 1u; way < (set + 1u) * ways && tags[victim] != 0u;
+         ++way) {
+      if (tags[way] == 0u || cache[way].used < cache[victim].used) {
+        victim = way;
+      }
+    }
+    if (tags[victim] != 0u) {
+      ++stats.evictions;
+    }
+    tags[victim] = tag;
+    auto *entry = &cache[victim];
+    *entry = {.used = ++clock,
+              .callee = callee,
+              .shape = shape,
+              .read = read,
+              .written = current.written,
+              .files = registers,
+              .written_status = current.written_status,
+              .status = static_cast<std::uint8_t>(registers[STATUS] &
+                                                  current.written_status),
+              .written_w = current.written_w,
+              .w = w,
+              .nested = current.nested,
+              .cycles = current.cycles};
+    ++stats.recorded;
+  }
+
+public:
+  explicit MemoizingEmulator(const std::array<OpCode, 512> &rom,
+                             const MemoOptions &options = {})
+      : BasicEmulator{rom}, options{options},
+        cache(std::max(options.entries / ways, 1uz) * ways),
+        tags(std::size(cache)), sets{std::size(cache) / ways} {}
+
+  void tick() {
+    if (!recording) {
+      BasicEmulator::tick();
+      return;
+    }
+
+    // What the instruction reads is noted before it runs, so that fsr and
+    // the written set are as it finds them
+    const auto &instruction = program[pc];
+    const auto mnemonic = instruction.mnemonic;
+    std::uint8_t f = instruction.f;
+    const bool file = has_file_operand(mnemonic);
+    if (file && f == INDF) {
+      note_read(FSR);
+      f = fsr();
+    }
+    if (file && reads_file(mnemonic)) {
+      note_read(f);
+    }
+    if (reads_w(mnemonic) && !current.written_w) {
+      current.shape.w = true;
+    }
+    current.shape.status |= reads_status(mnemonic) & ~current.written_status;
+
+    BasicEmulator::tick();
+    ++current.cycles;
+
+    if (file && writes_file(instruction)) {
+      note_write(f);
+    }
+    current.written_w = current.written_w || writes_w(instruction);
+    current.written_status |= writes_status(mnemonic);
+
+    if (mnemonic == Mnemonic::CALL) {
+      // A third level would lose the return address the call started with
+      current.nested = current.nested || current.depth != 0u;
+      if (++current.depth > std::size(stack)) {
+        abandon();
+        return;
+      }
+    } else if (mnemonic == Mnemonic::RETLW && --current.depth == 0u) {
+      finish();
+      return;
+    }
+    if (current.cycles >= options.max_cycles) {
+      abandon();
+    }
+  }
+
+  // Runs `cycles` instructions, with the same effect as calling tick() that
+  // many times, replaying cached calls that fit in what is left.
+  void run(const std::uint64_t cycles) {
+    for (auto left = cycles; left != 0u;) {
+      if (!recording && program[pc].mnemonic == Mnemonic::CALL &&
+          !uncacheable[program[pc].k]) {
+        const auto callee = program[pc].k;
+        ++stats.lookups;
+        if (auto *entry = find(callee); entry == nullptr) {
+          start(callee);
+        } else if (entry->cycles <= left) {
+          entry->used = ++clock;
+          apply(*entry);
+          ++stats.hits;
+          stats.cycles_replayed += entry->cycles;
+          left -= entry->cycles;
+          continue;
+        }
+      }
+      tick();
+      --left;
+    }
+  }
+
+  void restore(const State &state) {
+    BasicEmulator::restore(state);
+    recording = false;
+  }
+
+  MemoStats memo_stats() const {
+    auto report = stats;
+    report.memory = std::size(cache) * (sizeof(Entry) + sizeof(tags[0])) +
+                    sizeof(shapes);
+    return report;
+  }
+};
+
+} // namespace pic1650
@@ -0,0 +1,654 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+#include "pic1650.hpp"
+
+namespace pic1650 {
+
+// Runs Lanes independent copies of the same ROM in lockstep. The state is
+// stored as structure-of-arrays: the register file of BasicEmulator, with
+// one array of Lanes bytes per file, and likewise w, pc, the inputs and the
+// stack.
+//
+// The instructions are the BasicOpCodes handlers of Pass, each a few loops
+// over those arrays, which the compiler turns into AVX2 or AVX-512 code when
+// allowed to (see PIC1650_NATIVE in CMakeLists.txt). While every lane is at
+// the same address, an instruction is one pass over all lanes. Once lanes
+// split up, they are grouped by address and each group runs as a pass with
+// a mask selecting its lanes, or on its own when a lane is alone, until the
+// lanes come back together.
+template <std::size_t Lanes, Device D = devices::pic1650> class MultiEmulator {
+  static_assert(Lanes > 0 && Lanes < 0xffffu);
+
+public:
+  using Bytes = std::array<std::uint8_t, Lanes>;
+  using State = BasicState<D>;
+
+  static constexpr Device device = D;
+
+private:
+  // 0xff for lanes taking part in the current instruction, 0 otherwise
+  using Mask = Bytes;
+  using Addresses = std::array<std::uint16_t, Lanes>;
+
+  static constexpr std::size_t rom_words = D.rom_words;
+  static constexpr std::uint16_t pc_mask = D.pc_mask();
+  static constexpr std::uint8_t GPR = PORTA + D.ports;
+  static constexpr std::array<std::uint8_t, 32> traps = file_traps(D);
+
+  // Bits of STATUS
+  static constexpr std::uint8_t C = 0b001u;
+  static constexpr std::uint8_t DC = 0b010u;
+  static constexpr std::uint8_t Z = 0b100u;
+
+  // Lanes a pass runs on: every lane, one lane, or the lanes whose mask byte
+  // is set
+  struct AllLanes {
+    static constexpr bool masked = false;
+    static constexpr std::size_t first() { return 0; }
+    static constexpr std::size_t last() { return Lanes; }
+  };
+
+  struct OneLane {
+    static constexpr bool masked = false;
+    std::size_t lane;
+    constexpr std::size_t first() const { return lane; }
+    constexpr std::size_t last() const { return lane + 1; }
+  };
+
+  struct MaskedLanes {
+    static constexpr bool masked = true;
+    const Mask &mask;
+    static constexpr std::size_t first() { return 0; }
+    static constexpr std::size_t last() { return Lanes; }
+  };
+
+  // Executes one instruction on the lanes Selection picks, as a few loops
+  // over the arrays of state, each of which the compiler can vectorise.
+  // Masked lanes are computed along with the others and left unchanged.
+  template <typename Selection>
+  class Pass final : public BasicOpCodes<Pass<Selection>> {
+  private:
+    MultiEmulator &machine;
+    const Selection lanes;
+
+    template <typename Body> void each(Body body) const {
+      for (auto lane = lanes.first(); lane < lanes.last(); ++lane) {
+        body(lane);
+      }
+    }
+
+    bool selected(const std::size_t lane) const {
+      if constexpr (Selection::masked) {
+        return lanes.mask[lane] != 0u;
+      } else {
+        return true;
+      }
+    }
+
+    template <typename Array>
+    void set(Array &to, const std::size_t lane, const auto x) const {
+      using Value = typename Array::value_type;
+      if constexpr (Selection::masked) {
+        to[lane] = lanes.mask[lane] ? static_cast<Value>(x) : to[lane];
+      } else {
+        to[lane] = static_cast<Value>(x);
+      }
+    }
+
+    // operation(x, w) on each lane
+    template <typename Operation>
+    Bytes map(const Bytes &x, Operation operation) const {
+      Bytes result{};
+      each([&](const std::size_t lane) {
+        result[lane] =
+            static_cast<std::uint8_t>(operation(x[lane], machine.w[lane]));
+      });
+      return result;
+    }
+
+    Bytes read_file(const std::uint8_t f) const {
+      Bytes value{};
+      if ((traps[f] & trap_read) == 0u) [[likely]] {
+        each([&](const std::size_t lane) {
+          value[lane] = machine.registers[f][lane];
+        });
+      } else {
+        each([&](const std::size_t lane) {
+          value[lane] = selected(lane) ? machine.read_file(lane, f) : 0u;
+        });
+      }
+      return value;
+    }
+
+    // Returns what each lane's file holds afterwards
+    Bytes write_file(const std::uint8_t f, const Bytes &x) const {
+      if ((traps[f] & trap_write) == 0u) [[likely]] {
+        each([&](const std::size_t lane) {
+          set(machine.registers[f], lane, x[lane]);
+        });
+        return x;
+      }
+      Bytes written{};
+      each([&](const std::size_t lane) {
+        if (selected(lane)) {
+          written[lane] = machine.write_file(lane, f, x[lane]);
+        }
+      });
+      return written;
+    }
+
+    Bytes write_file(const std::uint8_t f, const std::uint8_t d,
+                     const Bytes &x) const {
+      if (d == 0u) {
+        each([&](const std::size_t lane) { set(machine.w, lane, x[lane]); });
+        return x;
+      }
+      return write_file(f, x);
+    }
+
+    // Sets bit of STATUS on the lanes where condition is non-zero, and
+    // clears it on the others
+    void set_status(const std::uint8_t bit, const Bytes &condition) const {
+      auto &status = machine.registers[STATUS];
+      each([&](const std::size_t lane) {
+        set(status, lane, (status[lane] & ~bit) | (condition[lane] ? bit : 0u));
+      });
+    }
+
+    void set_zero(const Bytes &x) const {
+      set_status(Z, map(x, [](const auto value, auto) { return value == 0u; }));
+    }
+
+    void skip_if(const Bytes &condition) const {
+      each([&](const std::size_t lane) {
+        const auto next = (machine.pc[lane] + 1u) & pc_mask;
+        set(machine.pc, lane, condition[lane] ? next : machine.pc[lane]);
+      });
+    }
+
+    // The result of a byte operation, to file f or to w, setting Z from it
+    void write_result(const std::uint8_t f, const std::uint8_t d,
+                      const Bytes &x) const {
+      set_zero(write_file(f, d, x));
+    }
+
+    template <typename Operation>
+    void byte_operation(const std::uint8_t f, const std::uint8_t d,
+                        Operation operation) const {
+      write_result(f, d, map(read_file(f), operation));
+    }
+
+    template <typename Operation>
+    void literal_operation(Operation operation) const {
+      write_result(0, 0, map(machine.w, operation));
+    }
+
+  public:
+    Pass(MultiEmulator &machine, const Selection lanes)
+        : machine(machine), lanes(lanes) {}
+
+    // Executes the instruction every selected lane is at
+    void tick(const Instruction &instruction) {
+      auto &rtcc = machine.registers[RTCC];
+      each([&](const std::size_t lane) {
+        set(rtcc, lane, rtcc[lane] + 1u);
+        set(machine.pc, lane, (machine.pc[lane] + 1u) & pc_mask);
+      });
+      this->dispatch(instruction);
+    }
+
+    void MOVWF(const std::uint8_t f) { write_file(f, machine.w); }
+
+    void CLRW() { write_result(0, 0, Bytes{}); }
+
+    void CLRF(const std::uint8_t f) { write_result(f, 1, Bytes{}); }
+
+    void SUBWF(const std::uint8_t f, const std::uint8_t d) {
+      const auto value = read_file(f);
+      set_status(C, map(value, [](const auto x, const auto w) {
+                   return w <= x;
+                 }));
+      set_status(DC, map(value, [](const auto x, const auto w) {
+                   return (w & 0x0fu) <= (x & 0x0fu);
+                 }));
+      write_result(f, d, map(value, [](const auto x, const auto w) {
+                     return x - w;
+                   }));
+    }
+
+    void DECF(const std::uint8_t f, const std::uint8_t d) {
+      byte_operation(f, d, [](const auto x, auto) { return x - 1u; });
+    }
+
+    void IORWF(const std::uint8_t f, const std::uint8_t d) {
+      byte_operation(f, d, [](const auto x, const auto w) { return x | w; });
+    }
+
+    void ANDWF(const std::uint8_t f, const std::uint8_t d) {
+      byte_operation(f, d, [](const auto x, const auto w) { return x & w; });
+    }
+
+    void XORWF(const std::uint8_t f, const std::uint8_t d) {
+      byte_operation(f, d, [](const auto x, const auto w) { return x ^ w; });
+    }
+
+    void ADDWF(const std::uint8_t f, const std::uint8_t d) {
+      const auto value = read_file(f);
+      set_status(C, map(value, [](const auto x, const auto w) {
+                   return x + w > 0xffu;
+                 }));
+      set_status(DC, map(value, [](const auto x, const auto w) {
+                   return (x & 0x0fu) + (w & 0x0fu) > 0x0fu;
+                 }));
+      write_result(f, d, map(value, [](const auto x, const auto w) {
+                     return x + w;
+                   }));
+    }
+
+    void MOVF(const std::uint8_t f, const std::uint8_t d) {
+      byte_operation(f, d, [](const auto x, auto) { return x; });
+    }
+
+    void COMF(const std::uint8_t f, const std::uint8_t d) {
+      byte_operation(f, d, [](const auto x, auto) { return ~x; });
+    }
+
+    void INCF(const std::uint8_t f, const std::uint8_t d) {
+      byte_operation(f, d, [](const auto x, auto) { return x + 1u; });
+    }
+
+    void DECFSZ(const std::uint8_t f, const std::uint8_t d) {
+      const auto written = write_file(
+          f, d, map(read_file(f), [](const auto x, auto) { return x - 1u; }));
+      skip_if(map(written, [](const auto x, auto) { return x == 0u; }));
+    }
+
+    void RRF(const std::uint8_t f, const std::uint8_t d) {
+      const auto value = read_file(f);
+      set_status(C, map(value, [](const auto x, auto) { return x & 0b1u; }));
+      write_file(f, d, map(value, [](const auto x, auto) {
+                   return (x >> 1) | (x << 7);
+                 }));
+    }
+
+    void RLF(const std::uint8_t f, const std::uint8_t d) {
+      const auto value = read_file(f);
+      set_status(C, map(value, [](const auto x, auto) { return x >> 7; }));
+      write_file(f, d, map(value, [](const auto x, auto) {
+                   return (x << 1) | (x >> 7);
+                 }));
+    }
+
+    void SWAPF(const std::uint8_t f, const std::uint8_t d) {
+      write_file(f, d, map(read_file(f), [](const auto x, auto) {
+                   return (x << 4) | (x >> 4);
+                 }));
+    }
+
+    void INCFSZ(const std::uint8_t f, const std::uint8_t d) {
+      const auto written = write_file(
+          f, d, map(read_file(f), [](const auto x, auto) { return x + 1u; }));
+      skip_if(map(written, [](const auto x, auto) { return x == 0u; }));
+    }
+
+    void BCF(const std::uint8_t f, const std::uint8_t b) {
+      write_file(f, map(read_file(f), [b](const auto x, auto) {
+                   return x & ~(0b1u << b);
+                 }));
+    }
+
+    void BSF(const std::uint8_t f, const std::uint8_t b) {
+      write_file(f, map(read_file(f), [b](const auto x, auto) {
+                   return x | (0b1u << b);
+                 }));
+    }
+
+    void BTFSC(const std::uint8_t f, const std::uint8_t b) {
+      skip_if(map(read_file(f), [b](const auto x, auto) {
+        return (x & (0b1u << b)) == 0u;
+      }));
+    }
+
+    void BTFSS(const std::uint8_t f, const std::uint8_t b) {
+      skip_if(map(read_file(f), [b](const auto x, auto) {
+        return (x & (0b1u << b)) != 0u;
+      }));
+    }
+
+    void RETLW(const std::uint8_t k) {
+      auto &stack = machine.stack;
+      each([&](const std::size_t lane) {
+        set(machine.w, lane, k);
+        set(machine.pc, lane, stack[0][lane]);
+        for (std::size_t level = 1; level < D.stack_depth; ++level) {
+          set(stack[level - 1], lane, stack[level][lane]);
+        }
+        set(stack[D.stack_depth - 1], lane, 0xffffu);
+      });
+    }
+
+    void CALL(const std::uint8_t k) {
+      auto &stack = machine.stack;
+      each([&](const std::size_t lane) {
+        for (std::size_t level = D.stack_depth - 1; level > 0; --level) {
+          set(stack[level], lane, stack[level - 1][lane]);
+        }
+        set(stack[0], lane, machine.pc[lane] & pc_mask);
+        set(machine.pc, lane, k & pc_mask);
+      });
+    }
+
+    void GOTO(const std::uint16_t k) {
+      each([&](const std::size_t lane) { set(machine.pc, lane, k & pc_mask); });
+    }
+
+    void MOVLW(const std::uint8_t k) {
+      each([&](const std::size_t lane) { set(machine.w, lane, k); });
+    }
+
+    void IORLW(const std::uint8_t k) {
+      literal_operation([k](const auto w, auto) { return w | k; });
+    }
+
+    void ANDLW(const std::uint8_t k) {
+      literal_operation([k](const auto w, auto) { return w & k; });
+    }
+
+    void XORLW(const std::uint8_t k) {
+      literal_operation([k](const auto w, auto) { return w ^ k; });
+    }
+  };
+
+  const std::array<Instruction, rom_words> program;
+  Addresses pc;
+  Bytes w{};
+  std::array<Bytes, 32> registers{};
+  std::array<Bytes, D.ports> inputs;
+  std::array<Addresses, D.stack_depth> stack;
+
+  // Addresses shared by at least this many lanes run as one masked pass over
+  // every lane; the lanes at other addresses run one at a time.
+  static constexpr std::size_t vector_threshold = std::max(Lanes / 8, 2uz);
+
+  // Scheduler state while lanes are diverged: the lanes waiting at each
+  // address, as a linked list through next_lane ending in Lanes, a bitmap of
+  // the addresses with lanes waiting, and each lane's remaining budget.
+  std::array<std::uint16_t, rom_words> first_lane;
+  std::array<std::uint64_t, (rom_words + 63) / 64> waiting{};
+  std::array<std::uint16_t, Lanes> next_lane{};
+  std::array<std::uint64_t, Lanes> remaining{};
+
+  std::uint8_t fsr(const std::size_t lane) const {
+    return registers[FSR][lane] & 0b1'1111u;
+  }
+
+  // File f of one lane, read and written as BasicEmulator::read_file and
+  // write_file do, for the files that trap
+  std::uint8_t read_file(const std::size_t lane, const std::uint8_t f) const {
+    assert(f < 32);
+    if ((traps[f] & trap_read) == 0u) {
+      return registers[f][lane];
+    }
+    switch (f) {
+    case INDF:
+      assert(fsr(lane) != 0);
+      return read_file(lane, fsr(lane));
+    case PCL:
+      return pc[lane] & 0b1111'1111;
+    default:
+      return registers[f][lane] & inputs[f - PORTA][lane];
+    }
+  }
+
+  std::uint8_t write_file(const std::size_t lane, const std::uint8_t f,
+                          const std::uint8_t x) {
+    assert(f < 32);
+    if ((traps[f] & trap_write) == 0u) {
+      registers[f][lane] = x;
+      return x;
+    }
+    switch (f) {
+    case INDF:
+      assert(fsr(lane) != 0);
+      return write_file(lane, fsr(lane), x);
+    case PCL:
+      pc[lane] = x & pc_mask;
+      return x;
+    case STATUS:
+      registers[STATUS][lane] = x & 0b111u;
+      return registers[STATUS][lane];
+    default:
+      registers[FSR][lane] = 0b1110'0000u | x;
+      return fsr(lane);
+    }
+  }
+
+  template <typename Selection>
+  void execute(const std::uint16_t address, const Selection lanes) {
+    Pass<Selection>{*this, lanes}.tick(program[address]);
+  }
+
+  bool converged() const {
+    bool same = true;
+    for (std::size_t lane = 0; lane < Lanes; ++lane) {
+      same &= pc[lane] == pc[0];
+    }
+    return same;
+  }
+
+  void wait(const std::uint16_t lane) {
+    const auto address = pc[lane];
+    next_lane[lane] = first_lane[address];
+    first_lane[address] = lane;
+    waiting[address / 64] |= std::uint64_t{1} << (address % 64);
+  }
+
+  // The lowest address with lanes waiting at it, or rom_words if there are
+  // none
+  std::uint16_t lowest_waiting() const {
+    for (std::size_t word = 0; word < std::size(waiting); ++word) {
+      if (waiting[word] != 0) {
+        return static_cast<std::uint16_t>(64 * word +
+                                          std::countr_zero(waiting[word]));
+      }
+    }
+    return rom_words;
+  }
+
+  // Runs up to budget instructions on every lane once they have split up.
+  // Lanes are independent, so they need not stay in step: the lanes at the
+  // lowest address run first, which lets lanes that fell behind catch up with
+  // the others where their paths meet again. Returns early, with the number
+  // of instructions run, if every lane ends up at one address with the same
+  // budget left.
+  std::uint64_t diverge(const std::uint64_t budget) {
+    remaining.fill(budget);
+    for (std::size_t lane = 0; lane < Lanes; ++lane) {
+      wait(static_cast<std::uint16_t>(lane));
+    }
+
+    std::array<std::uint16_t, Lanes> group;
+    while (true) {
+      const auto address = lowest_waiting();
+      if (address == rom_words) {
+        return budget;
+      }
+      waiting[address / 64] &= ~(std::uint64_t{1} << (address % 64));
+
+      std::size_t size = 0;
+      for (auto lane = first_lane[address]; lane != Lanes;
+           lane = next_lane[lane]) {
+        group[size++] = lane;
+      }
+      first_lane[address] = Lanes;
+
+      if (size == Lanes &&
+          std::ranges::all_of(remaining, [&](const std::uint64_t left) {
+            return left == remaining[0];
+          })) {
+        return budget - remaining[0];
+      }
+
+      if (size >= vector_threshold) {
+        Mask mask{};
+        for (std::size_t i = 0; i < size; ++i) {
+          mask[group[i]] = 0xffu;
+        }
+        execute(address, MaskedLanes{mask});
+        for (std::size_t i = 0; i < size; ++i) {
+          if (--remaining[group[i]] != 0) {
+            wait(group[i]);
+          }
+        }
+      } else {
+        // Too few lanes for a pass over all of them. They stay the lowest
+        // until they pass the next address other lanes are waiting at, so
+        // each can run on alone until then.
+        const auto next_waiting = lowest_waiting();
+        for (std::size_t i = 0; i < size; ++i) {
+          const auto lane = group[i];
+          do {
+            execute(pc[lane], OneLane{lane});
+          } while (--remaining[lane] != 0 && pc[lane] < next_waiting);
+          if (remaining[lane] != 0) {
+            wait(lane);
+          }
+        }
+      }
+    }
+  }
+
+public:
+  explicit MultiEmulator(const std::array<OpCode, rom_words> &rom)
+      : program(Pass<AllLanes>::decode(rom)) {
+    first_lane.fill(Lanes);
+    for (std::size_t lane = 0; lane < Lanes; ++lane) {
+      restore(lane, State{});
+    }
+  }
+
+  // Executes one instruction on every lane
+  void tick() { run(1); }
+
+  // Runs `cycles` instructions on every lane, with the same effect as calling
+  // tick() that many times.
+  void run(const std::uint64_t cycles) {
+    std::uint64_t executed = 0;
+    while (executed < cycles) {
+      if (converged()) {
+        execute(pc[0], AllLanes{});
+        ++executed;
+      } else {
+        executed += diverge(cycles - executed);
+      }
+    }
+  }
+
+  void input(const std::size_t lane, const std::size_t port,
+             const std::size_t bit, const bool set) {
+    if (set) {
+      input_high(lane, port, bit);
+    } else {
+      input_low(lane, port, bit);
+    }
+  }
+
+  void input_high(const std::size_t lane, const std::size_t port,
+                  const std::size_t bit) {
+    inputs[port][lane] |= static_cast<std::uint8_t>(1u << bit);
+  }
+
+  void input_low(const std::size_t lane, const std::size_t port,
+                 const std::size_t bit) {
+    inputs[port][lane] &= static_cast<std::uint8_t>(~(1u << bit));
+  }
+
+  static constexpr std::size_t lanes() { return Lanes; }
+
+  std::uint16_t PC(const std::size_t lane) const { return pc[lane]; }
+
+  auto a(const std::size_t lane) const { return registers[PORTA + 0][lane]; }
+  auto b(const std::size_t lane) const
+    requires(D.ports > 1)
+  {
+    return registers[PORTA + 1][lane];
+  }
+  auto c(const std::size_t lane) const
+    requires(D.ports > 2)
+  {
+    return registers[PORTA + 2][lane];
+  }
+  auto d(const std::size_t lane) const
+    requires(D.ports > 3)
+  {
+    return registers[PORTA + 3][lane];
+  }
+
+  // Port values of every lane at once
+  const Bytes &a() const { return registers[PORTA + 0]; }
+  const Bytes &b() const
+    requires(D.ports > 1)
+  {
+    return registers[PORTA + 1];
+  }
+  const Bytes &c() const
+    requires(D.ports > 2)
+  {
+    return registers[PORTA + 2];
+  }
+  const Bytes &d() const
+    requires(D.ports > 3)
+  {
+    return registers[PORTA + 3];
+  }
+
+  // The state of one lane, as BasicEmulator::snapshot() gives it
+  State snapshot(const std::size_t lane) const {
+    State state{
+        .pc = pc[lane],
+        .rtcc = registers[RTCC][lane],
+        .w = w[lane],
+        .fsr = static_cast<std::uint8_t>(registers[FSR][lane] & 0b1'1111u),
+        .status = registers[STATUS][lane],
+    };
+    for (std::size_t level = 0; level < D.stack_depth; ++level) {
+      state.stack[level] = stack[level][lane];
+    }
+    for (std::size_t port = 0; port < D.ports; ++port) {
+      state.inputs[port] = inputs[port][lane];
+      state.output_latches[port] = registers[PORTA + port][lane];
+    }
+    for (std::size_t i = 0; i < D.general_purpose_registers(); ++i) {
+      state.general_purpose_registers[i] = registers[GPR + i][lane];
+    }
+    return state;
+  }
+
+  void restore(const std::size_t lane, const State &state) {
+    assert(state.pc < rom_words && state.fsr < 32 && state.status < 8);
+    pc[lane] = state.pc;
+    registers[RTCC][lane] = state.rtcc;
+    w[lane] = state.w;
+    registers[FSR][lane] = 0b1110'0000u | state.fsr;
+    registers[STATUS][lane] = state.status;
+    for (std::size_t level = 0; level < D.stack_depth; ++level) {
+      stack[level][lane] = state.stack[level];
+    }
+    for (std::size_t port = 0; port < D.ports; ++port) {
+      inputs[port][lane] = state.inputs[port];
+      registers[PORTA + port][lane] = state.output_latches[port];
+    }
+    for (std::size_t i = 0; i < D.general_purpose_registers(); ++i) {
+      registers[GPR + i][lane] = state.general_purpose_registers[i];
+    }
+  }
+};
+
+} // namespace pic1650
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <format>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+
+namespace pic1650 {
+
+// Reads a number written in decimal, or in hex or binary with a 0x or 0b
+// prefix, and nothing else
+inline std::optional<std::uint64_t> to_number(const std::string_view text) {
+  auto digits = text;
+  auto base = 10;
+  if (digits.starts_with("0x")) {
+    base = 16;
+    digits.remove_prefix(2);
+  } else if (digits.starts_with("0b")) {
+    base = 2;
+    digits.remove_prefix(2);
+  }
+  std::uint64_t value{};
+  const auto end = std::data(digits) + std::size(digits);
+  const auto [at, error] =
+      std::from_chars(std::data(digits), end, value, base);
+  if (std::empty(digits) || error != std::errc{} || at != end) {
+    return std::nullopt;
+  }
+  return value;
+}
+
+// Like to_number(), but throws std::runtime_error on anything else
+inline std::uint64_t parse_number(const std::string_view text) {
+  const auto value = to_number(text);
+  if (!value) {
+    throw std::runtime_error(std::format("bad number '{:s}'", text));
+  }
+  return *value;
+}
+
+} // namespace pic1650
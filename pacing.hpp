@@ -0,0 +1,122 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <thread>
+
+namespace pic1650 {
+
+struct PacingOptions {
+  // Oscillator frequency. The PIC1650 takes four clocks per instruction.
+  double clock_hz{1'000'000.0};
+  std::uint32_t clocks_per_instruction{4};
+  // Real time covered by each batch of instructions
+  std::chrono::nanoseconds batch{std::chrono::milliseconds{1}};
+  // How long before a deadline to stop sleeping and spin instead, which
+  // should exceed the host's usual oversleep
+  std::chrono::nanoseconds spin{std::chrono::microseconds{200}};
+  // Falling further behind than this gives up on catching up, rather than
+  // running flat out until the lost time is made good
+  std::chrono::nanoseconds max_lag{std::chrono::milliseconds{100}};
+};
+
+struct PacingReport {
+  std::uint64_t cycles{};
+  std::chrono::nanoseconds elapsed{};
+  // Instructions per second the options ask for
+  double target_rate{};
+  // Latest any batch started after its deadline
+  std::chrono::nanoseconds worst_lag{};
+  // Times the pacer fell more than max_lag behind and gave up catching up
+  std::uint64_t resyncs{};
+
+  double achieved_rate() const {
+    const auto seconds = std::chrono::duration<double>(elapsed).count();
+    return seconds > 0.0 ? static_cast<double>(cycles) / seconds : 0.0;
+  }
+};
+
+// Runs instructions at the speed of a real PIC1650. Work is done in batches;
+// each batch has a deadline worked out from the cycle count since the start,
+// so lateness on one batch is made up on the next ones instead of adding up.
+// Before a deadline the pacer sleeps while it is more than options.spin away,
+// then spins, which keeps the jitter down to about the cost of a clock read.
+class Pacer {
+private:
+  using Clock = std::chrono::steady_clock;
+
+  PacingOptions options;
+  double rate;
+  std::uint64_t batch_cycles;
+  bool started{};
+  // Deadlines are measured from here, moved on each resync
+  Clock::time_point origin{};
+  std::uint64_t origin_cycles{};
+  Clock::time_point start{};
+  PacingReport totals{};
+
+  Clock::time_point deadline(const std::uint64_t cycle) const {
+    const auto seconds =
+        static_cast<double>(cycle - origin_cycles) / rate;
+    return origin + std::chrono::duration_cast<Clock::duration>(
+                        std::chrono::duration<double>(seconds));
+  }
+
+  void wait_until(const Clock::time_point when) const {
+    if (const auto now = Clock::now(); when - now > options.spin) {
+      std::this_thread::sleep_until(when - options.spin);
+    }
+    while (Clock::now() < when) {
+    }
+  }
+
+public:
+  explicit Pacer(const PacingOptions &options = {})
+      : options{options},
+        rate{options.clock_hz /
+             std::max<std::uint32_t>(options.clocks_per_instruction, 1)},
+        batch_cycles{std::max<std::uint64_t>(
+            static_cast<std::uint64_t>(std::llround(
+                rate * std::chrono::duration<double>(options.batch).count())),
+            1)} {
+    totals.target_rate = rate;
+  }
+
+  // Runs `cycles` instructions by calling advance(n) with batches of n, none
+  // of which starts before a real PIC1650 would have got to it.
+  template <typename Advance>
+  void run(const std::uint64_t cycles, Advance advance) {
+    if (!started) {
+      started = true;
+      start = origin = Clock::now();
+      origin_cycles = totals.cycles;
+    }
+    for (auto left = cycles; left != 0u;) {
+      const auto due = deadline(totals.cycles);
+      wait_until(due);
+      const auto now = Clock::now();
+      const auto lag =
+          std::chrono::duration_cast<std::chrono::nanoseconds>(now - due);
+      totals.worst_lag = std::max(totals.worst_lag, lag);
+      if (lag > options.max_lag) {
+        origin = now;
+        origin_cycles = totals.cycles;
+        ++totals.resyncs;
+      }
+
+      const auto batch = std::min(left, batch_cycles);
+      advance(batch);
+      totals.cycles += batch;
+      left -= batch;
+    }
+    totals.elapsed =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                             start);
+  }
+
+  const PacingReport &report() const { return totals; }
+};
+
+} // namespace pic1650
@@ -0,0 +1,290 @@
+// Runs every scenario in a scenario file against a ROM on a pool of threads
+// and prints a CSV summary per scenario, in file order:
+//
+//   pic1650-batch [--threads N] [--booted] tandybaseball.bin scenarios.txt
+//       >results.csv
+//
+// A scenario file holds scenarios, each followed by its input events:
+//
+//   # Lines starting with # are comments
+//   scenario <name> <cycles> [until <pc|a|b|c|d>=<value>]
+//   <cycle> <port> <bit> <high|low>
+//
+// A scenario runs for <cycles> instructions, or stops early once the register
+// named by until holds the value after an instruction. Each event sets an
+// input bit after <cycle> instructions have run. Numbers may be written in
+// decimal, or with a 0x or 0b prefix.
+//
+// Scenarios start from reset, or with --booted from the state the bundled ROM
+// boots into, which bundled_boot.cpp bakes in while compiling
+// (PIC1650_BOOT_CYCLES and PIC1650_BOOT_PC in CMakeLists.txt). Their cycles
+// then count from there.
+
+#include <algorithm>
+#include <array>
+#include <exception>
+#include <cstdint>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "pic1650.hpp"
+#include "bundled_rom.hpp"
+#include "numbers.hpp"
+#include "work_stealing.hpp"
+
+namespace {
+
+struct Event {
+  std::uint64_t cycle{};
+  std::size_t port{};
+  std::size_t bit{};
+  bool set{};
+};
+
+struct StopCondition {
+  char target{};
+  std::uint16_t value{};
+
+  bool operator()(const pic1650::Emulator &emulator) const {
+    switch (target) {
+    case 'a':
+      return emulator.a() == value;
+    case 'b':
+      return emulator.b() == value;
+    case 'c':
+      return emulator.c() == value;
+    case 'd':
+      return emulator.d() == value;
+    default:
+      return emulator.PC() == value;
+    }
+  }
+};
+
+struct Scenario {
+  std::string name;
+  std::uint64_t cycles{};
+  std::optional<StopCondition> until;
+  std::vector<Event> events;
+};
+
+struct Summary {
+  std::uint64_t cycles{};
+  bool stopped{};
+  std::uint16_t pc{};
+  std::array<std::uint8_t, 4> output_latches{};
+  std::uint64_t state_hash{};
+};
+
+std::uint64_t parse_number(const std::string_view text,
+                           const std::size_t line) {
+  const auto value = pic1650::to_number(text);
+  if (!value) {
+    throw std::runtime_error(
+        std::format("line {:d}: bad number '{:s}'", line, text));
+  }
+  return *value;
+}
+
+std::vector<Scenario> parse_scenarios(std::istream &is) {
+  std::vector<Scenario> scenarios;
+  std::string text;
+  for (std::size_t line = 1; std::getline(is, text); ++line) {
+    std::istringstream fields{text};
+    std::string first;
+    if (!(fields >> first) || first.starts_with('#')) {
+      continue;
+    }
+
+    if (first == "scenario") {
+      Scenario scenario;
+      std::string cycles;
+      if (!(fields >> scenario.name >> cycles)) {
+        throw std::runtime_error(std::format(
+            "line {:d}: expected 'scenario <name> <cycles>'", line));
+      }
+      scenario.cycles = parse_number(cycles, line);
+      std::string keyword;
+      if (fields >> keyword) {
+        std::string condition;
+        const auto equals = keyword == "until" && (fields >> condition)
+                                ? condition.find('=')
+                                : std::string::npos;
+        if (equals == std::string::npos) {
+          throw std::runtime_error(std::format(
+              "line {:d}: expected 'until <pc|a|b|c|d>=<value>'", line));
+        }
+        const auto target = condition.substr(0, equals);
+        if (target != "pc" && target != "a" && target != "b" &&
+            target != "c" && target != "d") {
+          throw std::runtime_error(std::format(
+              "line {:d}: can't stop on '{:s}'", line, target));
+        }
+        scenario.until = StopCondition{
+            .target = target == "pc" ? 'p' : target[0],
+            .value = static_cast<std::uint16_t>(parse_number(
+                std::string_view{condition}.substr(equals + 1), line))};
+      }
+      scenarios.push_back(std::move(scenario));
+      continue;
+    }
+
+    if (std::empty(scenarios)) {
+      throw std::runtime_error(
+          std::format("line {:d}: event before the first scenario", line));
+    }
+    std::string port;
+    std::string bit;
+    std::string level;
+    if (!(fields >> port >> bit >> level) ||
+        (level != "high" && level != "low")) {
+      throw std::runtime_error(std::format(
+          "line {:d}: expected '<cycle> <port> <bit> <high|low>'", line));
+    }
+    const Event event{.cycle = parse_number(first, line),
+                      .port = parse_number(port, line),
+                      .bit = parse_number(bit, line),
+                      .set = level == "high"};
+    if (event.port > 3 || event.bit > 7) {
+      throw std::runtime_error(
+          std::format("line {:d}: no input bit {:d} on port {:d}", line,
+                      event.bit, event.port));
+    }
+    scenarios.back().events.push_back(event);
+  }
+
+  for (auto &scenario : scenarios) {
+    std::ranges::stable_sort(scenario.events, {}, &Event::cycle);
+  }
+  return scenarios;
+}
+
+Summary run(pic1650::Emulator emulator, const Scenario &scenario) {
+  Summary summary;
+  // Runs until `cycle` instructions have run in total, or the scenario stops
+  const auto run_to = [&](const std::uint64_t cycle) {
+    if (summary.stopped || cycle <= summary.cycles) {
+      return;
+    }
+    if (scenario.until) {
+      summary.cycles +=
+          emulator.run_until(*scenario.until, cycle - summary.cycles);
+      summary.stopped = (*scenario.until)(emulator);
+    } else {
+      emulator.run(cycle - summary.cycles);
+      summary.cycles = cycle;
+    }
+  };
+
+  for (const auto &event : scenario.events) {
+    if (event.cycle > scenario.cycles) {
+      break;
+    }
+    run_to(event.cycle);
+    if (summary.stopped) {
+      break;
+    }
+    emulator.input(event.port, event.bit, event.set);
+  }
+  run_to(scenario.cycles);
+
+  summary.pc = emulator.PC();
+  summary.output_latches = {emulator.a(), emulator.b(), emulator.c(),
+                            emulator.d()};
+  summary.state_hash = emulator.hash();
+  return summary;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  try {
+    auto threads = std::max(std::thread::hardware_concurrency(), 1u);
+    auto from_boot = false;
+    std::vector<std::string_view> paths;
+    for (auto i = 1; i < argc; ++i) {
+      const std::string_view arg{argv[i]};
+      if (arg == "--threads") {
+        const std::string_view count{i + 1 < argc ? argv[++i] : ""};
+        const auto value = pic1650::to_number(count);
+        if (!value || *value == 0 ||
+            *value > std::numeric_limits<unsigned>::max()) {
+          throw std::runtime_error(std::format(
+              "--threads needs a number of threads above 0, not '{:s}'",
+              count));
+        }
+        threads = static_cast<unsigned>(*value);
+      } else if (arg == "--booted") {
+        from_boot = true;
+      } else {
+        paths.push_back(arg);
+      }
+    }
+    if (std::size(paths) != 2) {
+      std::cerr << "usage: pic1650-batch [--threads N] [--booted] "
+                   "tandybaseball.bin scenarios.txt >results.csv"
+                << std::endl;
+      return 1;
+    }
+
+    std::array<std::uint16_t, 512> opcodes;
+    std::ifstream rom{std::string{paths[0]}, std::ios::binary};
+    rom.read(reinterpret_cast<char *>(std::data(opcodes)),
+             std::size(opcodes) * 2);
+    if (!rom) {
+      std::cerr << std::format("can't read a ROM from {:s}", paths[0])
+                << std::endl;
+      return 1;
+    }
+    if (from_boot && opcodes != pic1650::bundled::rom) {
+      std::cerr << std::format("--booted needs the bundled ROM, and {:s} is "
+                               "another",
+                               paths[0])
+                << std::endl;
+      return 1;
+    }
+
+    std::ifstream file{std::string{paths[1]}};
+    if (!file) {
+      std::cerr << std::format("can't open {:s}", paths[1]) << std::endl;
+      return 1;
+    }
+    const auto scenarios = parse_scenarios(file);
+
+    // Every worker copies its own Emulator from this one, so the ROM is only
+    // decoded once, and booting costs nothing.
+    pic1650::Emulator prototype{opcodes};
+    if (from_boot) {
+      prototype.restore(pic1650::bundled::booted.state);
+    }
+    std::vector<Summary> summaries(std::size(scenarios));
+    pic1650::parallel_for(
+        std::size(scenarios), threads,
+        [&](const std::size_t index, std::size_t) {
+          summaries[index] = run(prototype, scenarios[index]);
+        });
+
+    std::cout << "scenario,cycles,stopped,pc,a,b,c,d,state_hash\n";
+    for (auto i = 0uz; i < std::size(scenarios); ++i) {
+      const auto &summary = summaries[i];
+      std::cout << std::format("{:s},{:d},{:d},{:d},", scenarios[i].name,
+                               summary.cycles, summary.stopped, summary.pc);
+      for (const auto x : summary.output_latches) {
+        std::cout << std::format("0b{:08b},", x);
+      }
+      std::cout << std::format("{:016x}\n", summary.state_hash);
+    }
+  } catch (const std::exception &error) {
+    std::cerr << error.what() << std::endl;
+    return 1;
+  }
+}
@@ -0,0 +1,348 @@
+// Measures the emulator on the baseball ROM and on synthetic instruction
+// mixes, and prints the median and 99th percentile time per instruction:
+//
+//   pic1650-bench [--json] [--repetitions N] [tandybaseball.bin]
+//
+// Every case runs once to warm up and then N times (15 by default). The
+// cases are tick() and run() on Emulator, run() on JitEmulator where the
+// recompiler is available, run() on 64 lanes of MultiEmulator with a
+// different button held in each, timed per instruction of each lane,
+// decoding and dispatching through IOpCodes, LoudEmulator writing its
+// CSV to a null stream, and OpCodeStream disassembling the ROM. With --json
+// the results are printed as one JSON object, for comparing builds.
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <iostream>
+#include <ostream>
+#include <random>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "pic1650.hpp"
+#include "multi_emulator.hpp"
+#include "recompiler.hpp"
+#include "roms.hpp"
+
+namespace {
+
+using Rom = std::array<pic1650::OpCode, 512>;
+
+// Discards everything written to it
+class NullBuffer final : public std::streambuf {
+protected:
+  int overflow(const int c) override { return c; }
+  std::streamsize xsputn(const char *, const std::streamsize n) override {
+    return n;
+  }
+};
+
+// Decodes and dispatches like any IOpCodes, then does next to nothing
+class CountingOpCodes final : public pic1650::IOpCodes {
+public:
+  std::uint64_t sum{};
+
+  void MOVWF(const std::uint8_t f) override { sum += f; }
+  void CLRW() override { ++sum; }
+  void CLRF(const std::uint8_t f) override { sum += f; }
+  void SUBWF(const std::uint8_t f, const std::uint8_t d) override {
+    sum += f + d;
+  }
+  void DECF(const std::uint8_t f, const std::uint8_t d) override {
+    sum += f + d;
+  }
+  void IORWF(const std::uint8_t f, const std::uint8_t d) override {
+    sum += f + d;
+  }
+  void ANDWF(const std::uint8_t f, const std::uint8_t d) override {
+    sum += f + d;
+  }
+  void XORWF(const std::uint8_t f, const std::uint8_t d) override {
+    sum += f + d;
+  }
+  void ADDWF(const std::uint8_t f, const std::uint8_t d) override {
+    sum += f + d;
+  }
+  void MOVF(const std::uint8_t f, const std::uint8_t d) override {
+    sum += f + d;
+  }
+  void COMF(const std::uint8_t f, const std::uint8_t d) override {
+    sum += f + d;
+  }
+  void INCF(const std::uint8_t f, const std::uint8_t d) override {
+    sum += f + d;
+  }
+  void DECFSZ(const std::uint8_t f, const std::uint8_t d) override {
+    sum += f + d;
+  }
+  void RRF(const std::uint8_t f, const std::uint8_t d) override {
+    sum += f + d;
+  }
+  void RLF(const std::uint8_t f, const std::uint8_t d) override {
+    sum += f + d;
+  }
+  void SWAPF(const std::uint8_t f, const std::uint8_t d) override {
+    sum += f + d;
+  }
+  void INCFSZ(const std::uint8_t f, const std::uint8_t d) override {
+    sum += f + d;
+  }
+  void BCF(const std::uint8_t f, const std::uint8_t b) override {
+    sum += f + b;
+  }
+  void BSF(const std::uint8_t f, const std::uint8_t b) override {
+    sum += f + b;
+  }
+  void BTFSC(const std::uint8_t f, const std::uint8_t b) override {
+    sum += f + b;
+  }
+  void BTFSS(const std::uint8_t f, const std::uint8_t b) override {
+    sum += f + b;
+  }
+  void RETLW(const std::uint8_t k) override { sum += k; }
+  void CALL(const std::uint8_t k) override { sum += k; }
+  void GOTO(const std::uint16_t k) override { sum += k; }
+  void MOVLW(const std::uint8_t k) override { sum += k; }
+  void IORLW(const std::uint8_t k) override { sum += k; }
+  void ANDLW(const std::uint8_t k) override { sum += k; }
+  void XORLW(const std::uint8_t k) override { sum += k; }
+};
+
+// Straight-line arithmetic on the general purpose registers, in blocks of 16
+// instructions that each end in a GOTO to the next block.
+Rom arithmetic_mix(const std::uint32_t seed) {
+  std::mt19937 random{seed};
+  constexpr std::array<pic1650::OpCode, 12> byte_operations{
+      0b0000'1000'0000, 0b0000'1100'0000, 0b0001'0000'0000, 0b0001'0100'0000,
+      0b0001'1000'0000, 0b0001'1100'0000, 0b0010'0000'0000, 0b0010'0100'0000,
+      0b0010'1000'0000, 0b0011'0000'0000, 0b0011'0100'0000, 0b0011'1000'0000};
+  Rom rom{};
+  for (std::size_t address = 0; address < std::size(rom); ++address) {
+    if (address % 16 == 15) {
+      rom[address] = static_cast<pic1650::OpCode>(
+          0b1010'0000'0000u | ((address + 1u) & 0x1ffu));
+    } else {
+      const auto d = random() & 1u;
+      const auto f = 9u + random() % 23u;
+      rom[address] = static_cast<pic1650::OpCode>(
+          byte_operations[random() % std::size(byte_operations)] | (d << 5) |
+          f);
+    }
+  }
+  return rom;
+}
+
+// Nested DECFSZ/GOTO delay loops, which is where games spend their time
+Rom delay_loop_mix() {
+  Rom rom{};
+  for (std::size_t at = 0; at < std::size(rom); at += 8) {
+    const auto loop =
+        static_cast<pic1650::OpCode>(0b1010'0000'0000u | (at + 4u));
+    const std::array<pic1650::OpCode, 8> block{
+        0b1100'1100'1000, // MOVLW 200
+        0b0000'0010'1001, // MOVWF F9
+        0b1100'0000'0011, // MOVLW 3
+        0b0000'0010'1010, // MOVWF F10
+        0b0010'1110'1001, // DECFSZ F9 D1
+        loop,             // GOTO at + 4
+        0b0010'1110'1010, // DECFSZ F10 D1
+        loop,             // GOTO at + 4
+    };
+    std::ranges::copy(block,
+                      std::begin(rom) + static_cast<std::ptrdiff_t>(at));
+  }
+  return rom;
+}
+
+struct Result {
+  std::string rom;
+  std::string name;
+  std::uint64_t instructions{};
+  std::size_t repetitions{};
+  double median_ns{};
+  double p99_ns{};
+};
+
+// Times `repetitions` calls of body(), after one untimed call, each of which
+// does `instructions` instructions' worth of work
+Result measure(const std::string_view rom, const std::string_view name,
+               const std::uint64_t instructions,
+               const std::size_t repetitions,
+               const std::function<void()> &body) {
+  body();
+  std::vector<double> ns;
+  for (auto i = 0uz; i < repetitions; ++i) {
+    const auto start = std::chrono::steady_clock::now();
+    body();
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    ns.push_back(std::chrono::duration<double, std::nano>(elapsed).count() /
+                 static_cast<double>(instructions));
+  }
+  std::ranges::sort(ns);
+  // Nearest rank percentiles
+  const auto percentile = [&ns](const std::size_t p) {
+    const auto rank = (p * std::size(ns) + 99u) / 100u;
+    return ns[std::max(rank, 1uz) - 1u];
+  };
+  return {std::string{rom}, std::string{name}, instructions, repetitions,
+          percentile(50), percentile(99)};
+}
+
+std::vector<Result> bench(const std::string_view name, const Rom &rom,
+                          const std::size_t repetitions) {
+  constexpr std::uint64_t cycles = 10'000'000;
+  constexpr std::uint64_t traced = 50'000;
+  constexpr std::uint64_t passes = 2'000;
+  std::vector<Result> results;
+  volatile std::uint64_t sink{};
+
+  const pic1650::Emulator prototype{rom};
+  results.push_back(measure(name, "tick", cycles, repetitions, [&] {
+    auto emulator = prototype;
+    for (std::uint64_t i = 0; i < cycles; ++i) {
+      emulator.tick();
+    }
+    sink = emulator.hash();
+  }));
+  results.push_back(measure(name, "run", cycles, repetitions, [&] {
+    auto emulator = prototype;
+    emulator.run(cycles);
+    sink = emulator.hash();
+  }));
+#if defined(PIC1650_JIT)
+  // Includes translating the ROM, which is small next to the run
+  results.push_back(measure(name, "jit", cycles, repetitions, [&] {
+    pic1650::JitEmulator emulator{rom};
+    emulator.run(cycles);
+    sink = emulator.hash();
+  }));
+#endif
+  results.push_back(measure(name, "lanes", cycles, repetitions, [&] {
+    pic1650::MultiEmulator<64> lanes{rom};
+    for (std::size_t lane = 0; lane < lanes.lanes(); ++lane) {
+      lanes.input_low(lane, lane % 4, lane / 4 % 8);
+    }
+    lanes.run(cycles / lanes.lanes());
+    sink = lanes.PC(0);
+  }));
+
+  results.push_back(
+      measure(name, "dispatch", passes * std::size(rom), repetitions, [&] {
+        CountingOpCodes counting;
+        // Called through the interface, as a caller picking one at run time
+        pic1650::IOpCodes &opcodes = counting;
+        for (std::uint64_t pass = 0; pass < passes; ++pass) {
+          for (const auto opcode : rom) {
+            opcodes.dispatch(opcode);
+          }
+        }
+        sink = counting.sum;
+      }));
+
+  NullBuffer null_buffer;
+  std::ostream null{&null_buffer};
+  results.push_back(measure(name, "trace", traced, repetitions, [&] {
+    pic1650::LoudEmulator emulator{rom, null};
+    for (std::uint64_t i = 0; i < traced; ++i) {
+      emulator.tick();
+    }
+  }));
+
+  results.push_back(measure(
+      name, "disassemble", std::size(rom) * passes / 10, repetitions, [&] {
+        pic1650::OpCodeStream stream{null};
+        for (std::uint64_t pass = 0; pass < passes / 10; ++pass) {
+          for (const auto opcode : rom) {
+            stream.dispatch(opcode);
+          }
+        }
+      }));
+  return results;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  bool json = false;
+  std::size_t repetitions = 15;
+  std::string path = "tandybaseball.bin";
+  for (auto i = 1; i < argc; ++i) {
+    const std::string_view arg{argv[i]};
+    if (arg == "--json") {
+      json = true;
+    } else if (arg == "--repetitions") {
+      const std::string_view count{i + 1 < argc ? argv[++i] : ""};
+      const auto end = std::data(count) + std::size(count);
+      const auto [at, error] =
+          std::from_chars(std::data(count), end, repetitions);
+      if (error != std::errc{} || at != end || repetitions == 0u) {
+        std::cerr << std::format("--repetitions needs a number above 0, "
+                                 "not '{:s}'",
+                                 count)
+                  << std::endl;
+        return 1;
+      }
+    } else {
+      path = arg;
+    }
+  }
+
+  Rom baseball;
+  std::ifstream file{path, std::ios::binary};
+  file.read(reinterpret_cast<char *>(std::data(baseball)),
+            std::size(baseball) * 2);
+  if (!file) {
+    std::cerr << "usage: pic1650-bench [--json] [--repetitions N] "
+                 "[tandybaseball.bin]"
+              << std::endl;
+    return 1;
+  }
+
+  std::vector<Result> results;
+  const auto add = [&](const std::string_view name, const Rom &rom) {
+    if (!json) {
+      std::cerr << std::format("benchmarking {:s}...", name) << std::endl;
+    }
+    std::ranges::move(bench(name, rom, repetitions),
+                      std::back_inserter(results));
+  };
+  add("tandybaseball", baseball);
+  add("random", pic1650::random_rom(1650));
+  add("arithmetic", arithmetic_mix(1650));
+  add("delay_loops", delay_loop_mix());
+
+  if (json) {
+    std::cout << "{\"results\": [";
+    for (auto i = 0uz; i < std::size(results); ++i) {
+      const auto &result = results[i];
+      std::cout << std::format(
+          "{:s}\n  {{\"rom\": \"{:s}\", \"case\": \"{:s}\", "
+          "\"instructions\": {:d}, \"repetitions\": {:d}, "
+          "\"median_ns_per_instruction\": {:.4f}, "
+          "\"p99_ns_per_instruction\": {:.4f}, \"median_mips\": {:.2f}}}",
+          i == 0 ? "" : ",", result.rom, result.name, result.instructions,
+          result.repetitions, result.median_ns, result.p99_ns,
+          1e3 / result.median_ns);
+    }
+    std::cout << "\n]}" << std::endl;
+    return 0;
+  }
+
+  std::cout << std::format("{:14s} {:12s} {:>12s} {:>12s} {:>10s}\n", "rom",
+                           "case", "median ns", "p99 ns", "MIPS");
+  for (const auto &result : results) {
+    std::cout << std::format("{:14s} {:12s} {:12.3f} {:12.3f} {:10.2f}\n",
+                             result.rom, result.name, result.median_ns,
+                             result.p99_ns, 1e3 / result.median_ns);
+  }
+}
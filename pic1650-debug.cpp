@@ -0,0 +1,386 @@
+// Debugs a ROM from commands on stdin, one per line:
+//
+//   pic1650-debug tandybaseball.bin
+//
+//   break ADDRESS [if CONDITION]  stop before the instruction at ADDRESS
+//   delete ADDRESS                remove the breakpoint at ADDRESS
+//   watch FILE [read|write]       stop after reads or writes of FILE, or both
+//   unwatch FILE                  remove the watchpoint on FILE
+//   when CONDITION                stop when CONDITION becomes true
+//   forget                        remove every when condition
+//   continue [CYCLES]             run until something stops it, for at most
+//                                 CYCLES instructions (100 million by default)
+//   step [COUNT]                  run COUNT instructions (one by default)
+//   next                          step, running a CALL through to its return
+//   finish                        run until the current function returns
+//   press PORT BIT                pull an input low, as a key press does
+//   release PORT BIT              let an input float high again
+//   back [COUNT]                  go back COUNT instructions (one by default)
+//   rewind CYCLE                  go back to CYCLE, counting from the start
+//   save FILE                     write the machine state to FILE
+//   load FILE                     continue from a state saved to FILE
+//   state                         print the registers and the next instruction
+//   list [ADDRESS]                disassemble around ADDRESS, or pc
+//   info                          list the breakpoints, watchpoints and
+//                                 conditions
+//   quit
+//
+// Addresses are written as in listings, x036, or as numbers, and numbers in
+// decimal or with a 0x or 0b prefix. A FILE is f0 to f31 or one of rtcc, pc,
+// status, fsr and the ports a to d. A CONDITION is w or a FILE, then one of
+// == != < <= > >= &, then a number, separated by spaces: "a & 0x01" holds
+// while bit 0 of latch A is set. Ports test their latches.
+//
+// Going back restores the snapshot taken after the last command that ran
+// before the target, or pressed or released an input, and runs forward from
+// it. The last 4096 of those commands can be gone back past, and loading a
+// state forgets them.
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "pic1650.hpp"
+#include "debugger.hpp"
+#include "numbers.hpp"
+#include "state.hpp"
+
+namespace {
+
+using pic1650::Comparison;
+using pic1650::Condition;
+using pic1650::parse_number;
+
+constexpr std::uint64_t default_budget = 100'000'000;
+constexpr std::size_t rewind_snapshots = 4096;
+
+constexpr std::array<std::string_view, 9> file_names{
+    "indf", "rtcc", "pc", "status", "fsr", "a", "b", "c", "d"};
+
+constexpr std::array<std::string_view, 7> comparisons{"==", "!=", "<", "<=",
+                                                      ">",  ">=", "&"};
+
+std::uint16_t parse_address(const std::string_view text) {
+  const auto address = text.starts_with('x')
+                           ? parse_number(std::format("0x{:s}", text.substr(1)))
+                           : parse_number(text);
+  if (address >= 512u) {
+    throw std::runtime_error(std::format("no address {:s}", text));
+  }
+  return static_cast<std::uint16_t>(address);
+}
+
+std::uint8_t parse_file(const std::string_view text) {
+  if (const auto name = std::ranges::find(file_names, text);
+      name != std::end(file_names)) {
+    return static_cast<std::uint8_t>(name - std::begin(file_names));
+  }
+  if (text.starts_with('f')) {
+    if (const auto f = parse_number(text.substr(1)); f < 32u) {
+      return static_cast<std::uint8_t>(f);
+    }
+  }
+  throw std::runtime_error(std::format("no file {:s}", text));
+}
+
+std::string file_name(const std::uint8_t f) {
+  return f < std::size(file_names) ? std::string{file_names[f]}
+                                   : std::format("f{:d}", f);
+}
+
+// Reads the words after `at` as a condition
+Condition parse_condition(const std::vector<std::string> &words,
+                          const std::size_t at) {
+  if (std::size(words) != at + 3u) {
+    throw std::runtime_error("a condition is OPERAND COMPARISON VALUE");
+  }
+  Condition condition{.w = words[at] == "w"};
+  if (!condition.w) {
+    condition.file = parse_file(words[at]);
+  }
+  const auto comparison = std::ranges::find(comparisons, words[at + 1u]);
+  if (comparison == std::end(comparisons)) {
+    throw std::runtime_error(
+        std::format("no comparison {:s}", words[at + 1u]));
+  }
+  condition.comparison =
+      static_cast<Comparison>(comparison - std::begin(comparisons));
+  const auto value = parse_number(words[at + 2u]);
+  if (value > 0xffu) {
+    throw std::runtime_error(std::format("{:s} is more than a byte",
+                                         words[at + 2u]));
+  }
+  condition.value = static_cast<std::uint8_t>(value);
+  return condition;
+}
+
+std::string describe(const Condition &condition) {
+  return std::format("{:s} {:s} 0x{:02X}",
+                     condition.w ? "w" : file_name(condition.file),
+                     comparisons[std::to_underlying(condition.comparison)],
+                     condition.value);
+}
+
+class Session {
+private:
+  const std::array<pic1650::OpCode, 512> &rom;
+  pic1650::DebuggingEmulator emulator;
+  // Never run(), so its interval doesn't matter
+  pic1650::RewindBuffer<pic1650::DebuggingEmulator> history{
+      emulator, rewind_snapshots, default_budget};
+  std::stringstream ss;
+  pic1650::OpCodeStream disassembler{ss};
+
+  std::string disassemble(const std::size_t address) {
+    ss.str("");
+    disassembler.dispatch(rom[address]);
+    auto text = ss.str();
+    text.pop_back();
+    return text;
+  }
+
+  void print_state() {
+    const auto state = emulator.snapshot();
+    std::cout << std::format(
+        "pc x{:03X} w 0x{:02X} C {:d} DC {:d} Z {:d} fsr {:d} rtcc {:d} "
+        "depth {:d} stack",
+        state.pc, state.w, state.status & 0b1u, (state.status >> 1) & 0b1u,
+        (state.status >> 2) & 0b1u, state.fsr, state.rtcc, emulator.depth());
+    for (const auto x : state.stack) {
+      std::cout << (x == 0xffffu ? std::string{" -"} : std::format(" x{:03X}", x));
+    }
+    std::cout << "\nlatches";
+    for (const auto x : state.output_latches) {
+      std::cout << std::format(" 0b{:08b}", x);
+    }
+    std::cout << " inputs";
+    for (const auto x : state.inputs) {
+      std::cout << std::format(" 0b{:08b}", x);
+    }
+    std::cout << "\nf9-f31";
+    for (const auto x : state.general_purpose_registers) {
+      std::cout << std::format(" {:02X}", x);
+    }
+    std::cout << std::format("\nx{:03X}:   {:s}\n", state.pc,
+                             disassemble(state.pc));
+  }
+
+  void report(const pic1650::Stop &stop) {
+    history.ran(stop.cycles);
+    std::cout << std::format("{:s} at x{:03X} after {:d} cycles, cycle {:d}",
+                             to_string(stop.reason), stop.address, stop.cycles,
+                             history.cycle());
+    if (stop.reason == pic1650::StopReason::Watchpoint) {
+      std::cout << std::format(
+          ": {:s} {:s}",
+          stop.access == pic1650::Access::Read    ? "read"
+          : stop.access == pic1650::Access::Write ? "wrote"
+                                                  : "read and wrote",
+          file_name(stop.file));
+    } else if (stop.reason == pic1650::StopReason::Condition) {
+      std::cout << std::format(
+          ": {:s}", describe(emulator.break_conditions()[stop.condition]));
+    }
+    std::cout << '\n';
+    print_state();
+  }
+
+  void rewind(const std::uint64_t target) {
+    history.rewind(target);
+    std::cout << std::format("back at cycle {:d}\n", history.cycle());
+    print_state();
+  }
+
+  void save(const std::string &path) {
+    const auto bytes = pic1650::serialize(emulator.snapshot());
+    std::ofstream file{path, std::ios::binary};
+    file.write(reinterpret_cast<const char *>(std::data(bytes)),
+               std::ssize(bytes));
+    if (!file) {
+      throw std::runtime_error(std::format("can't write {:s}", path));
+    }
+  }
+
+  void load(const std::string &path) {
+    std::ifstream file{path, std::ios::binary};
+    if (!file) {
+      throw std::runtime_error(std::format("can't read {:s}", path));
+    }
+    // One byte more than a state, so that a longer file is rejected too
+    std::array<std::byte, pic1650::serialized_state_size + 1u> bytes;
+    file.read(reinterpret_cast<char *>(std::data(bytes)), std::ssize(bytes));
+    emulator.restore(pic1650::deserialize(
+        std::span{bytes}.first(static_cast<std::size_t>(file.gcount()))));
+    history.clear();
+    print_state();
+  }
+
+  void list(const std::size_t around) {
+    for (auto address = std::max<std::size_t>(around, 5u) - 5u;
+         address < std::min<std::size_t>(around + 6u, std::size(rom));
+         ++address) {
+      std::cout << std::format(
+          "{:s}{:s} x{:03X}:   {:s}\n",
+          address == emulator.PC() ? ">" : " ",
+          emulator.breakpoints()[address] ? "*" : " ", address,
+          disassemble(address));
+    }
+  }
+
+  void info() {
+    for (std::size_t address = 0; address < std::size(rom); ++address) {
+      if (emulator.breakpoints()[address]) {
+        std::cout << std::format("break x{:03X}", address);
+        if (const auto &guard = emulator.guard(address)) {
+          std::cout << std::format(" if {:s}", describe(*guard));
+        }
+        std::cout << '\n';
+      }
+    }
+    for (std::uint8_t f = 0; f < 32u; ++f) {
+      if (const auto access = emulator.watchpoints()[f]; access != 0u) {
+        std::cout << std::format(
+            "watch {:s}{:s}\n", file_name(f),
+            access == std::to_underlying(pic1650::Access::Read)    ? " read"
+            : access == std::to_underlying(pic1650::Access::Write) ? " write"
+                                                                    : "");
+      }
+    }
+    for (const auto &condition : emulator.break_conditions()) {
+      std::cout << std::format("when {:s}\n", describe(condition));
+    }
+  }
+
+public:
+  explicit Session(const std::array<pic1650::OpCode, 512> &rom)
+      : rom{rom}, emulator{rom} {}
+
+  // Runs one command, and returns false on quit
+  bool execute(const std::vector<std::string> &words) {
+    const auto &command = words[0];
+    const auto argument = [&words](const std::size_t i) -> const std::string & {
+      if (i >= std::size(words)) {
+        throw std::runtime_error(
+            std::format("{:s} needs more arguments", words[0]));
+      }
+      return words[i];
+    };
+    const auto budget = [&words] {
+      return std::size(words) > 1 ? parse_number(words[1]) : default_budget;
+    };
+
+    if (command == "break" || command == "b") {
+      std::optional<Condition> condition;
+      if (std::size(words) > 2) {
+        if (words[2] != "if") {
+          throw std::runtime_error("break ADDRESS [if CONDITION]");
+        }
+        condition = parse_condition(words, 3);
+      }
+      emulator.set_breakpoint(parse_address(argument(1)), condition);
+    } else if (command == "delete" || command == "d") {
+      emulator.clear_breakpoint(parse_address(argument(1)));
+    } else if (command == "watch" || command == "w") {
+      auto access = pic1650::Access::ReadWrite;
+      if (std::size(words) > 2) {
+        access = words[2] == "read"    ? pic1650::Access::Read
+                 : words[2] == "write" ? pic1650::Access::Write
+                                       : throw std::runtime_error(
+                                             "watch FILE [read|write]");
+      }
+      emulator.watch(parse_file(argument(1)), access);
+    } else if (command == "unwatch") {
+      emulator.unwatch(parse_file(argument(1)));
+    } else if (command == "when") {
+      emulator.add_condition(parse_condition(words, 1));
+    } else if (command == "forget") {
+      emulator.clear_conditions();
+    } else if (command == "continue" || command == "c") {
+      report(emulator.resume(budget()));
+    } else if (command == "step" || command == "s") {
+      const auto count = std::size(words) > 1 ? parse_number(words[1]) : 1u;
+      pic1650::Stop stop{.reason = pic1650::StopReason::Stepped,
+                         .address = emulator.PC()};
+      for (std::uint64_t i = 0; i < count; ++i) {
+        stop.address = emulator.PC();
+        stop.cycles += emulator.step().cycles;
+      }
+      report(stop);
+    } else if (command == "next" || command == "n") {
+      report(emulator.step_over(budget()));
+    } else if (command == "finish" || command == "f") {
+      if (emulator.depth() == 0u) {
+        throw std::runtime_error("not in a function");
+      }
+      report(emulator.step_out(budget()));
+    } else if (command == "press" || command == "release") {
+      history.input(parse_number(argument(1)) & 0b11u,
+                    parse_number(argument(2)) & 0b111u, command == "release");
+    } else if (command == "back") {
+      const auto count = std::size(words) > 1 ? parse_number(words[1]) : 1u;
+      rewind(history.cycle() - std::min(count, history.cycle()));
+    } else if (command == "rewind") {
+      rewind(parse_number(argument(1)));
+    } else if (command == "save") {
+      save(argument(1));
+    } else if (command == "load") {
+      load(argument(1));
+    } else if (command == "state" || command == "p") {
+      print_state();
+    } else if (command == "list" || command == "l") {
+      list(std::size(words) > 1 ? parse_address(words[1]) : emulator.PC());
+    } else if (command == "info" || command == "i") {
+      info();
+    } else if (command == "quit" || command == "q") {
+      return false;
+    } else {
+      throw std::runtime_error(std::format("no command {:s}", command));
+    }
+    return true;
+  }
+};
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  std::array<std::uint16_t, 512> opcodes;
+  std::ifstream rom{argc == 2 ? argv[1] : "", std::ios::binary};
+  rom.read(reinterpret_cast<char *>(std::data(opcodes)),
+           std::size(opcodes) * 2);
+  if (!rom) {
+    std::cerr << "usage: pic1650-debug tandybaseball.bin <commands"
+              << std::endl;
+    return 1;
+  }
+
+  Session session{opcodes};
+  for (std::string line; std::getline(std::cin, line);) {
+    std::istringstream words_in{line};
+    std::vector<std::string> words;
+    for (std::string word; words_in >> word;) {
+      words.push_back(word);
+    }
+    if (std::empty(words) || words[0].starts_with('#')) {
+      continue;
+    }
+    try {
+      if (!session.execute(words)) {
+        break;
+      }
+    } catch (const std::exception &error) {
+      std::cerr << error.what() << std::endl;
+    }
+  }
+}
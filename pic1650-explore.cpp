@@ -0,0 +1,135 @@
+// Explores every state the game can reach from a starting point under every
+// input vector, and reports what it found:
+//
+//   pic1650-explore [--threads N] [--depth D] [--step CYCLES] [--boot CYCLES]
+//                   [--pins MASK] [--max-states N] [--memory-states N]
+//                   [--spill DIRECTORY] tandybaseball.bin
+//
+// The search starts after --boot instructions from reset (one million by
+// default), and each transition holds one input vector for --step
+// instructions (10000 by default), to --depth transitions (8 by default).
+// The input vectors are nothing pressed and each input bit in --pins (bit
+// 8 * port + bit, all 32 by default) pulled low on its own. Past
+// --memory-states states, each level of the search spills to a file in
+// --spill, or to a temporary file.
+//
+// The report gives the new states found at each depth, the addresses never
+// reached, and examples of stuck and faulting states.
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "pic1650.hpp"
+#include "explore.hpp"
+#include "numbers.hpp"
+
+namespace {
+
+using pic1650::parse_number;
+
+void print_state(const pic1650::State &state) {
+  std::cout << std::format("    pc x{:03X} w {:d} fsr {:d} latches", state.pc,
+                           state.w, state.fsr);
+  for (const auto x : state.output_latches) {
+    std::cout << std::format(" 0b{:08b}", x);
+  }
+  std::cout << '\n';
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  try {
+    pic1650::ExploreOptions options;
+    std::uint64_t boot = 1'000'000;
+    std::string path;
+    for (auto i = 1; i < argc; ++i) {
+      const std::string_view arg{argv[i]};
+      const auto value = [&] {
+        if (i + 1 == argc) {
+          throw std::runtime_error(std::format("{:s} needs a value", arg));
+        }
+        return parse_number(argv[++i]);
+      };
+      if (arg == "--threads") {
+        options.threads = value();
+      } else if (arg == "--depth") {
+        options.max_depth = value();
+      } else if (arg == "--step") {
+        options.cycles_per_step = std::max(value(), std::uint64_t{1});
+      } else if (arg == "--boot") {
+        boot = value();
+      } else if (arg == "--pins") {
+        options.inputs = pic1650::single_inputs(
+            static_cast<std::uint32_t>(value()));
+      } else if (arg == "--max-states") {
+        options.max_states = value();
+      } else if (arg == "--memory-states") {
+        options.frontier_memory = value();
+      } else if (arg == "--spill") {
+        if (i + 1 == argc) {
+          throw std::runtime_error(std::format("{:s} needs a value", arg));
+        }
+        options.spill_directory = argv[++i];
+      } else {
+        path = arg;
+      }
+    }
+
+    std::array<std::uint16_t, 512> opcodes;
+    std::ifstream rom{path, std::ios::binary};
+    rom.read(reinterpret_cast<char *>(std::data(opcodes)),
+             std::size(opcodes) * 2);
+    if (!rom) {
+      std::cerr << "usage: pic1650-explore [--threads N] [--depth D] "
+                   "[--step CYCLES] [--boot CYCLES] [--pins MASK] "
+                   "[--max-states N] [--memory-states N] [--spill DIRECTORY] "
+                   "tandybaseball.bin"
+                << std::endl;
+      return 1;
+    }
+
+    pic1650::Emulator emulator{opcodes};
+    emulator.run(boot);
+    const auto start = std::chrono::steady_clock::now();
+    const auto report = pic1650::explore(opcodes, emulator.snapshot(), options);
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    std::cout << std::format(
+        "{:d} states from {:d} transitions in {:.2f} s{:s}\n"
+        "{:d} states spilled, {:d} bytes of state set\n\ndepth {:>12s}\n",
+        report.states, report.transitions, elapsed.count(),
+        report.exhausted ? ", every reachable state found" : "",
+        report.spilled, report.set_memory, "new states");
+    for (auto depth = 0uz; depth < std::size(report.levels); ++depth) {
+      std::cout << std::format("{:5d} {:12d}\n", depth, report.levels[depth]);
+    }
+
+    std::cout << "\nnever reached";
+    for (auto address = 0uz; address < std::size(report.reached); ++address) {
+      if (!report.reached[address]) {
+        std::cout << std::format(" x{:03X}", address);
+      }
+    }
+    std::cout << std::format("\n\n{:d} stuck states\n", report.stuck);
+    std::ranges::for_each(report.stuck_examples, print_state);
+    std::cout << std::format("{:d} states that fault on an indirect access "
+                             "with fsr 0\n",
+                             report.faults);
+    std::ranges::for_each(report.fault_examples, print_state);
+  } catch (const std::exception &e) {
+    // Also how the search ends past --max-states
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+}
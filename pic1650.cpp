@@ -1,16 +1,392 @@
+#include <algorithm>
 #include <array>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <csignal>
 #include <cstdint>
+#include <exception>
+#include <format>
+#include <fstream>
 #include <iostream>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
 
 #include "pic1650.hpp"
+#include "async_trace.hpp"
+#include "audio.hpp"
+#include "delta_trace.hpp"
+#include "display.hpp"
+#include "memo.hpp"
+#include "pacing.hpp"
+#include "profile.hpp"
+#include "replay.hpp"
+#include "trace.hpp"
 
-int main() {
-  std::array<std::uint16_t, 512> opcodes;
+namespace {
+
+// Set by SIGINT and SIGTERM, the only ways to end a trace
+volatile std::sig_atomic_t stopping = 0;
+
+void stop(int) { stopping = 1; }
+
+// Ticks a tracing emulator until SIGINT or SIGTERM, so that the caller can
+// then write out what the emulator has buffered. The flag is checked every
+// few thousand instructions.
+template <typename Tracer> void trace_until_stopped(Tracer &emulator) {
+  std::signal(SIGINT, stop);
+  std::signal(SIGTERM, stop);
+  while (stopping == 0) {
+    for (auto i = 0; i < 4096; ++i) {
+      emulator.tick();
+    }
+  }
+}
+
+// The ROM image, read from stdin by every mode but --replay
+using Rom = std::array<std::uint16_t, pic1650::Emulator::device.rom_words>;
+
+Rom read_rom() {
+  Rom opcodes;
   std::cin.read(reinterpret_cast<char *>(std::data(opcodes)),
                 std::size(opcodes) * 2);
-  pic1650::LoudEmulator emulator{opcodes, std::cout};
+  return opcodes;
+}
 
+// Whether `arg` is the option `name`, alone or as `name`=<value>
+bool is_option(const std::string_view arg, const std::string_view name) {
+  return arg.starts_with(name) &&
+         (std::size(arg) == std::size(name) || arg[std::size(name)] == '=');
+}
+
+// Reads the cycle count from --option=<cycles>, if given
+bool parse_cycles(const std::string_view arg, std::uint64_t &cycles) {
+  const auto equals = arg.find('=');
+  if (equals == std::string_view::npos) {
+    return true;
+  }
+  const auto count = arg.substr(equals + 1);
+  const auto end = std::data(count) + std::size(count);
+  const auto [at, error] = std::from_chars(std::data(count), end, cycles);
+  if (error != std::errc{} || at != end) {
+    std::cerr << std::format("bad cycle count '{:s}'", count) << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void print_frame(const std::uint64_t cycle, const pic1650::Frame &frame) {
+  std::cout << std::format("{:d},{:s}", cycle, pic1650::to_string(frame))
+            << std::endl;
+}
+
+// Prints the trace of the recording in --replay=<file>, or from the cycle
+// given by --replay=<file>@<cycle> to its end after seeking there. The ROM
+// comes from the recording, so nothing is read from stdin.
+int replay(const std::string_view arg) {
+  const auto at = arg.rfind('@');
+  const std::string path{arg.substr(0, at)};
+  std::uint64_t from = 0;
+  if (at != std::string_view::npos) {
+    const auto cycle = arg.substr(at + 1);
+    const auto end = std::data(cycle) + std::size(cycle);
+    const auto [stop, error] = std::from_chars(std::data(cycle), end, from);
+    if (error != std::errc{} || stop != end) {
+      std::cerr << std::format("bad cycle '{:s}'", cycle) << std::endl;
+      return 1;
+    }
+  }
+  try {
+    std::ifstream file{path, std::ios::binary};
+    if (!file) {
+      throw std::runtime_error(std::format("can't open {:s}", path));
+    }
+    const auto recording = pic1650::Recording::load(file);
+    // Seeks without tracing, then traces on from the same state
+    pic1650::Emulator seeker{recording.rom};
+    pic1650::Replayer replayer{seeker, recording};
+    replayer.seek(from);
+    pic1650::LoudEmulator emulator{recording.rom, std::cout};
+    emulator.restore(seeker.snapshot());
+    emulator.cnt = from;
+    // Seeking applied the inputs changed on cycle from
+    const auto &events = recording.events;
+    for (auto event = std::ranges::upper_bound(events, from, {},
+                                               &pic1650::InputEvent::cycle);
+         event != std::end(events); ++event) {
+      emulator.run(event->cycle - emulator.cnt);
+      emulator.input(event->port, event->bit, event->set);
+    }
+    emulator.run(recording.cycles - emulator.cnt);
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+int binary_trace() {
+  pic1650::BinaryTraceEmulator emulator{read_rom(), std::cout};
+  trace_until_stopped(emulator);
+  emulator.flush();
+  return 0;
+}
+
+int delta_trace() {
+  pic1650::DeltaTraceEmulator emulator{read_rom(), std::cout};
+  trace_until_stopped(emulator);
+  emulator.finish();
+  return 0;
+}
+
+int frames() {
+  pic1650::Emulator emulator{read_rom()};
+  pic1650::DisplayWatcher watcher{emulator};
+  while (true) {
+    watcher.run(1u << 20, print_frame);
+  }
+}
+
+// Prints frames as the real game would show them, at the clock given in Hz
+// by --paced=<hz>, and reports how well it keeps up every second.
+int paced(const std::string_view arg) {
+  pic1650::PacingOptions options;
+  if (const auto equals = arg.find('='); equals != std::string_view::npos) {
+    const auto hz = arg.substr(equals + 1);
+    const auto end = std::data(hz) + std::size(hz);
+    const auto [at, error] =
+        std::from_chars(std::data(hz), end, options.clock_hz);
+    if (error != std::errc{} || at != end || !(options.clock_hz > 0.0)) {
+      std::cerr << std::format("bad clock frequency '{:s}'", hz) << std::endl;
+      return 1;
+    }
+  }
+  pic1650::Emulator emulator{read_rom()};
+  pic1650::DisplayWatcher watcher{emulator};
+  pic1650::Pacer pacer{options};
+  const auto second =
+      static_cast<std::uint64_t>(std::ceil(pacer.report().target_rate));
+  while (true) {
+    pacer.run(second, [&](const std::uint64_t cycles) {
+      watcher.run(cycles, print_frame);
+    });
+    const auto &report = pacer.report();
+    std::cerr << std::format(
+                     "{:.0f} of {:.0f} instructions/s ({:.1f}%), worst lag "
+                     "{:d} us, {:d} resyncs",
+                     report.achieved_rate(), report.target_rate,
+                     100.0 * report.achieved_rate() / report.target_rate,
+                     std::chrono::duration_cast<std::chrono::microseconds>(
+                         report.worst_lag)
+                         .count(),
+                     report.resyncs)
+              << std::endl;
+  }
+}
+
+// Profiles the first --profile=<cycles> instructions (100 million by
+// default) and prints the annotated listing.
+int profile(const std::string_view arg) {
+  std::uint64_t cycles = 100'000'000;
+  if (!parse_cycles(arg, cycles)) {
+    return 1;
+  }
+  const auto opcodes = read_rom();
+  pic1650::ProfilingEmulator emulator{opcodes};
+  emulator.run(cycles);
+  pic1650::write_profile(std::cout, opcodes, emulator.profile());
+  return 0;
+}
+
+// Runs the first --memo=<cycles> instructions (100 million by default)
+// replaying cached subroutine calls, and reports how well the cache did.
+int memo(const std::string_view arg) {
+  std::uint64_t cycles = 100'000'000;
+  if (!parse_cycles(arg, cycles)) {
+    return 1;
+  }
+  pic1650::MemoizingEmulator emulator{read_rom()};
+  const auto start = std::chrono::steady_clock::now();
+  emulator.run(cycles);
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  const auto stats = emulator.memo_stats();
+  std::cout << std::format(
+                   "{:d} cycles in {:.3f} s, {:d} of {:d} calls replayed "
+                   "({:.1f}%), {:d} cycles replayed ({:.1f}%)\n"
+                   "{:d} calls recorded, {:d} abandoned, {:d} evicted, "
+                   "{:d} bytes of cache",
+                   cycles, elapsed.count(), stats.hits, stats.lookups,
+                   100.0 * stats.hit_rate(), stats.cycles_replayed,
+                   cycles == 0u ? 0.0
+                                : 100.0 *
+                                      static_cast<double>(
+                                          stats.cycles_replayed) /
+                                      static_cast<double>(cycles),
+                   stats.recorded, stats.abandoned, stats.evictions,
+                   stats.memory)
+            << std::endl;
+  return 0;
+}
+
+// Renders the sound of the first --audio=<cycles> instructions (a minute at
+// the default clock by default) as a WAV file, with the speed on stderr.
+int audio(const std::string_view arg) {
+  const pic1650::AudioOptions options;
+  std::uint64_t cycles = 15'000'000;
+  if (!parse_cycles(arg, cycles)) {
+    return 1;
+  }
+  pic1650::Emulator emulator{read_rom()};
+  pic1650::AudioWatcher watcher{emulator, options};
+  pic1650::WavWriter wav{std::cout, options.sample_rate};
+  std::uint64_t samples = 0;
+  const auto write = [&](const std::span<const std::int16_t> pcm) {
+    wav.write(pcm);
+    samples += std::size(pcm);
+  };
+  const auto start = std::chrono::steady_clock::now();
+  for (auto left = cycles; left != 0u;) {
+    const auto batch = std::min<std::uint64_t>(left, 1u << 20);
+    watcher.run(batch, write);
+    left -= batch;
+  }
+  watcher.finish(write);
+  wav.finish();
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  const auto seconds = static_cast<double>(samples) / options.sample_rate;
+  std::cerr << std::format("{:d} cycles, {:.1f} s of audio in {:.3f} s "
+                           "({:.0f} times real time)",
+                           cycles, seconds, elapsed.count(),
+                           seconds / elapsed.count())
+            << std::endl;
+  return 0;
+}
+
+// Records a session to the file given by --record=<file>, with keyframes
+// to seek by. The inputs change as the lines after the ROM on stdin say,
+// "<cycle> <port> <bit> <0|1>" in order of cycle, and a line of just
+// "<cycle>" ends the session there rather than at the last change.
+int record(const std::string &path) {
+  const auto opcodes = read_rom();
+  pic1650::Emulator emulator{opcodes};
+  pic1650::Recorder recorder{emulator, opcodes};
+  std::string line;
+  for (std::size_t number = 1; std::getline(std::cin, line); ++number) {
+    std::istringstream words{line};
+    std::array<std::uint64_t, 4> fields{};
+    std::size_t count = 0;
+    bool numbers = true;
+    for (std::string word; numbers && words >> word; ++count) {
+      const auto end = std::data(word) + std::size(word);
+      numbers = count < std::size(fields) &&
+                std::from_chars(std::data(word), end, fields[count]) ==
+                    std::from_chars_result{end, std::errc{}};
+    }
+    const auto [cycle, port, bit, level] = fields;
+    if (count == 0u) {
+      continue;
+    }
+    if (numbers && (count == 1u || count == 4u) &&
+        cycle >= recorder.cycle() && port < emulator.device.ports &&
+        bit < 8u && level <= 1u) {
+      recorder.run(cycle - recorder.cycle());
+      if (count == 1u) {
+        break;
+      }
+      recorder.input(port, bit, level == 1u);
+      continue;
+    }
+    std::cerr << std::format("line {:d}: expected '<cycle> <port> <bit> "
+                             "<0|1>' or '<cycle>', in order of cycle, not "
+                             "'{:s}'",
+                             number, line)
+              << std::endl;
+    return 1;
+  }
+  try {
+    std::ofstream file{path, std::ios::binary};
+    recorder.recording().save(file);
+  } catch (const std::exception &e) {
+    std::cerr << std::format("{:s}: {:s}", path, e.what()) << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+int async_trace(const std::string_view mode) {
+  pic1650::Backpressure backpressure;
+  if (mode == "--async" || mode == "--async=block") {
+    backpressure = pic1650::Backpressure::Block;
+  } else if (mode == "--async=drop") {
+    backpressure = pic1650::Backpressure::Drop;
+  } else {
+    std::cerr << std::format("unknown option {:s}, expected --async, "
+                             "--async=block or --async=drop",
+                             mode)
+              << std::endl;
+    return 1;
+  }
+  pic1650::AsyncTraceEmulator emulator{
+      read_rom(), std::cout, {.backpressure = backpressure}};
+  trace_until_stopped(emulator);
+  // Writes out the records still in the ring and joins the threads
+  emulator.close();
+  if (backpressure == pic1650::Backpressure::Drop) {
+    std::cerr << std::format("dropped {:d} records", emulator.dropped())
+              << std::endl;
+  }
+  return 0;
+}
+
+int csv_trace() {
+  pic1650::LoudEmulator emulator{read_rom(), std::cout};
   while (true) {
     emulator.tick();
   }
 }
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  const std::string_view mode{argc > 1 ? argv[1] : ""};
+  if (mode.empty()) {
+    return csv_trace();
+  }
+  if (mode.starts_with("--replay=")) {
+    return replay(mode.substr(std::size("--replay=") - 1));
+  }
+  if (mode == "--binary") {
+    return binary_trace();
+  }
+  if (mode == "--delta") {
+    return delta_trace();
+  }
+  if (mode == "--frames") {
+    return frames();
+  }
+  if (is_option(mode, "--paced")) {
+    return paced(mode);
+  }
+  if (is_option(mode, "--profile")) {
+    return profile(mode);
+  }
+  if (is_option(mode, "--memo")) {
+    return memo(mode);
+  }
+  if (is_option(mode, "--audio")) {
+    return audio(mode);
+  }
+  if (mode.starts_with("--record=")) {
+    return record(std::string{mode.substr(std::size("--record=") - 1)});
+  }
+  if (is_option(mode, "--async")) {
+    return async_trace(mode);
+  }
+  std::cerr << std::format("unknown option {:s}", mode) << std::endl;
+  return 1;
+}
@@ -1,19 +1,186 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <bit>
 #include <cassert>
+#include <cstddef>
 #include <cstdint>
 #include <format>
 #include <iostream>
+#include <limits>
 #include <ostream>
 #include <sstream>
 #include <stdexcept>
+#include <type_traits>
+#include <utility>
 
 namespace pic1650 {
 
 using OpCode = std::uint16_t;
 
-class IOpCodes {
+enum class Mnemonic : std::uint8_t {
+  NOP,
+  MOVWF,
+  CLRW,
+  CLRF,
+  SUBWF,
+  DECF,
+  IORWF,
+  ANDWF,
+  XORWF,
+  ADDWF,
+  MOVF,
+  COMF,
+  INCF,
+  DECFSZ,
+  RRF,
+  RLF,
+  SWAPF,
+  INCFSZ,
+  BCF,
+  BSF,
+  BTFSC,
+  BTFSS,
+  RETLW,
+  CALL,
+  GOTO,
+  MOVLW,
+  IORLW,
+  ANDLW,
+  XORLW,
+  ILLEGAL_INSTRUCTION,
+};
+
+// An opcode with its operand fields already extracted, so that executing it
+// does not have to match it against every bit pattern again.
+struct Instruction {
+  Mnemonic mnemonic{Mnemonic::ILLEGAL_INSTRUCTION};
+  std::uint8_t f{};
+  // "d" for byte oriented operations, "b" for bit oriented operations
+  std::uint8_t d{};
+  // Literal for literal and control operations; the raw opcode when illegal
+  std::uint16_t k{};
+};
+
+// True when execution may not continue at the next address after this
+// instruction: jumps, calls, returns, skips and writes that may reach the
+// program counter (file 2 directly, or through the indirect file 0).
+constexpr bool ends_block(const Instruction &instruction) {
+  const bool writes_pc = (instruction.f == 0u || instruction.f == 2u);
+  switch (instruction.mnemonic) {
+  case Mnemonic::NOP:
+  case Mnemonic::CLRW:
+  case Mnemonic::MOVLW:
+  case Mnemonic::IORLW:
+  case Mnemonic::ANDLW:
+  case Mnemonic::XORLW:
+    return false;
+  case Mnemonic::MOVWF:
+  case Mnemonic::CLRF:
+  case Mnemonic::BCF:
+  case Mnemonic::BSF:
+    return writes_pc;
+  case Mnemonic::SUBWF:
+  case Mnemonic::DECF:
+  case Mnemonic::IORWF:
+  case Mnemonic::ANDWF:
+  case Mnemonic::XORWF:
+  case Mnemonic::ADDWF:
+  case Mnemonic::MOVF:
+  case Mnemonic::COMF:
+  case Mnemonic::INCF:
+  case Mnemonic::RRF:
+  case Mnemonic::RLF:
+  case Mnemonic::SWAPF:
+    return writes_pc && instruction.d == 1u;
+  case Mnemonic::DECFSZ:
+  case Mnemonic::INCFSZ:
+  case Mnemonic::BTFSC:
+  case Mnemonic::BTFSS:
+  case Mnemonic::RETLW:
+  case Mnemonic::CALL:
+  case Mnemonic::GOTO:
+  case Mnemonic::ILLEGAL_INSTRUCTION:
+    return true;
+  }
+  return true;
+}
+
+// True when the instruction operates on a file, given by its f field
+constexpr bool has_file_operand(const Mnemonic mnemonic) {
+  switch (mnemonic) {
+  case Mnemonic::NOP:
+  case Mnemonic::CLRW:
+  case Mnemonic::RETLW:
+  case Mnemonic::CALL:
+  case Mnemonic::GOTO:
+  case Mnemonic::MOVLW:
+  case Mnemonic::IORLW:
+  case Mnemonic::ANDLW:
+  case Mnemonic::XORLW:
+  case Mnemonic::ILLEGAL_INSTRUCTION:
+    return false;
+  default:
+    return true;
+  }
+}
+
+// Whether an instruction with a file operand reads and writes that file
+constexpr bool reads_file(const Mnemonic mnemonic) {
+  return mnemonic != Mnemonic::MOVWF && mnemonic != Mnemonic::CLRF;
+}
+
+constexpr bool writes_file(const Instruction &instruction) {
+  switch (instruction.mnemonic) {
+  case Mnemonic::MOVWF:
+  case Mnemonic::CLRF:
+  case Mnemonic::BCF:
+  case Mnemonic::BSF:
+    return true;
+  case Mnemonic::BTFSC:
+  case Mnemonic::BTFSS:
+    return false;
+  default:
+    return instruction.d == 1u;
+  }
+}
+
+// Bits of STATUS an instruction reads and writes, other than through its file
+// operand
+constexpr std::uint8_t reads_status(const Mnemonic mnemonic) {
+  return mnemonic == Mnemonic::RRF || mnemonic == Mnemonic::RLF ? 0b001u : 0u;
+}
+
+constexpr std::uint8_t writes_status(const Mnemonic mnemonic) {
+  switch (mnemonic) {
+  case Mnemonic::SUBWF:
+  case Mnemonic::ADDWF:
+    return 0b111u;
+  case Mnemonic::RRF:
+  case Mnemonic::RLF:
+    return 0b001u;
+  case Mnemonic::CLRW:
+  case Mnemonic::CLRF:
+  case Mnemonic::DECF:
+  case Mnemonic::IORWF:
+  case Mnemonic::ANDWF:
+  case Mnemonic::XORWF:
+  case Mnemonic::MOVF:
+  case Mnemonic::COMF:
+  case Mnemonic::INCF:
+  case Mnemonic::IORLW:
+  case Mnemonic::ANDLW:
+  case Mnemonic::XORLW:
+    return 0b100u;
+  default:
+    return 0u;
+  }
+}
+
+// Statically dispatched instruction decoder: dispatch() calls the mnemonic
+// handlers of Derived directly, so they can be inlined into the caller.
+template <typename Derived> class BasicOpCodes {
 private:
   static constexpr bool is_match(const OpCode opcode,
                                  const std::uint16_t pattern,
@@ -42,68 +209,172 @@ private:
   }
 
 public:
-  virtual void dispatch(const OpCode opcode) {
+  static constexpr Instruction decode(const OpCode opcode) {
     if (is_match(opcode, 0b0000'0000'0000, 0b1111'1111'1111)) {
-      NOP();
+      return {Mnemonic::NOP};
     } else if (is_match(opcode, 0b0000'0010'0000, 0b1111'1110'0000)) {
-      MOVWF(f(opcode));
+      return {Mnemonic::MOVWF, f(opcode)};
     } else if (is_match(opcode, 0b0000'0100'0000, 0b1111'1111'1111)) {
-      CLRW();
+      return {Mnemonic::CLRW};
     } else if (is_match(opcode, 0b0000'0110'0000, 0b1111'1110'0000)) {
-      CLRF(f(opcode));
+      return {Mnemonic::CLRF, f(opcode)};
     } else if (is_match(opcode, 0b0000'1000'0000, 0b1111'1100'0000)) {
-      SUBWF(f(opcode), d(opcode));
+      return {Mnemonic::SUBWF, f(opcode), d(opcode)};
     } else if (is_match(opcode, 0b0000'1100'0000, 0b1111'1100'0000)) {
-      DECF(f(opcode), d(opcode));
+      return {Mnemonic::DECF, f(opcode), d(opcode)};
     } else if (is_match(opcode, 0b0001'0000'0000, 0b1111'1100'0000)) {
-      IORWF(f(opcode), d(opcode));
+      return {Mnemonic::IORWF, f(opcode), d(opcode)};
     } else if (is_match(opcode, 0b0001'0100'0000, 0b1111'1100'0000)) {
-      ANDWF(f(opcode), d(opcode));
+      return {Mnemonic::ANDWF, f(opcode), d(opcode)};
     } else if (is_match(opcode, 0b0001'1000'0000, 0b1111'1100'0000)) {
-      XORWF(f(opcode), d(opcode));
+      return {Mnemonic::XORWF, f(opcode), d(opcode)};
     } else if (is_match(opcode, 0b0001'1100'0000, 0b1111'1100'0000)) {
-      ADDWF(f(opcode), d(opcode));
+      return {Mnemonic::ADDWF, f(opcode), d(opcode)};
     } else if (is_match(opcode, 0b0010'0000'0000, 0b1111'1100'0000)) {
-      MOVF(f(opcode), d(opcode));
+      return {Mnemonic::MOVF, f(opcode), d(opcode)};
     } else if (is_match(opcode, 0b0010'0100'0000, 0b1111'1100'0000)) {
-      COMF(f(opcode), d(opcode));
+      return {Mnemonic::COMF, f(opcode), d(opcode)};
     } else if (is_match(opcode, 0b0010'1000'0000, 0b1111'1100'0000)) {
-      INCF(f(opcode), d(opcode));
+      return {Mnemonic::INCF, f(opcode), d(opcode)};
     } else if (is_match(opcode, 0b0010'1100'0000, 0b1111'1100'0000)) {
-      DECFSZ(f(opcode), d(opcode));
+      return {Mnemonic::DECFSZ, f(opcode), d(opcode)};
     } else if (is_match(opcode, 0b0011'0000'0000, 0b1111'1100'0000)) {
-      RRF(f(opcode), d(opcode));
+      return {Mnemonic::RRF, f(opcode), d(opcode)};
     } else if (is_match(opcode, 0b0011'0100'0000, 0b1111'1100'0000)) {
-      RLF(f(opcode), d(opcode));
+      return {Mnemonic::RLF, f(opcode), d(opcode)};
     } else if (is_match(opcode, 0b0011'1000'0000, 0b1111'1100'0000)) {
-      SWAPF(f(opcode), d(opcode));
+      return {Mnemonic::SWAPF, f(opcode), d(opcode)};
     } else if (is_match(opcode, 0b0011'1100'0000, 0b1111'1100'0000)) {
-      INCFSZ(f(opcode), d(opcode));
+      return {Mnemonic::INCFSZ, f(opcode), d(opcode)};
     } else if (is_match(opcode, 0b0100'0000'0000, 0b1111'0000'0000)) {
-      BCF(f(opcode), b(opcode));
+      return {Mnemonic::BCF, f(opcode), b(opcode)};
     } else if (is_match(opcode, 0b0101'0000'0000, 0b1111'0000'0000)) {
-      BSF(f(opcode), b(opcode));
+      return {Mnemonic::BSF, f(opcode), b(opcode)};
     } else if (is_match(opcode, 0b0110'0000'0000, 0b1111'0000'0000)) {
-      BTFSC(f(opcode), b(opcode));
+      return {Mnemonic::BTFSC, f(opcode), b(opcode)};
     } else if (is_match(opcode, 0b0111'0000'0000, 0b1111'0000'0000)) {
-      BTFSS(f(opcode), b(opcode));
+      return {Mnemonic::BTFSS, f(opcode), b(opcode)};
     } else if (is_match(opcode, 0b1000'0000'0000, 0b1111'0000'0000)) {
-      RETLW(k8(opcode));
+      return {Mnemonic::RETLW, 0, 0, k8(opcode)};
     } else if (is_match(opcode, 0b1001'0000'0000, 0b1111'0000'0000)) {
-      CALL(k8(opcode));
+      return {Mnemonic::CALL, 0, 0, k8(opcode)};
     } else if (is_match(opcode, 0b1010'0000'0000, 0b1110'0000'0000)) {
-      GOTO(k9(opcode));
+      return {Mnemonic::GOTO, 0, 0, k9(opcode)};
     } else if (is_match(opcode, 0b1100'0000'0000, 0b1111'0000'0000)) {
-      MOVLW(k8(opcode));
+      return {Mnemonic::MOVLW, 0, 0, k8(opcode)};
     } else if (is_match(opcode, 0b1101'0000'0000, 0b1111'0000'0000)) {
-      IORLW(k8(opcode));
+      return {Mnemonic::IORLW, 0, 0, k8(opcode)};
     } else if (is_match(opcode, 0b1110'0000'0000, 0b1111'0000'0000)) {
-      ANDLW(k8(opcode));
+      return {Mnemonic::ANDLW, 0, 0, k8(opcode)};
     } else if (is_match(opcode, 0b1111'0000'0000, 0b1111'0000'0000)) {
-      XORLW(k8(opcode));
+      return {Mnemonic::XORLW, 0, 0, k8(opcode)};
     } else {
-      ILLEGAL_INSTRUCTION(opcode);
+      return {Mnemonic::ILLEGAL_INSTRUCTION, 0, 0, opcode};
+    }
+  }
+
+  template <std::size_t N>
+  static constexpr std::array<Instruction, N>
+  decode(const std::array<OpCode, N> &rom) {
+    std::array<Instruction, N> program{};
+    for (std::size_t address = 0; address < N; ++address) {
+      program[address] = decode(rom[address]);
+    }
+    return program;
+  }
+
+  constexpr void dispatch(const OpCode opcode) { dispatch(decode(opcode)); }
+
+  constexpr void dispatch(const Instruction &instruction) {
+    const auto [mnemonic, f, d, k] = instruction;
+    switch (mnemonic) {
+    case Mnemonic::NOP:
+      return self().NOP();
+    case Mnemonic::MOVWF:
+      return self().MOVWF(f);
+    case Mnemonic::CLRW:
+      return self().CLRW();
+    case Mnemonic::CLRF:
+      return self().CLRF(f);
+    case Mnemonic::SUBWF:
+      return self().SUBWF(f, d);
+    case Mnemonic::DECF:
+      return self().DECF(f, d);
+    case Mnemonic::IORWF:
+      return self().IORWF(f, d);
+    case Mnemonic::ANDWF:
+      return self().ANDWF(f, d);
+    case Mnemonic::XORWF:
+      return self().XORWF(f, d);
+    case Mnemonic::ADDWF:
+      return self().ADDWF(f, d);
+    case Mnemonic::MOVF:
+      return self().MOVF(f, d);
+    case Mnemonic::COMF:
+      return self().COMF(f, d);
+    case Mnemonic::INCF:
+      return self().INCF(f, d);
+    case Mnemonic::DECFSZ:
+      return self().DECFSZ(f, d);
+    case Mnemonic::RRF:
+      return self().RRF(f, d);
+    case Mnemonic::RLF:
+      return self().RLF(f, d);
+    case Mnemonic::SWAPF:
+      return self().SWAPF(f, d);
+    case Mnemonic::INCFSZ:
+      return self().INCFSZ(f, d);
+    case Mnemonic::BCF:
+      return self().BCF(f, d);
+    case Mnemonic::BSF:
+      return self().BSF(f, d);
+    case Mnemonic::BTFSC:
+      return self().BTFSC(f, d);
+    case Mnemonic::BTFSS:
+      return self().BTFSS(f, d);
+    case Mnemonic::RETLW:
+      return self().RETLW(k);
+    case Mnemonic::CALL:
+      return self().CALL(k);
+    case Mnemonic::GOTO:
+      return self().GOTO(k);
+    case Mnemonic::MOVLW:
+      return self().MOVLW(k);
+    case Mnemonic::IORLW:
+      return self().IORLW(k);
+    case Mnemonic::ANDLW:
+      return self().ANDLW(k);
+    case Mnemonic::XORLW:
+      return self().XORLW(k);
+    case Mnemonic::ILLEGAL_INSTRUCTION:
+      break;
     }
+    return self().ILLEGAL_INSTRUCTION(k);
+  }
+
+  constexpr void NOP() {}
+
+  void ILLEGAL_INSTRUCTION(const OpCode opcode) {
+    throw std::runtime_error(
+        std::format("b{:012b} is an illegal instruction", opcode));
+  }
+
+protected:
+  constexpr Derived &self() { return static_cast<Derived &>(*this); }
+};
+
+// Runtime polymorphic adapter over BasicOpCodes, for callers that need to
+// pick an implementation at run time.
+class IOpCodes : public BasicOpCodes<IOpCodes> {
+public:
+  virtual ~IOpCodes() = default;
+
+  virtual void dispatch(const OpCode opcode) {
+    BasicOpCodes::dispatch(opcode);
+  }
+
+  void dispatch(const Instruction &instruction) {
+    BasicOpCodes::dispatch(instruction);
   }
 
   virtual void NOP(){};
@@ -155,227 +426,359 @@ public:
   virtual void XORLW(const std::uint8_t k) = 0;
 
   virtual void ILLEGAL_INSTRUCTION(const OpCode opcode) {
-    throw std::runtime_error(
-        std::format("b{:012b} is an illegal instruction", opcode));
+    BasicOpCodes::ILLEGAL_INSTRUCTION(opcode);
   };
 };
 
-class OpCodeStream final : public IOpCodes {
+class OpCodeStream final : public BasicOpCodes<OpCodeStream> {
 private:
   std::ostream &os;
 
 public:
   explicit OpCodeStream(std::ostream &os) noexcept : os{os} {}
 
-  void NOP() override { os << std::format("{:8s}\n", "NOP"); };
+  void NOP() { os << std::format("{:8s}\n", "NOP"); };
 
-  void MOVWF(const std::uint8_t f) override {
+  void MOVWF(const std::uint8_t f) {
     os << std::format("{:8s} F{:<2d}\n", "MOVWF", f);
   }
 
-  void CLRW() override { os << std::format("{:8s}\n", "CLRW"); }
+  void CLRW() { os << std::format("{:8s}\n", "CLRW"); }
 
-  void CLRF(const std::uint8_t f) override {
+  void CLRF(const std::uint8_t f) {
     os << std::format("{:8s} F{:<2d}\n", "CLRF", f);
   }
 
   void SUBWF(const std::uint8_t f,
-             const std::uint8_t d) override {
+             const std::uint8_t d) {
     os << std::format("{:8s} F{:<2d} D{:1d}\n", "SUBWF", f, d);
   }
 
-  void DECF(const std::uint8_t f, const std::uint8_t d) override {
+  void DECF(const std::uint8_t f, const std::uint8_t d) {
     os << std::format("{:8s} F{:<2d} D{:1d}\n", "DECF", f, d);
   }
 
   void IORWF(const std::uint8_t f,
-             const std::uint8_t d) override {
+             const std::uint8_t d) {
     os << std::format("{:8s} F{:<2d} D{:1d}\n", "IORWF", f, d);
   }
 
   void ANDWF(const std::uint8_t f,
-             const std::uint8_t d) override {
+             const std::uint8_t d) {
     os << std::format("{:8s} F{:<2d} D{:1d}\n", "ANDWF", f, d);
   }
 
   void XORWF(const std::uint8_t f,
-             const std::uint8_t d) override {
+             const std::uint8_t d) {
     os << std::format("{:8s} F{:<2d} D{:1d}\n", "XORWF", f, d);
   }
 
   void ADDWF(const std::uint8_t f,
-             const std::uint8_t d) override {
+             const std::uint8_t d) {
     os << std::format("{:8s} F{:<2d} D{:1d}\n", "ADDWF", f, d);
   }
 
-  void MOVF(const std::uint8_t f, const std::uint8_t d) override {
+  void MOVF(const std::uint8_t f, const std::uint8_t d) {
     os << std::format("{:8s} F{:<2d} D{:1d}\n", "MOVF", f, d);
   }
 
-  void COMF(const std::uint8_t f, const std::uint8_t d) override {
+  void COMF(const std::uint8_t f, const std::uint8_t d) {
     os << std::format("{:8s} F{:<2d} D{:1d}\n", "COMF", f, d);
   }
 
-  void INCF(const std::uint8_t f, const std::uint8_t d) override {
+  void INCF(const std::uint8_t f, const std::uint8_t d) {
     os << std::format("{:8s} F{:<2d} D{:1d}\n", "INCF", f, d);
   }
 
   void DECFSZ(const std::uint8_t f,
-              const std::uint8_t d) override {
+              const std::uint8_t d) {
     os << std::format("{:8s} F{:<2d} D{:1d}\n", "DECFSZ", f, d);
   }
 
-  void RRF(const std::uint8_t f, const std::uint8_t d) override {
+  void RRF(const std::uint8_t f, const std::uint8_t d) {
     os << std::format("{:8s} F{:<2d} D{:1d}\n", "RRF", f, d);
   }
 
-  void RLF(const std::uint8_t f, const std::uint8_t d) override {
+  void RLF(const std::uint8_t f, const std::uint8_t d) {
     os << std::format("{:8s} F{:<2d} D{:1d}\n", "RLF", f, d);
   }
 
   void SWAPF(const std::uint8_t f,
-             const std::uint8_t d) override {
+             const std::uint8_t d) {
     os << std::format("{:8s} F{:<2d} D{:1d}\n", "SWAPF", f, d);
   }
 
   void INCFSZ(const std::uint8_t f,
-              const std::uint8_t d) override {
+              const std::uint8_t d) {
     os << std::format("{:8s} F{:<2d} D{:1d}\n", "INCFSZ", f, d);
   }
 
-  void BCF(const std::uint8_t f, const std::uint8_t b) override {
+  void BCF(const std::uint8_t f, const std::uint8_t b) {
     os << std::format("{:8s} F{:<2d} B{:1d}\n", "BCF", f, b);
   }
 
-  void BSF(const std::uint8_t f, const std::uint8_t b) override {
+  void BSF(const std::uint8_t f, const std::uint8_t b) {
     os << std::format("{:8s} F{:<2d} B{:1d}\n", "BSF", f, b);
   }
 
   void BTFSC(const std::uint8_t f,
-             const std::uint8_t b) override {
+             const std::uint8_t b) {
     os << std::format("{:8s} F{:<2d} B{:1d}\n", "BTFSC", f, b);
   }
 
   void BTFSS(const std::uint8_t f,
-             const std::uint8_t b) override {
+             const std::uint8_t b) {
     os << std::format("{:8s} F{:<2d} B{:1d}\n", "BTFSS", f, b);
   }
 
-  void RETLW(const std::uint8_t k) override {
+  void RETLW(const std::uint8_t k) {
     os << std::format("{:8s} {:03d} x{:02X}   b{:08b} o{:03o}\n", "RETLW", k, k,
                       k, k);
   }
 
-  void CALL(const std::uint8_t k) override {
+  void CALL(const std::uint8_t k) {
     os << std::format("{:8s} {:<3d} x{:02X}   b{:08b} o{:03o}\n", "CALL", k, k,
                       k, k);
   }
 
-  void GOTO(const std::uint16_t k) override {
+  void GOTO(const std::uint16_t k) {
     os << std::format("{:8s} {:<3d} x{:03X} b{:09b} o{:03o}\n", "GOTO", k, k, k,
                       k);
   }
 
-  void MOVLW(const std::uint8_t k) override {
+  void MOVLW(const std::uint8_t k) {
     os << std::format("{:8s} {:<3d} x{:02X}   b{:08b} o{:03o}\n", "MOVLW", k, k,
                       k, k);
   }
 
-  void IORLW(const std::uint8_t k) override {
+  void IORLW(const std::uint8_t k) {
     os << std::format("{:8s} {:<3d} x{:02X}   b{:08b} o{:03o}\n", "IORLW", k, k,
                       k, k);
   }
 
-  void ANDLW(const std::uint8_t k) override {
+  void ANDLW(const std::uint8_t k) {
     os << std::format("{:8s} {:<3d} x{:02X}   b{:08b} o{:03o}\n", "ANDLW", k, k,
                       k, k);
   }
 
-  void XORLW(const std::uint8_t k) override {
+  void XORLW(const std::uint8_t k) {
     os << std::format("{:8s} {:<3d} x{:02X}   b{:08b} o{:03o}\n", "XORLW", k, k,
                       k, k);
   }
 };
 
-class Emulator : public IOpCodes {
-protected:
-  const std::array<OpCode, 512> rom;
-  std::uint16_t pc{0x1ffu};
+// The sizes that tell the parts of the family apart. Every part has the 12-bit
+// instruction set and its 32 files; the ports start at file 5, and the
+// general purpose registers take the files after them.
+struct Device {
+  // Words of ROM, a power of two; pc wraps around it and resets to the top
+  std::size_t rom_words{512};
+  std::size_t ports{4};
+  // Return addresses the stack holds
+  std::size_t stack_depth{2};
+
+  constexpr std::uint16_t pc_mask() const {
+    return static_cast<std::uint16_t>(rom_words - 1u);
+  }
+
+  constexpr std::uint16_t reset_vector() const { return pc_mask(); }
+
+  constexpr std::size_t general_purpose_registers() const {
+    return 32u - 5u - ports;
+  }
+};
+
+namespace devices {
+inline constexpr Device pic1650{.rom_words = 512, .ports = 4, .stack_depth = 2};
+// Ports A and B, with files 7 and 8 general purpose
+inline constexpr Device pic1654{.rom_words = 512, .ports = 2, .stack_depth = 2};
+// Ports A to C, with file 8 general purpose
+inline constexpr Device pic1655{.rom_words = 512, .ports = 3, .stack_depth = 2};
+} // namespace devices
+
+// The whole machine state, as captured by BasicEmulator::snapshot(). It is
+// trivially copyable, so states can be stored in bulk and copied around freely.
+template <Device D> struct BasicState {
+  std::uint16_t pc{D.reset_vector()};
+  std::array<std::uint16_t, D.stack_depth> stack{[] {
+    std::array<std::uint16_t, D.stack_depth> empty;
+    empty.fill(0xffffu);
+    return empty;
+  }()};
   std::uint8_t rtcc{};
   std::uint8_t w{};
   std::uint8_t fsr{};
-  struct Status {
-    std::uint8_t C : 1;
-    std::uint8_t DC : 1;
-    std::uint8_t Z : 1;
-    std::uint8_t reserved : 5;
-  } status;
-  std::array<std::uint8_t, 23> general_purpose_registers{};
-  std::array<std::uint8_t, 4> inputs{0xffu, 0xffu, 0xffu, 0xffu};
-  std::array<std::uint8_t, 4> output_latches{};
-  std::array<std::uint16_t, 2> stack{0xffffu, 0xffffu};
+  // C, DC and Z in bits 0 to 2
+  std::uint8_t status{};
+  std::array<std::uint8_t, D.general_purpose_registers()>
+      general_purpose_registers{};
+  std::array<std::uint8_t, D.ports> inputs{[] {
+    std::array<std::uint8_t, D.ports> floating;
+    floating.fill(0xffu);
+    return floating;
+  }()};
+  std::array<std::uint8_t, D.ports> output_latches{};
+
+  bool operator==(const BasicState &) const = default;
+};
+
+using State = BasicState<devices::pic1650>;
+
+static_assert(std::is_trivially_copyable_v<State>);
+
+// Addresses in the register file, the same on every part
+enum File : std::uint8_t {
+  INDF = 0,
+  RTCC = 1,
+  PCL = 2,
+  STATUS = 3,
+  FSR = 4,
+  PORTA = 5,
+};
+
+// Files whose reads or writes have side effects, or need more than a load
+// or store: INDF both ways, reads of pc and the ports, writes of pc and
+// the masked STATUS and FSR.
+inline constexpr std::uint8_t trap_read = 0b01u;
+inline constexpr std::uint8_t trap_write = 0b10u;
+
+constexpr std::array<std::uint8_t, 32> file_traps(const Device &device) {
+  std::array<std::uint8_t, 32> files{trap_read | trap_write, 0,
+                                     trap_read | trap_write, trap_write,
+                                     trap_write};
+  std::fill_n(std::begin(files) + PORTA, device.ports, trap_read);
+  return files;
+}
+
+// Statically dispatched emulator core for the part described by D. Derived
+// may hide read_io_port() to customise port reads, or wrap tick(); neither
+// costs a virtual call. Every size and mask comes from D at compile time.
+template <typename Derived, Device D = devices::pic1650>
+class BasicEmulator : public BasicOpCodes<Derived> {
+  static_assert(std::has_single_bit(D.rom_words) && D.rom_words <= 512,
+                "GOTO reaches nine bits of ROM");
+  static_assert(D.ports >= 1 && D.ports <= 4 && D.stack_depth >= 1);
+
+public:
+  static constexpr Device device = D;
+  using State = BasicState<D>;
 
-  void increment_pc() { pc = (pc + 1u) & 0x1ffu; }
+protected:
+  static constexpr std::size_t rom_words = D.rom_words;
+  static constexpr std::uint16_t pc_mask = D.pc_mask();
+
+  const std::array<OpCode, rom_words> rom;
+  const std::array<Instruction, rom_words> program;
+  // Instructions in one pass around the idle loop starting at each address,
+  // or 0 when no such loop starts there (see measure_loops())
+  const std::array<std::uint8_t, rom_words> loop_lengths;
+  // Number of instructions from each address to the end of its block, plus
+  // loop_head where run() may skip an idle loop
+  const std::array<std::uint16_t, rom_words> block_lengths;
+  std::uint16_t pc{D.reset_vector()};
+  std::uint8_t w{};
+
+  static constexpr std::uint8_t GPR = PORTA + D.ports;
+
+  // The register file, with every file at its own address so that plain
+  // reads and writes are one load or store. STATUS holds just C, DC and Z,
+  // and FSR holds its unused bits set, as both read back. PCL is never
+  // stored: pc is nine bits and changes every instruction, so reads of it
+  // are trapped instead.
+  std::array<std::uint8_t, 32> registers{0, 0, 0, 0, 0b1110'0000u};
+  std::array<std::uint8_t, D.ports> inputs{State{}.inputs};
+  std::array<std::uint16_t, D.stack_depth> stack{State{}.stack};
+
+  // Bits of STATUS
+  static constexpr std::uint8_t C = 0b001u;
+  static constexpr std::uint8_t DC = 0b010u;
+  static constexpr std::uint8_t Z = 0b100u;
 
-  std::uint8_t read_file(const std::uint8_t f) {
+  static constexpr std::array<std::uint8_t, 32> traps = file_traps(D);
+
+  // Jump targets are nine bits, which wrap around a smaller ROM
+  static constexpr std::uint16_t in_rom(const std::uint16_t address) {
+    if constexpr (rom_words == 512) {
+      return address;
+    } else {
+      return address & pc_mask;
+    }
+  }
+
+  constexpr void increment_pc() { pc = (pc + 1u) & pc_mask; }
+
+  constexpr std::uint8_t fsr() const { return registers[FSR] & 0b1'1111u; }
+
+  constexpr bool status(const std::uint8_t bit) const {
+    return (registers[STATUS] & bit) != 0u;
+  }
+
+  constexpr void set_status(const std::uint8_t bit, const bool value) {
+    registers[STATUS] = static_cast<std::uint8_t>(
+        (registers[STATUS] & ~bit) | (value ? bit : 0u));
+  }
+
+  template <std::size_t N>
+  constexpr std::array<std::uint8_t, N> slice(const std::size_t first) const {
+    std::array<std::uint8_t, N> copy;
+    std::copy_n(std::begin(registers) + static_cast<std::ptrdiff_t>(first), N,
+                std::begin(copy));
+    return copy;
+  }
+
+  constexpr std::array<std::uint8_t, D.ports> output_latches() const {
+    return slice<D.ports>(PORTA);
+  }
+
+  constexpr std::array<std::uint8_t, D.general_purpose_registers()>
+  general_purpose_registers() const {
+    return slice<D.general_purpose_registers()>(GPR);
+  }
+
+  constexpr std::uint8_t read_file(const std::uint8_t f) {
     assert(f < 32);
+    if ((traps[f] & trap_read) == 0u) [[likely]] {
+      return registers[f];
+    }
     switch (f) {
-    case 0:
+    case INDF:
       // "0" is a virtual file which indirectly reads from the register file
       // pointed to by fsr
-      assert(fsr != 0);
-      return read_file(fsr);
-    case 1:
-      return rtcc;
-    case 2:
+      assert(fsr() != 0);
+      return read_file(fsr());
+    case PCL:
       return pc & 0b1111'1111;
-    case 3:
-      return std::bit_cast<std::uint8_t>(status) & 0b111;
-    case 4:
-      return 0b1110'0000 | fsr;
-    case 5:
-    case 6:
-    case 7:
-    case 8:
-      return read_io_port(f - 5u);
     default:
-      return general_purpose_registers[f - 9];
+      return this->self().read_io_port(f - PORTA);
     }
   }
 
-  std::uint8_t write_file(const std::uint8_t f, const std::uint8_t x) {
+  constexpr std::uint8_t write_file(const std::uint8_t f,
+                                    const std::uint8_t x) {
     assert(f < 32);
+    if ((traps[f] & trap_write) == 0u) [[likely]] {
+      registers[f] = x;
+      return x;
+    }
     switch (f) {
-    case 0:
+    case INDF:
       // "0" is a virtual file which indirectly writes to the register file
       // pointed to by fsr
-      assert(fsr != 0);
-      return write_file(fsr, x);
-    case 1:
-      rtcc = x;
-      return x;
-    case 2:
-      pc = x;
-      return x;
-    case 3:
-      status = std::bit_cast<Status>(static_cast<std::uint8_t>(x & 0b111u));
-      return std::bit_cast<std::uint8_t>(status);
-    case 4:
-      fsr = x & 0b1'1111;
-      return fsr;
-    case 5:
-    case 6:
-    case 7:
-    case 8:
-      output_latches[f - 5] = x;
+      assert(fsr() != 0);
+      return write_file(fsr(), x);
+    case PCL:
+      pc = in_rom(x);
       return x;
+    case STATUS:
+      registers[STATUS] = x & 0b111u;
+      return registers[STATUS];
     default:
-      general_purpose_registers[f - 9] = x;
-      return x;
+      registers[FSR] = 0b1110'0000u | x;
+      return fsr();
     }
   }
 
-  std::uint8_t write_file(const std::uint8_t f, const std::uint8_t d,
+  constexpr std::uint8_t write_file(const std::uint8_t f, const std::uint8_t d,
                           const std::uint8_t x) {
     if (d == 0u) {
       w = x;
@@ -385,21 +788,269 @@ protected:
     }
   }
 
-  virtual std::uint8_t read_io_port(const std::uint8_t port) {
-    return output_latches[port] & inputs[port];
+  constexpr std::uint8_t read_io_port(const std::uint8_t port) {
+    return registers[PORTA + port] & inputs[port];
   }
 
 public:
-  Emulator(const std::array<OpCode, 512> &rom) : rom(rom) {}
+  // Blocks also end at the top of the ROM, so that straight-line code
+  // wrapping around to address 0 cannot run past a budget check.
+  static constexpr bool ends_block_at(const std::array<Instruction, rom_words> &code,
+                                      const std::size_t address) {
+    return ends_block(code[address]) || address + 1 == std::size(code);
+  }
+
+  static constexpr std::array<std::uint16_t, rom_words>
+  measure_blocks(const std::array<Instruction, rom_words> &code) {
+    std::array<std::uint16_t, rom_words> lengths{};
+    for (std::size_t address = std::size(code); address-- > 0;) {
+      lengths[address] = ends_block_at(code, address)
+                             ? 1u
+                             : static_cast<std::uint16_t>(lengths[address + 1] + 1u);
+    }
+    return lengths;
+  }
+
+  static constexpr std::size_t max_loop_length = 16;
+  static constexpr std::uint16_t loop_head = 0x8000u;
+
+  // Finds idle loops: cycles of at most max_loop_length instructions that
+  // only count general purpose registers down or up to zero (DECFSZ and
+  // INCFSZ f,1, each register at most once), test bits the loop cannot change
+  // (BTFSC and BTFSS, staying in the loop when they don't skip), GOTO and NOP.
+  // Such a loop writes nothing but its counters, so the pass on which it
+  // leaves can be computed from their values. I/O ports count as unchanging
+  // only when `ports_invariant`, that is when reading them has no effects.
+  static constexpr std::array<std::uint8_t, rom_words>
+  measure_loops(const std::array<Instruction, rom_words> &code,
+                const bool ports_invariant) {
+    std::array<std::uint8_t, rom_words> lengths{};
+    for (std::size_t start = 0; start < std::size(code); ++start) {
+      std::uint32_t counted = 0;
+      std::uint32_t tested = 0;
+      auto address = start;
+      for (std::size_t length = 1; length <= max_loop_length; ++length) {
+        const auto &instruction = code[address];
+        const auto file = std::uint32_t{1} << instruction.f;
+        if (instruction.mnemonic == Mnemonic::GOTO) {
+          address = in_rom(instruction.k);
+        } else if (instruction.mnemonic == Mnemonic::NOP) {
+          address = (address + 1u) & pc_mask;
+        } else if ((instruction.mnemonic == Mnemonic::DECFSZ ||
+                    instruction.mnemonic == Mnemonic::INCFSZ) &&
+                   instruction.d == 1u && instruction.f >= GPR &&
+                   (counted & file) == 0u) {
+          counted |= file;
+          address = (address + 1u) & pc_mask;
+        } else if ((instruction.mnemonic == Mnemonic::BTFSC ||
+                    instruction.mnemonic == Mnemonic::BTFSS) &&
+                   (instruction.f == STATUS || instruction.f == FSR ||
+                    instruction.f >= GPR ||
+                    (instruction.f >= PORTA && ports_invariant))) {
+          tested |= file;
+          address = (address + 1u) & pc_mask;
+        } else {
+          break;
+        }
+        if (address == start) {
+          if ((counted & tested) == 0u) {
+            lengths[start] = static_cast<std::uint8_t>(length);
+          }
+          break;
+        }
+      }
+    }
+    return lengths;
+  }
+
+  // Flags the start of every idle loop run() may skip in block lengths
+  static constexpr std::array<std::uint16_t, rom_words>
+  mark_loops(std::array<std::uint16_t, rom_words> lengths,
+             const std::array<std::uint8_t, rom_words> &loops) {
+    if constexpr (skips_loops()) {
+      for (std::size_t address = 0; address < std::size(lengths); ++address) {
+        if (loops[address] != 0u) {
+          lengths[address] |= loop_head;
+        }
+      }
+    }
+    return lengths;
+  }
+
+  // True when Derived wraps tick(), in which case run() and run_until() must
+  // go through it rather than execute(), which calls this tick().
+  static constexpr bool wraps_tick() {
+    return !std::is_same_v<decltype(&Derived::tick),
+                           decltype(&BasicEmulator::tick)>;
+  }
+
+  // True when Derived hides read_io_port(), whose calls then can't be elided.
+  static constexpr bool hides_read_io_port() {
+    return !std::is_same_v<decltype(&Derived::read_io_port),
+                           decltype(&BasicEmulator::read_io_port)>;
+  }
+
+  // Idle loops are only skipped when Derived runs every instruction in them
+  // with the stock handlers, so that skipping them can't be observed.
+  static constexpr bool skips_loops() {
+    return std::is_same_v<decltype(&Derived::DECFSZ),
+                          decltype(&BasicEmulator::DECFSZ)> &&
+           std::is_same_v<decltype(&Derived::INCFSZ),
+                          decltype(&BasicEmulator::INCFSZ)> &&
+           std::is_same_v<decltype(&Derived::BTFSC),
+                          decltype(&BasicEmulator::BTFSC)> &&
+           std::is_same_v<decltype(&Derived::BTFSS),
+                          decltype(&BasicEmulator::BTFSS)> &&
+           std::is_same_v<decltype(&Derived::GOTO),
+                          decltype(&BasicEmulator::GOTO)> &&
+           std::is_same_v<decltype(&Derived::NOP),
+                          decltype(&BasicEmulator::NOP)>;
+  }
+
+  // Skips ahead through the idle loop at pc, without running more than
+  // `cycles` instructions, and returns the number of instructions skipped.
+  // Every counter, rtcc and pc end up exactly as running the loop would have
+  // left them; nothing else in the loop writes, so w and status are
+  // unchanged. Leaving on the first pass skips nothing.
+  constexpr std::uint64_t fast_forward(const std::uint64_t cycles) {
+    const std::uint64_t length = loop_lengths[pc];
+    // Passes up to and including the one that leaves, the instructions run
+    // on that pass and the address it leaves from
+    auto passes = std::numeric_limits<std::uint64_t>::max();
+    std::uint64_t last_pass = 0;
+    std::uint16_t exit = 0;
+    auto address = pc;
+    for (std::uint64_t step = 1; step <= length; ++step) {
+      const auto &instruction = program[address];
+      std::uint64_t leaves = passes;
+      if (instruction.mnemonic == Mnemonic::DECFSZ) {
+        const auto value = registers[instruction.f];
+        leaves = value == 0u ? 256u : value;
+      } else if (instruction.mnemonic == Mnemonic::INCFSZ) {
+        leaves = 256u - registers[instruction.f];
+      } else if (instruction.mnemonic == Mnemonic::BTFSC ||
+                 instruction.mnemonic == Mnemonic::BTFSS) {
+        const bool set = (read_file(instruction.f) >> instruction.d) & 1u;
+        if (set == (instruction.mnemonic == Mnemonic::BTFSS)) {
+          return 0;
+        }
+      }
+      if (leaves < passes) {
+        passes = leaves;
+        last_pass = step;
+        exit = address;
+      }
+      address = instruction.mnemonic == Mnemonic::GOTO
+                    ? in_rom(instruction.k)
+                    : static_cast<std::uint16_t>((address + 1u) & pc_mask);
+    }
+
+    // Run whole passes only when the budget ends before the loop does
+    const bool leaves = passes != std::numeric_limits<std::uint64_t>::max() &&
+                        (passes - 1u) * length + last_pass <= cycles;
+    const auto whole = leaves ? passes - 1u : cycles / length;
+    if (whole == 0u) {
+      return 0;
+    }
+    const auto skipped = whole * length + (leaves ? last_pass : 0u);
+
+    address = pc;
+    for (std::uint64_t step = 1; step <= length; ++step) {
+      const auto &instruction = program[address];
+      const auto count = static_cast<std::uint8_t>(
+          whole + (leaves && step <= last_pass ? 1u : 0u));
+      if (instruction.mnemonic == Mnemonic::DECFSZ) {
+        registers[instruction.f] -= count;
+      } else if (instruction.mnemonic == Mnemonic::INCFSZ) {
+        registers[instruction.f] += count;
+      }
+      address = instruction.mnemonic == Mnemonic::GOTO
+                    ? in_rom(instruction.k)
+                    : static_cast<std::uint16_t>((address + 1u) & pc_mask);
+    }
+    registers[RTCC] += static_cast<std::uint8_t>(skipped);
+    if (leaves) {
+      pc = (exit + 2u) & pc_mask;
+    }
+    return skipped;
+  }
+
+  // Runs `cycles` instructions, tick() after tick() in whole blocks, with the
+  // budget checked once per block, and skips idle loops.
+  constexpr void execute(const std::uint64_t cycles) {
+    std::uint64_t executed = 0;
+    while (executed < cycles) {
+      auto length = block_lengths[pc];
+      if (length > cycles - executed) {
+        // Budgets are below loop_head, so loop heads take this branch too
+        // and cost nothing on the way into ordinary blocks.
+        if ((length & loop_head) == 0u) {
+          length = static_cast<std::uint16_t>(cycles - executed);
+        } else if (const auto skipped = fast_forward(cycles - executed);
+                   skipped != 0u) {
+          executed += skipped;
+          continue;
+        } else {
+          length = static_cast<std::uint16_t>(
+              std::min<std::uint64_t>(length - loop_head, cycles - executed));
+        }
+      }
+      for (auto left = length; left != 0u; --left) {
+        tick();
+      }
+      executed += length;
+    }
+  }
 
-  virtual void tick() {
-    ++rtcc;
-    const OpCode opcode = rom[pc];
+public:
+  constexpr BasicEmulator(const std::array<OpCode, rom_words> &rom)
+      : rom(rom), program(BasicEmulator::decode(rom)),
+        loop_lengths(measure_loops(program, !hides_read_io_port())),
+        block_lengths(mark_loops(measure_blocks(program), loop_lengths)) {}
+
+  constexpr void tick() {
+    ++registers[RTCC];
+    const Instruction &instruction = program[pc];
     increment_pc();
-    dispatch(opcode);
+    this->dispatch(instruction);
   }
 
-  void input(const std::size_t port, const std::size_t bit, const bool set) {
+  // Runs `cycles` instructions, with the same effect as calling tick() that
+  // many times.
+  constexpr void run(const std::uint64_t cycles) {
+    if constexpr (wraps_tick()) {
+      for (std::uint64_t executed = 0; executed < cycles; ++executed) {
+        this->self().tick();
+      }
+    } else {
+      for (auto left = cycles; left != 0u;) {
+        const auto budget = std::min<std::uint64_t>(left, loop_head - 1u);
+        execute(budget);
+        left -= budget;
+      }
+    }
+  }
+
+  // Runs until predicate(emulator) holds after an instruction, or until
+  // max_cycles instructions have run. Returns the number of instructions run.
+  template <typename Predicate>
+  constexpr std::uint64_t
+  run_until(Predicate predicate,
+            const std::uint64_t max_cycles =
+                std::numeric_limits<std::uint64_t>::max()) {
+    std::uint64_t executed = 0;
+    while (executed < max_cycles) {
+      this->self().tick();
+      ++executed;
+      if (predicate(this->self())) {
+        break;
+      }
+    }
+    return executed;
+  }
+
+  constexpr void input(const std::size_t port, const std::size_t bit,
+                       const bool set) {
     if (set) {
       input_high(port, bit);
     } else {
@@ -407,96 +1058,96 @@ public:
     }
   }
 
-  void input_high(const std::size_t port, const std::size_t bit) {
+  constexpr void input_high(const std::size_t port, const std::size_t bit) {
     const std::uint8_t bit_position = (1u << bit);
     inputs[port] = (inputs[port] & ~bit_position) | bit_position;
   }
 
-  void input_low(const std::size_t port, const std::size_t bit) {
+  constexpr void input_low(const std::size_t port, const std::size_t bit) {
     const std::uint8_t bit_position = (1u << bit);
     inputs[port] = (inputs[port] & ~bit_position);
   }
 
-  void NOP() override{};
+  constexpr void NOP() {}
 
-  void MOVWF(const std::uint8_t f) override { write_file(f, w); }
+  constexpr void MOVWF(const std::uint8_t f) { write_file(f, w); }
 
-  void CLRW() override {
+  constexpr void CLRW() {
     w = 0;
-    status.Z = 0b1;
+    set_status(Z, true);
   }
 
-  void CLRF(const std::uint8_t f) override {
+  constexpr void CLRF(const std::uint8_t f) {
     write_file(f, 0u);
-    status.Z = 0b1;
+    set_status(Z, true);
   }
 
-  void SUBWF(const std::uint8_t f,
-             const std::uint8_t d) override {
+  constexpr void SUBWF(const std::uint8_t f,
+             const std::uint8_t d) {
 
     const auto value = read_file(f);
-    status.C = (w <= value);
-    status.DC = ((w & 0x0fu) <= (value & 0x0fu));
+    set_status(C, w <= value);
+    set_status(DC, (w & 0x0fu) <= (value & 0x0fu));
     const auto written = write_file(f, d, value - w);
-    status.Z = (written == 0u);
+    set_status(Z, written == 0u);
   }
 
-  void DECF(const std::uint8_t f, const std::uint8_t d) override {
+  constexpr void DECF(const std::uint8_t f, const std::uint8_t d) {
     const auto value = read_file(f);
     const auto written = write_file(f, d, value - 1u);
-    status.Z = (written == 0u);
+    set_status(Z, written == 0u);
   }
 
-  void IORWF(const std::uint8_t f,
-             const std::uint8_t d) override {
+  constexpr void IORWF(const std::uint8_t f,
+             const std::uint8_t d) {
     const auto value = read_file(f);
     const auto written = write_file(f, d, value | w);
-    status.Z = (written == 0u);
+    set_status(Z, written == 0u);
   }
 
-  void ANDWF(const std::uint8_t f,
-             const std::uint8_t d) override {
+  constexpr void ANDWF(const std::uint8_t f,
+             const std::uint8_t d) {
     const auto value = read_file(f);
     const auto written = write_file(f, d, value & w);
-    status.Z = (written == 0u);
+    set_status(Z, written == 0u);
   }
 
-  void XORWF(const std::uint8_t f,
-             const std::uint8_t d) override {
+  constexpr void XORWF(const std::uint8_t f,
+             const std::uint8_t d) {
     const auto value = read_file(f);
     const auto written = write_file(f, d, value ^ w);
-    status.Z = (written == 0u);
+    set_status(Z, written == 0u);
   }
 
-  void ADDWF(const std::uint8_t f,
-             const std::uint8_t d) override {
+  constexpr void ADDWF(const std::uint8_t f,
+             const std::uint8_t d) {
     const auto value = read_file(f);
-    status.C = ((std::uint16_t{w} + std::uint16_t{value}) > 0xffu);
-    status.DC = (((w & 0x0fu) + (value & 0x0fu)) > 0x0fu);
+    set_status(C, (std::uint16_t{w} + std::uint16_t{value}) > 0xffu);
+    set_status(DC, ((w & 0x0fu) + (value & 0x0fu)) > 0x0fu);
     const auto written = write_file(f, d, value + w);
-    status.Z = (written == 0u);
+    set_status(Z, written == 0u);
   }
 
-  void MOVF(const std::uint8_t f, const std::uint8_t d) override {
+  constexpr void MOVF(const std::uint8_t f, const std::uint8_t d) {
     const auto value = read_file(f);
     const auto written = write_file(f, d, value);
-    status.Z = (written == 0u);
+    set_status(Z, written == 0u);
   }
 
-  void COMF(const std::uint8_t f, const std::uint8_t d) override {
+  constexpr void COMF(const std::uint8_t f, const std::uint8_t d) {
     const auto value = read_file(f);
     const auto written = write_file(f, d, ~value);
-    status.Z = (written == 0u);
+    set_status(Z, written == 0u);
   }
 
-  void INCF(const std::uint8_t f, const std::uint8_t d) override {
+  constexpr void INCF(const std::uint8_t f, const std::uint8_t d) {
     const auto value = read_file(f);
     const auto written = write_file(f, d, value + 1u);
-    status.Z = (written == 0u);
+    set_status(Z, written == 0u);
   }
 
-  void DECFSZ(const std::uint8_t f,
-              const std::uint8_t d) override {
+  constexpr void DECFSZ(const std::uint8_t f,
+              const std::uint8_t d) {
     const auto value = read_file(f);
     const auto written = write_file(f, d, value - 1u);
     if (written == 0u) {
@@ -504,26 +1155,26 @@ public:
     }
   }
 
-  void RRF(const std::uint8_t f, const std::uint8_t d) override {
+  constexpr void RRF(const std::uint8_t f, const std::uint8_t d) {
     const auto value = read_file(f);
-    status.C = value & 0b1;
-    write_file(f, d, (value >> 1) | (status.C << 7));
+    set_status(C, value & 0b1);
+    write_file(f, d, (value >> 1) | (status(C) ? 0x80u : 0u));
   }
 
-  void RLF(const std::uint8_t f, const std::uint8_t d) override {
+  constexpr void RLF(const std::uint8_t f, const std::uint8_t d) {
     const auto value = read_file(f);
-    status.C = value >> 7;
-    write_file(f, d, (value << 1) | status.C);
+    set_status(C, value >> 7);
+    write_file(f, d, (value << 1) | (status(C) ? 1u : 0u));
   }
 
-  void SWAPF(const std::uint8_t f,
-             const std::uint8_t d) override {
+  constexpr void SWAPF(const std::uint8_t f,
+             const std::uint8_t d) {
     const auto value = read_file(f);
     write_file(f, d, (value << 4) | (value >> 4));
   }
 
-  void INCFSZ(const std::uint8_t f,
-              const std::uint8_t d) override {
+  constexpr void INCFSZ(const std::uint8_t f,
+              const std::uint8_t d) {
     const auto value = read_file(f);
     const auto written = write_file(f, d, value + 1u);
     if (written == 0u) {
@@ -531,108 +1182,254 @@ public:
     }
   }
 
-  void BCF(const std::uint8_t f, const std::uint8_t b) override {
+  constexpr void BCF(const std::uint8_t f, const std::uint8_t b) {
     const auto value = read_file(f);
     write_file(f, value & ~(0b1 << b));
   }
 
-  void BSF(const std::uint8_t f, const std::uint8_t b) override {
+  constexpr void BSF(const std::uint8_t f, const std::uint8_t b) {
     const auto value = read_file(f);
     write_file(f, value | (0b1 << b));
   }
 
-  void BTFSC(const std::uint8_t f,
-             const std::uint8_t b) override {
+  constexpr void BTFSC(const std::uint8_t f,
+             const std::uint8_t b) {
     const auto value = read_file(f);
     if (0u == (value & (0b1 << b))) {
       increment_pc();
     }
   }
 
-  void BTFSS(const std::uint8_t f,
-             const std::uint8_t b) override {
+  constexpr void BTFSS(const std::uint8_t f,
+             const std::uint8_t b) {
     const auto value = read_file(f);
     if (0u != (value & (0b1 << b))) {
       increment_pc();
     }
   }
 
-  void RETLW(const std::uint8_t k) override {
+  constexpr void RETLW(const std::uint8_t k) {
     w = k;
     pc = stack[0];
-    stack[0] = stack[1];
-    stack[1] = 0xffffu;
+    std::shift_left(std::begin(stack), std::end(stack), 1);
+    stack.back() = 0xffffu;
   }
 
-  void CALL(const std::uint8_t k) override {
-    stack[1] = stack[0];
-    stack[0] = pc & 0x1ffu;
-    pc = k;
+  constexpr void CALL(const std::uint8_t k) {
+    std::shift_right(std::begin(stack), std::end(stack), 1);
+    stack[0] = pc & pc_mask;
+    pc = in_rom(k);
   }
 
-  void GOTO(const std::uint16_t k) override { pc = k; }
+  constexpr void GOTO(const std::uint16_t k) { pc = in_rom(k); }
 
-  void MOVLW(const std::uint8_t k) override { w = k; }
+  constexpr void MOVLW(const std::uint8_t k) { w = k; }
 
-  void IORLW(const std::uint8_t k) override {
+  constexpr void IORLW(const std::uint8_t k) {
     w = w | k;
-    status.Z = (w == 0u);
+    set_status(Z, w == 0u);
   }
 
-  void ANDLW(const std::uint8_t k) override {
+  constexpr void ANDLW(const std::uint8_t k) {
     w = w & k;
-    status.Z = (w == 0u);
+    set_status(Z, w == 0u);
   }
 
-  void XORLW(const std::uint8_t k) override {
+  constexpr void XORLW(const std::uint8_t k) {
     w = w ^ k;
-    status.Z = (w == 0u);
+    set_status(Z, w == 0u);
+  }
+
+  constexpr std::uint16_t PC() const { return pc; }
+
+  constexpr auto a() const { return registers[PORTA + 0]; }
+  constexpr auto b() const
+    requires(D.ports > 1)
+  {
+    return registers[PORTA + 1];
+  }
+  constexpr auto c() const
+    requires(D.ports > 2)
+  {
+    return registers[PORTA + 2];
+  }
+  constexpr auto d() const
+    requires(D.ports > 3)
+  {
+    return registers[PORTA + 3];
+  }
+
+  constexpr State snapshot() const {
+    return State{
+        .pc = pc,
+        .stack = stack,
+        .rtcc = registers[RTCC],
+        .w = w,
+        .fsr = fsr(),
+        .status = registers[STATUS],
+        .general_purpose_registers = general_purpose_registers(),
+        .inputs = inputs,
+        .output_latches = output_latches(),
+    };
+  }
+
+  constexpr void restore(const State &state) {
+    assert(state.pc < std::size(program) && state.fsr < 32 &&
+           state.status < 8);
+    pc = state.pc;
+    stack = state.stack;
+    registers[RTCC] = state.rtcc;
+    w = state.w;
+    registers[FSR] = 0b1110'0000u | state.fsr;
+    registers[STATUS] = state.status;
+    std::ranges::copy(state.output_latches, std::begin(registers) + PORTA);
+    std::ranges::copy(state.general_purpose_registers,
+                      std::begin(registers) + GPR);
+    inputs = state.inputs;
+  }
+
+  // FNV-1a hash of the same machine state operator== compares
+  constexpr std::uint64_t hash() const {
+    std::uint64_t h = 0xcbf2'9ce4'8422'2325u;
+    const auto mix = [&h](const std::uint64_t x) {
+      h = (h ^ x) * 0x100'0000'01b3u;
+    };
+    mix(pc);
+    mix(registers[RTCC]);
+    mix(w);
+    mix(fsr());
+    mix(registers[STATUS]);
+    for (auto f = std::size_t{GPR}; f < std::size(registers); ++f) {
+      mix(registers[f]);
+    }
+    for (const auto x : inputs) {
+      mix(x);
+    }
+    for (auto f = std::size_t{PORTA}; f < GPR; ++f) {
+      mix(registers[f]);
+    }
+    for (const auto x : stack) {
+      mix(x);
+    }
+    return h;
   }
 
-  std::uint16_t PC() const { return pc; }
+  // Compares the machine state of two emulators, whatever their Derived.
+  template <typename Other>
+  constexpr bool operator==(const BasicEmulator<Other, D> &other) const {
+    // INDF and PCL are never stored, so compare equal
+    return pc == other.pc && w == other.w && registers == other.registers &&
+           inputs == other.inputs && stack == other.stack;
+  }
 
-  auto a() const { return output_latches[0]; }
-  auto b() const { return output_latches[1]; }
-  auto c() const { return output_latches[2]; }
-  auto d() const { return output_latches[3]; }
+  template <typename, Device> friend class BasicEmulator;
 };
 
-class LoudEmulator final : public Emulator {
-private:
-  std::stringstream ss{};
-  OpCodeStream opcode_stream;
-  std::ostream &os;
+class Emulator final : public BasicEmulator<Emulator> {
+public:
+  using BasicEmulator::BasicEmulator;
+};
 
+// Emulator for another part of the family, such as
+// DeviceEmulator<devices::pic1655>
+template <Device D>
+class DeviceEmulator final : public BasicEmulator<DeviceEmulator<D>, D> {
 public:
+  using BasicEmulator<DeviceEmulator, D>::BasicEmulator;
+};
+
+// The machine state after one instruction, together with the instruction
+struct TraceRecord {
   std::uint64_t cnt{};
+  std::uint16_t starting_pc{};
+  std::uint16_t pc{};
+  std::array<std::uint16_t, 2> stack{};
+  OpCode opcode{};
+  std::uint8_t rtcc{};
+  std::uint8_t w{};
+  // C, DC and Z in bits 0 to 2
+  std::uint8_t status{};
+  std::uint8_t fsr{};
+  std::array<std::uint8_t, 4> output_latches{};
+  std::array<std::uint8_t, 23> general_purpose_registers{};
+  std::array<std::uint8_t, 7> reserved{};
+};
 
-  LoudEmulator(const std::array<OpCode, 512> &rom, std::ostream &os)
-      : Emulator{rom}, opcode_stream{ss}, os{os} {
+// Emulator that hands a TraceRecord to Derived::record() after every tick.
+template <typename Derived>
+class BasicTracingEmulator : public BasicEmulator<Derived> {
+public:
+  std::uint64_t cnt{};
+
+  using BasicEmulator<Derived>::BasicEmulator;
+
+  void tick() {
+    const auto starting_pc = this->pc;
+    const auto opcode = this->rom[starting_pc];
+    BasicEmulator<Derived>::tick();
+    this->self().record(TraceRecord{
+        .cnt = cnt++,
+        .starting_pc = starting_pc,
+        .pc = this->pc,
+        .stack = this->stack,
+        .opcode = opcode,
+        .rtcc = this->registers[RTCC],
+        .w = this->w,
+        .status = this->registers[STATUS],
+        .fsr = this->fsr(),
+        .output_latches = this->output_latches(),
+        .general_purpose_registers = this->general_purpose_registers(),
+    });
+  }
+};
+
+// Renders trace records in the CSV layout LoudEmulator prints
+class CsvTraceFormatter {
+private:
+  std::stringstream ss{};
+  OpCodeStream opcode_stream{ss};
+
+public:
+  static void header(std::ostream &os) {
     os << "cnt,starting_pc,rtcc,pc,C,DC,Z,fsr,w,RA,RB,RC,RD,f9,f10,f11,"
           "r12,f13,f14,f15,f16,f17,f18,f19,f20,f21,f22,f23,f24,f25,f26,f27,f28,"
           "r29,f30,f31,stack0,stack1,opcode,decoded"
        << std::endl;
   }
 
-  void tick() override {
-    const auto starting_pc = pc;
-    const auto opcode = rom[starting_pc];
-    opcode_stream.dispatch(opcode);
-    Emulator::tick();
-    os << std::format("{:d},{:d},{:d},{:d},{:d},{:d},{:d},{:d},{:d},", cnt++,
-                      starting_pc, rtcc, pc, +status.C, +status.DC, +status.Z,
-                      fsr, w);
-    for (const auto x : output_latches) {
+  void row(std::ostream &os, const TraceRecord &record) {
+    opcode_stream.dispatch(record.opcode);
+    os << std::format("{:d},{:d},{:d},{:d},{:d},{:d},{:d},{:d},{:d},",
+                      record.cnt, record.starting_pc, record.rtcc, record.pc,
+                      record.status & 0b1u, (record.status >> 1) & 0b1u,
+                      (record.status >> 2) & 0b1u, record.fsr, record.w);
+    for (const auto x : record.output_latches) {
       os << std::format("0b{:08b},", x);
     }
-    for (const auto x : general_purpose_registers) {
+    for (const auto x : record.general_purpose_registers) {
       os << std::format("{:d},", x);
     }
-    os << std::format("{:d},{:d},0b{:012b},{:s}", stack[0], stack[1], opcode,
-                      ss.str())
-       << std::flush;
+    os << std::format("{:d},{:d},0b{:012b},{:s}", record.stack[0],
+                      record.stack[1], record.opcode, ss.str());
     ss.str("");
   }
 };
 
+class LoudEmulator final : public BasicTracingEmulator<LoudEmulator> {
+private:
+  CsvTraceFormatter formatter{};
+  std::ostream &os;
+
+public:
+  LoudEmulator(const std::array<OpCode, 512> &rom, std::ostream &os)
+      : BasicTracingEmulator{rom}, os{os} {
+    CsvTraceFormatter::header(os);
+  }
+
+  void record(const TraceRecord &record) {
+    formatter.row(os, record);
+    os << std::flush;
+  }
+};
+
 } // namespace pic1650
\ No newline at end of file
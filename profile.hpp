@@ -0,0 +1,212 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <map>
+#include <ostream>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+#include "pic1650.hpp"
+
+namespace pic1650 {
+
+// Cycles spent in completed calls to one function, counted from its CALL to
+// its RETLW. Exclusive cycles leave out those spent in the functions it
+// called.
+struct FunctionProfile {
+  std::uint64_t calls{};
+  std::uint64_t inclusive{};
+  std::uint64_t exclusive{};
+};
+
+struct Profile {
+  std::uint64_t cycles{};
+  // Times each address was executed, and for skip instructions how many of
+  // those times it skipped
+  std::array<std::uint64_t, 512> executed{};
+  std::array<std::uint64_t, 512> skipped{};
+  // Accesses to each file, with accesses through the indirect file 0
+  // counted against the file fsr pointed to
+  std::array<std::uint64_t, 32> reads{};
+  std::array<std::uint64_t, 32> writes{};
+  // CALLs from the function at first to the function at second, where the
+  // code run from reset counts as a function at the reset vector
+  std::map<std::pair<std::uint16_t, std::uint16_t>, std::uint64_t> calls;
+  std::map<std::uint16_t, FunctionProfile> functions;
+};
+
+constexpr std::uint16_t reset_vector = 0x1ffu;
+
+// Emulator that profiles every tick() into a Profile. Wrapping tick() makes
+// run() and run_until() step through it, so only emulators built with this
+// policy pay for profiling.
+template <typename Derived>
+class BasicProfilingEmulator : public BasicEmulator<Derived> {
+private:
+  struct Frame {
+    std::uint16_t function{};
+    // Cycle count when the function was called, and cycles spent in the
+    // calls it has made so far
+    std::uint64_t entered{};
+    std::uint64_t children{};
+  };
+
+  Profile data{};
+  std::vector<Frame> frames{{.function = reset_vector}};
+
+public:
+  using BasicEmulator<Derived>::BasicEmulator;
+
+  void tick() {
+    const auto starting_pc = this->pc;
+    const auto &instruction = this->program[starting_pc];
+    const auto fsr = this->fsr();
+    BasicEmulator<Derived>::tick();
+    ++data.cycles;
+    ++data.executed[starting_pc];
+
+    if (has_file_operand(instruction.mnemonic)) {
+      const auto f = instruction.f == 0u ? fsr : instruction.f;
+      data.reads[f] += reads_file(instruction.mnemonic) ? 1u : 0u;
+      data.writes[f] += writes_file(instruction) ? 1u : 0u;
+    }
+
+    switch (instruction.mnemonic) {
+    case Mnemonic::DECFSZ:
+    case Mnemonic::INCFSZ:
+    case Mnemonic::BTFSC:
+    case Mnemonic::BTFSS:
+      if (this->pc == ((starting_pc + 2u) & 0x1ffu)) {
+        ++data.skipped[starting_pc];
+      }
+      break;
+    case Mnemonic::CALL:
+      ++data.calls[{frames.back().function, instruction.k}];
+      frames.push_back({.function = instruction.k,
+                        .entered = data.cycles - 1u,
+                        .children = 0});
+      break;
+    case Mnemonic::RETLW:
+      // A return with no matching call is left to the caller's cycles
+      if (std::size(frames) > 1) {
+        const auto frame = frames.back();
+        frames.pop_back();
+        const auto inclusive = data.cycles - frame.entered;
+        auto &function = data.functions[frame.function];
+        ++function.calls;
+        function.inclusive += inclusive;
+        function.exclusive += inclusive - frame.children;
+        frames.back().children += inclusive;
+      }
+      break;
+    default:
+      break;
+    }
+  }
+
+  // The profile so far, with the code run from reset as a function called
+  // once at the reset vector. Calls still in progress count against their
+  // callers.
+  Profile profile() const {
+    auto profile = data;
+    profile.functions[reset_vector] = {
+        .calls = 1,
+        .inclusive = data.cycles,
+        .exclusive = data.cycles - frames.front().children};
+    return profile;
+  }
+};
+
+class ProfilingEmulator final
+    : public BasicProfilingEmulator<ProfilingEmulator> {
+public:
+  using BasicProfilingEmulator::BasicProfilingEmulator;
+};
+
+// Writes the readcode listing of `rom` annotated with how often each address
+// ran and skipped, followed by the call graph, the files and the hottest
+// loops. A loop is a backward GOTO, with the addresses it jumps over as its
+// body.
+inline void write_profile(std::ostream &os, const std::array<OpCode, 512> &rom,
+                          const Profile &profile) {
+  const auto percent = [&profile](const std::uint64_t cycles) {
+    return profile.cycles == 0u ? 0.0
+                                : 100.0 * static_cast<double>(cycles) /
+                                      static_cast<double>(profile.cycles);
+  };
+
+  std::stringstream ss;
+  OpCodeStream disassembler{ss};
+  os << std::format("{:d} cycles\n\n{:>12s} {:>7s} {:>12s}   listing\n",
+                    profile.cycles, "executed", "%", "skipped");
+  for (auto pc = 0uz; pc < std::size(rom); ++pc) {
+    const auto instruction = BasicOpCodes<OpCodeStream>::decode(rom[pc]);
+    const bool skips = instruction.mnemonic == Mnemonic::DECFSZ ||
+                       instruction.mnemonic == Mnemonic::INCFSZ ||
+                       instruction.mnemonic == Mnemonic::BTFSC ||
+                       instruction.mnemonic == Mnemonic::BTFSS;
+    ss.str("");
+    disassembler.dispatch(instruction);
+    os << std::format("{:12d} {:7.3f} {:>12s}   {:<3d} x{:03X}:   {:s}",
+                      profile.executed[pc], percent(profile.executed[pc]),
+                      skips ? std::format("{:d}", profile.skipped[pc]) : "",
+                      pc, pc, ss.str());
+  }
+
+  os << std::format("\nfunctions\n{:>8s} {:>10s} {:>14s} {:>7s} {:>14s} "
+                    "{:>7s}\n",
+                    "entry", "calls", "inclusive", "%", "exclusive", "%");
+  for (const auto &[entry, function] : profile.functions) {
+    os << std::format("    x{:03X} {:10d} {:14d} {:7.3f} {:14d} {:7.3f}\n",
+                      entry, function.calls, function.inclusive,
+                      percent(function.inclusive), function.exclusive,
+                      percent(function.exclusive));
+  }
+
+  os << "\ncall graph\n";
+  for (const auto &[edge, calls] : profile.calls) {
+    os << std::format("    x{:03X} -> x{:03X} {:10d}\n", edge.first,
+                      edge.second, calls);
+  }
+
+  os << std::format("\nfiles\n{:>8s} {:>14s} {:>14s}\n", "file", "reads",
+                    "writes");
+  for (auto f = 1uz; f < std::size(profile.reads); ++f) {
+    os << std::format("     F{:<2d} {:14d} {:14d}\n", f, profile.reads[f],
+                      profile.writes[f]);
+  }
+
+  struct Loop {
+    std::uint16_t from{};
+    std::uint16_t to{};
+    std::uint64_t cycles{};
+  };
+  std::vector<Loop> loops;
+  for (std::uint16_t pc = 0; pc < std::size(rom); ++pc) {
+    const auto instruction = BasicOpCodes<OpCodeStream>::decode(rom[pc]);
+    if (instruction.mnemonic == Mnemonic::GOTO && instruction.k <= pc &&
+        profile.executed[pc] != 0u) {
+      Loop loop{.from = pc, .to = instruction.k};
+      for (auto address = loop.to; address <= loop.from; ++address) {
+        loop.cycles += profile.executed[address];
+      }
+      loops.push_back(loop);
+    }
+  }
+  std::ranges::sort(loops, std::ranges::greater{}, &Loop::cycles);
+  loops.resize(std::min(std::size(loops), 10uz));
+  os << std::format("\nhot loops\n{:>14s} {:>12s} {:>14s} {:>7s}\n", "body",
+                    "passes", "cycles", "%");
+  for (const auto &loop : loops) {
+    os << std::format("    x{:03X}-x{:03X} {:12d} {:14d} {:7.3f}\n", loop.to,
+                      loop.from, profile.executed[loop.from], loop.cycles,
+                      percent(loop.cycles));
+  }
+}
+
+} // namespace pic1650
@@ -1,14 +1,43 @@
+// Disassembles a ROM read from stdin:
+//
+//   readcode <tandybaseball.bin >code.lst
+//   readcode --labels <tandybaseball.bin >labelled.lst
+//   readcode --blocks <tandybaseball.bin >blocks.csv
+//
+// --labels adds labels, cross references and branch targets found by
+// following the control flow from reset, and --blocks prints the basic blocks
+// found that way instead.
+
 #include <array>
 #include <cstdint>
 #include <format>
 #include <iostream>
+#include <string_view>
 
 #include "pic1650.hpp"
+#include "analysis.hpp"
 
-int main() {
-  std::array<std::uint16_t, 512> opcodes;
+int main(int argc, char *argv[]) {
+  std::array<std::uint16_t, pic1650::Emulator::device.rom_words> opcodes;
   std::cin.read(reinterpret_cast<char *>(std::data(opcodes)),
                 std::size(opcodes) * 2);
+
+  if (argc > 1) {
+    const std::string_view arg{argv[1]};
+    const auto flow =
+        pic1650::analyse(pic1650::OpCodeStream::decode(opcodes));
+    if (arg == "--labels") {
+      pic1650::write_listing(std::cout, opcodes, flow);
+      return 0;
+    }
+    if (arg == "--blocks") {
+      pic1650::write_block_index(std::cout, flow);
+      return 0;
+    }
+    std::cerr << "usage: readcode [--labels|--blocks] <rom" << std::endl;
+    return 1;
+  }
+
   pic1650::OpCodeStream os{std::cout};
   for (auto pc = 0uz; pc < std::size(opcodes); ++pc) {
     std::cout << std::format("{:<3d} x{:03X}:   ", pc, pc);
@@ -0,0 +1,735 @@
+#pragma once
+
+#if defined(__x86_64__) && defined(__unix__)
+
+// Defined where JitEmulator is available
+#define PIC1650_JIT 1
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <optional>
+#include <stdexcept>
+#include <vector>
+
+#include <sys/mman.h>
+
+#include "pic1650.hpp"
+
+namespace pic1650 {
+
+// Just enough of an x86-64 assembler to translate PIC1650 blocks. Memory
+// operands are always [rdi + disp32], rdi pointing at the emulator, and rsi
+// holds the remaining cycle budget.
+class X64Emitter {
+public:
+  enum class Reg : std::uint8_t { eax = 0, ecx = 1, edx = 2 };
+  enum class Alu : std::uint8_t {
+    add = 0,
+    or_ = 1,
+    and_ = 4,
+    sub = 5,
+    xor_ = 6,
+    cmp = 7
+  };
+  enum class Condition : std::uint8_t { b = 2, e = 4, ne = 5, be = 6, a = 7 };
+  using Label = std::size_t;
+
+private:
+  static constexpr std::uint8_t rsi = 6;
+  static constexpr std::uint8_t rdi = 7;
+
+  std::vector<std::uint8_t> &code;
+  std::vector<std::size_t> labels;
+  // Positions of rel32 operands, and the labels they refer to
+  std::vector<std::pair<std::size_t, Label>> fixups;
+
+  static constexpr std::uint8_t modrm(const std::uint8_t mod,
+                                      const std::uint8_t reg,
+                                      const std::uint8_t rm) {
+    return static_cast<std::uint8_t>((mod << 6) | ((reg & 0b111u) << 3) |
+                                     (rm & 0b111u));
+  }
+
+  static constexpr std::uint8_t id(const Reg reg) {
+    return static_cast<std::uint8_t>(reg);
+  }
+
+  static constexpr std::uint8_t id(const Alu alu) {
+    return static_cast<std::uint8_t>(alu);
+  }
+
+  template <typename... Bytes> void emit(const Bytes... bytes) {
+    (code.push_back(static_cast<std::uint8_t>(bytes)), ...);
+  }
+
+  void imm32(const std::uint32_t x) {
+    emit(x & 0xffu, (x >> 8) & 0xffu, (x >> 16) & 0xffu, (x >> 24) & 0xffu);
+  }
+
+  // ModRM byte and displacement for [rdi + disp]
+  void memory(const std::uint8_t reg, const std::int32_t disp) {
+    emit(modrm(0b10, reg, rdi));
+    imm32(static_cast<std::uint32_t>(disp));
+  }
+
+  void rel32(const Label label) {
+    fixups.emplace_back(std::size(code), label);
+    imm32(0);
+  }
+
+public:
+  X64Emitter(std::vector<std::uint8_t> &code, const std::size_t label_count)
+      : code{code}, labels(label_count) {}
+
+  void bind(const Label label) { labels[label] = std::size(code); }
+
+  std::size_t position(const Label label) const { return labels[label]; }
+
+  // Resolves every jump once all labels are bound
+  void link() {
+    for (const auto &[at, label] : fixups) {
+      const auto target = static_cast<std::int64_t>(labels[label]);
+      const auto next = static_cast<std::int64_t>(at + 4);
+      const auto displacement = static_cast<std::uint32_t>(target - next);
+      for (std::size_t i = 0; i < 4; ++i) {
+        code[at + i] = (displacement >> (8 * i)) & 0xffu;
+      }
+    }
+  }
+
+  // movzx r32, byte [rdi + disp]
+  void load8(const Reg dst, const std::int32_t disp) {
+    emit(0x0f, 0xb6);
+    memory(id(dst), disp);
+  }
+
+  // movzx r32, word [rdi + disp]
+  void load16(const Reg dst, const std::int32_t disp) {
+    emit(0x0f, 0xb7);
+    memory(id(dst), disp);
+  }
+
+  // mov byte [rdi + disp], r8 (al, cl or dl)
+  void store8(const std::int32_t disp, const Reg src) {
+    emit(0x88);
+    memory(id(src), disp);
+  }
+
+  // mov word [rdi + disp], r16
+  void store16(const std::int32_t disp, const Reg src) {
+    emit(0x66, 0x89);
+    memory(id(src), disp);
+  }
+
+  // mov byte [rdi + disp], imm8
+  void store8(const std::int32_t disp, const std::uint8_t x) {
+    emit(0xc6);
+    memory(0, disp);
+    emit(x);
+  }
+
+  // mov word [rdi + disp], imm16
+  void store16(const std::int32_t disp, const std::uint16_t x) {
+    emit(0x66, 0xc7);
+    memory(0, disp);
+    emit(x & 0xffu, x >> 8);
+  }
+
+  // <alu> byte [rdi + disp], imm8
+  void alu8(const Alu alu, const std::int32_t disp, const std::uint8_t x) {
+    emit(0x80);
+    memory(id(alu), disp);
+    emit(x);
+  }
+
+  // or byte [rdi + disp], r8
+  void or8(const std::int32_t disp, const Reg src) {
+    emit(0x08);
+    memory(id(src), disp);
+  }
+
+  // inc byte [rdi + disp]
+  void inc8(const std::int32_t disp) {
+    emit(0xfe);
+    memory(0, disp);
+  }
+
+  // mov r32, imm32
+  void mov(const Reg dst, const std::uint32_t x) {
+    emit(0xb8 + id(dst));
+    imm32(x);
+  }
+
+  // mov r32, r32
+  void mov(const Reg dst, const Reg src) {
+    emit(0x89, modrm(0b11, id(src), id(dst)));
+  }
+
+  // <alu> r32, r32
+  void alu(const Alu alu, const Reg dst, const Reg src) {
+    emit(8u * id(alu) + 1u, modrm(0b11, id(src), id(dst)));
+  }
+
+  // <alu> r32, imm32
+  void alu(const Alu alu, const Reg dst, const std::uint32_t x) {
+    emit(0x81, modrm(0b11, id(alu), id(dst)));
+    imm32(x);
+  }
+
+  // test r32, r32
+  void test(const Reg dst, const Reg src) {
+    emit(0x85, modrm(0b11, id(src), id(dst)));
+  }
+
+  // setcc r8 followed by movzx r32, r8, leaving 0 or 1 in dst
+  void set(const Condition condition, const Reg dst) {
+    emit(0x0f, 0x90 + static_cast<std::uint8_t>(condition),
+         modrm(0b11, 0, id(dst)));
+    emit(0x0f, 0xb6, modrm(0b11, id(dst), id(dst)));
+  }
+
+  // shl r32, imm8
+  void shl(const Reg dst, const std::uint8_t n) {
+    emit(0xc1, modrm(0b11, 4, id(dst)), n);
+  }
+
+  // shr r32, imm8
+  void shr(const Reg dst, const std::uint8_t n) {
+    emit(0xc1, modrm(0b11, 5, id(dst)), n);
+  }
+
+  // cmp rsi, imm32
+  void compare_budget(const std::uint32_t x) {
+    emit(0x48, 0x81, modrm(0b11, id(Alu::cmp), rsi));
+    imm32(x);
+  }
+
+  // sub rsi, imm32
+  void charge_budget(const std::uint32_t x) {
+    emit(0x48, 0x81, modrm(0b11, id(Alu::sub), rsi));
+    imm32(x);
+  }
+
+  // mov qword [rdi + disp], rsi
+  void store_budget(const std::int32_t disp) {
+    emit(0x48, 0x89);
+    memory(rsi, disp);
+  }
+
+  // jmp rel32
+  void jmp(const Label label) {
+    emit(0xe9);
+    rel32(label);
+  }
+
+  // jcc rel32
+  void jump_if(const Condition condition, const Label label) {
+    emit(0x0f, 0x80 + static_cast<std::uint8_t>(condition));
+    rel32(label);
+  }
+
+  void ret() { emit(0xc3); }
+};
+
+// Emulator backend that translates ROM blocks to x86-64 machine code.
+//
+// Every address gets a translated entry point, generated ahead of time,
+// which charges the block's length against the budget in rsi, runs the block
+// directly on the emulator's own registers and jumps straight to the entry
+// point of its successor. Control returns to run() when the budget is too
+// small for the next block, after a RETLW, or at an instruction the recompiler
+// leaves to the interpreter: reads of the I/O ports (so that read_io_port()
+// stays the one place inputs are sampled), anything using the indirect file 0,
+// writes to the program counter and illegal instructions.
+//
+// In Lockstep mode every block is a single instruction that always returns to
+// run(), and a reference Emulator is stepped alongside; any divergence throws.
+class JitEmulator final : public BasicEmulator<JitEmulator> {
+public:
+  enum class Mode { Native, Lockstep };
+
+private:
+  using Block = std::uint32_t (*)(JitEmulator *, std::uint64_t);
+
+  static constexpr std::size_t max_block_length = 64;
+
+  const Mode mode;
+  std::array<Block, 512> entries{};
+  std::array<std::uint16_t, 512> lengths{};
+  void *buffer{};
+  std::size_t buffer_size{};
+  // Budget left over by the last block, written back by the translated code
+  std::uint64_t budget{};
+  std::optional<Emulator> reference;
+  std::uint64_t cycle{};
+
+  // Displacements from `this` of every file the translated code accesses
+  std::array<std::int32_t, 32> files{};
+  std::int32_t w_offset{};
+  std::int32_t stack0_offset{};
+  std::int32_t stack1_offset{};
+  std::int32_t budget_offset{};
+
+  std::int32_t offset_of(const void *member) const {
+    return static_cast<std::int32_t>(static_cast<const std::byte *>(member) -
+                                     reinterpret_cast<const std::byte *>(this));
+  }
+
+  static constexpr X64Emitter::Label entry(const std::uint16_t address) {
+    return address;
+  }
+
+  static constexpr X64Emitter::Label exit(const std::uint16_t address) {
+    return 512u + address;
+  }
+
+  static constexpr bool translatable(const Instruction &instruction) {
+    if (instruction.mnemonic == Mnemonic::ILLEGAL_INSTRUCTION) {
+      return false;
+    }
+    if (!has_file_operand(instruction.mnemonic)) {
+      return true;
+    }
+    const auto f = instruction.f;
+    if (f == 0u) {
+      return false;
+    }
+    if (f == 2u && writes_file(instruction)) {
+      return false;
+    }
+    if (f >= 5u && f <= 8u && reads_file(instruction.mnemonic)) {
+      return false;
+    }
+    return true;
+  }
+
+  // Leaves the value of file f in eax
+  void load_file(X64Emitter &x64, const std::uint8_t f,
+                 const std::uint16_t next) const {
+    using enum X64Emitter::Reg;
+    if (f == 2u) {
+      x64.mov(eax, next & 0xffu);
+    } else {
+      x64.load8(eax, files[f]);
+    }
+  }
+
+  // Writes eax to file f, leaving the value written (as write_file() returns
+  // it) in eax
+  void store_file(X64Emitter &x64, const std::uint8_t f) const {
+    using enum X64Emitter::Reg;
+    using enum X64Emitter::Alu;
+    x64.alu(and_, eax, f == 3u ? 0b111u : f == 4u ? 0b1'1111u : 0xffu);
+    x64.store8(files[f], eax);
+    if (f == 4u) {
+      // fsr is held with its unused bits set, as it reads
+      x64.alu8(or_, files[f], 0b1110'0000u);
+    }
+  }
+
+  void store_result(X64Emitter &x64, const std::uint8_t f,
+                    const std::uint8_t d) const {
+    using enum X64Emitter::Reg;
+    if (d == 0u) {
+      x64.alu(X64Emitter::Alu::and_, eax, 0xffu);
+      x64.store8(w_offset, eax);
+    } else {
+      store_file(x64, f);
+    }
+  }
+
+  // Copies the 0 or 1 in edx into a status bit
+  void set_status_bit(X64Emitter &x64, const std::uint8_t bit) const {
+    using enum X64Emitter::Reg;
+    if (bit != 0u) {
+      x64.shl(edx, bit);
+    }
+    x64.alu8(X64Emitter::Alu::and_, files[3],
+             static_cast<std::uint8_t>(~(1u << bit)));
+    x64.or8(files[3], edx);
+  }
+
+  // status.Z = (eax == 0)
+  void set_z(X64Emitter &x64) const {
+    using enum X64Emitter::Reg;
+    x64.test(eax, eax);
+    x64.set(X64Emitter::Condition::e, edx);
+    set_status_bit(x64, 2);
+  }
+
+  // Continues at target: straight into its translation when there is one,
+  // otherwise back to run().
+  void jump(X64Emitter &x64, const std::uint16_t target) const {
+    if (mode == Mode::Native && lengths[target] != 0) {
+      x64.jmp(entry(target));
+    } else {
+      x64.jmp(exit(target));
+    }
+  }
+
+  // Continues at next, or at the address after it when the condition holds
+  void skip_if(X64Emitter &x64, const X64Emitter::Condition condition,
+               const std::uint16_t next) const {
+    const std::uint16_t skipped = (next + 1u) & 0x1ffu;
+    if (mode == Mode::Native && lengths[skipped] != 0) {
+      x64.jump_if(condition, entry(skipped));
+    } else {
+      x64.jump_if(condition, exit(skipped));
+    }
+    jump(x64, next);
+  }
+
+  // Emits one instruction; returns true when it has already transferred
+  // control elsewhere.
+  bool translate(X64Emitter &x64, const Instruction &instruction,
+                 const std::uint16_t next) const {
+    using enum X64Emitter::Reg;
+    using enum X64Emitter::Alu;
+    using enum X64Emitter::Condition;
+    const auto [mnemonic, f, d, k] = instruction;
+    x64.inc8(files[1]);
+    switch (mnemonic) {
+    case Mnemonic::NOP:
+      return false;
+    case Mnemonic::MOVWF:
+      x64.load8(eax, w_offset);
+      store_file(x64, f);
+      return false;
+    case Mnemonic::CLRW:
+      x64.store8(w_offset, std::uint8_t{0});
+      x64.alu8(or_, files[3], 0b100u);
+      return false;
+    case Mnemonic::CLRF:
+      x64.mov(eax, 0u);
+      store_file(x64, f);
+      x64.alu8(or_, files[3], 0b100u);
+      return false;
+    case Mnemonic::SUBWF:
+      load_file(x64, f, next);
+      x64.load8(ecx, w_offset);
+      x64.alu(cmp, ecx, eax);
+      x64.set(be, edx);
+      set_status_bit(x64, 0);
+      x64.mov(ecx, eax);
+      x64.alu(and_, ecx, 0x0fu);
+      x64.load8(edx, w_offset);
+      x64.alu(and_, edx, 0x0fu);
+      x64.alu(cmp, edx, ecx);
+      x64.set(be, edx);
+      set_status_bit(x64, 1);
+      x64.load8(ecx, w_offset);
+      x64.alu(sub, eax, ecx);
+      store_result(x64, f, d);
+      set_z(x64);
+      return false;
+    case Mnemonic::DECF:
+      load_file(x64, f, next);
+      x64.alu(sub, eax, 1u);
+      store_result(x64, f, d);
+      set_z(x64);
+      return false;
+    case Mnemonic::IORWF:
+    case Mnemonic::ANDWF:
+    case Mnemonic::XORWF:
+      load_file(x64, f, next);
+      x64.load8(ecx, w_offset);
+      x64.alu(mnemonic == Mnemonic::IORWF   ? or_
+              : mnemonic == Mnemonic::ANDWF ? and_
+                                            : xor_,
+              eax, ecx);
+      store_result(x64, f, d);
+      set_z(x64);
+      return false;
+    case Mnemonic::ADDWF:
+      load_file(x64, f, next);
+      x64.load8(ecx, w_offset);
+      x64.mov(edx, eax);
+      x64.alu(add, edx, ecx);
+      x64.alu(cmp, edx, 0xffu);
+      x64.set(a, edx);
+      set_status_bit(x64, 0);
+      x64.mov(ecx, eax);
+      x64.alu(and_, ecx, 0x0fu);
+      x64.load8(edx, w_offset);
+      x64.alu(and_, edx, 0x0fu);
+      x64.alu(add, edx, ecx);
+      x64.alu(cmp, edx, 0x0fu);
+      x64.set(a, edx);
+      set_status_bit(x64, 1);
+      x64.load8(ecx, w_offset);
+      x64.alu(add, eax, ecx);
+      store_result(x64, f, d);
+      set_z(x64);
+      return false;
+    case Mnemonic::MOVF:
+      load_file(x64, f, next);
+      store_result(x64, f, d);
+      set_z(x64);
+      return false;
+    case Mnemonic::COMF:
+      load_file(x64, f, next);
+      x64.alu(xor_, eax, 0xffu);
+      store_result(x64, f, d);
+      set_z(x64);
+      return false;
+    case Mnemonic::INCF:
+      load_file(x64, f, next);
+      x64.alu(add, eax, 1u);
+      store_result(x64, f, d);
+      set_z(x64);
+      return false;
+    case Mnemonic::DECFSZ:
+    case Mnemonic::INCFSZ:
+      load_file(x64, f, next);
+      x64.alu(mnemonic == Mnemonic::DECFSZ ? sub : add, eax, 1u);
+      store_result(x64, f, d);
+      x64.test(eax, eax);
+      skip_if(x64, e, next);
+      return true;
+    case Mnemonic::RRF:
+      load_file(x64, f, next);
+      x64.mov(edx, eax);
+      x64.alu(and_, edx, 1u);
+      set_status_bit(x64, 0);
+      x64.shl(edx, 7);
+      x64.shr(eax, 1);
+      x64.alu(or_, eax, edx);
+      store_result(x64, f, d);
+      return false;
+    case Mnemonic::RLF:
+      load_file(x64, f, next);
+      x64.mov(edx, eax);
+      x64.shr(edx, 7);
+      set_status_bit(x64, 0);
+      x64.shl(eax, 1);
+      x64.alu(or_, eax, edx);
+      store_result(x64, f, d);
+      return false;
+    case Mnemonic::SWAPF:
+      load_file(x64, f, next);
+      x64.mov(edx, eax);
+      x64.shl(eax, 4);
+      x64.shr(edx, 4);
+      x64.alu(or_, eax, edx);
+      store_result(x64, f, d);
+      return false;
+    case Mnemonic::BCF:
+      load_file(x64, f, next);
+      x64.alu(and_, eax, ~(1u << d) & 0xffu);
+      store_file(x64, f);
+      return false;
+    case Mnemonic::BSF:
+      load_file(x64, f, next);
+      x64.alu(or_, eax, 1u << d);
+      store_file(x64, f);
+      return false;
+    case Mnemonic::BTFSC:
+    case Mnemonic::BTFSS:
+      load_file(x64, f, next);
+      x64.alu(and_, eax, 1u << d);
+      skip_if(x64, mnemonic == Mnemonic::BTFSC ? e : ne, next);
+      return true;
+    case Mnemonic::RETLW:
+      x64.store8(w_offset, static_cast<std::uint8_t>(k));
+      x64.load16(eax, stack0_offset);
+      x64.load16(ecx, stack1_offset);
+      x64.store16(stack0_offset, ecx);
+      x64.store16(stack1_offset, std::uint16_t{0xffffu});
+      x64.store_budget(budget_offset);
+      x64.ret();
+      return true;
+    case Mnemonic::CALL:
+      x64.load16(ecx, stack0_offset);
+      x64.store16(stack1_offset, ecx);
+      x64.store16(stack0_offset, next);
+      jump(x64, k & 0xffu);
+      return true;
+    case Mnemonic::GOTO:
+      jump(x64, k);
+      return true;
+    case Mnemonic::MOVLW:
+      x64.store8(w_offset, static_cast<std::uint8_t>(k));
+      return false;
+    case Mnemonic::IORLW:
+    case Mnemonic::ANDLW:
+    case Mnemonic::XORLW:
+      x64.load8(eax, w_offset);
+      x64.alu(mnemonic == Mnemonic::IORLW   ? or_
+              : mnemonic == Mnemonic::ANDLW ? and_
+                                            : xor_,
+              eax, k);
+      x64.store8(w_offset, eax);
+      set_z(x64);
+      return false;
+    case Mnemonic::ILLEGAL_INSTRUCTION:
+      break;
+    }
+    throw std::logic_error(
+        std::format("b{:012b} cannot be translated", instruction.k));
+  }
+
+  // Number of instructions translated for the block starting at address;
+  // zero when its first instruction is left to the interpreter.
+  std::uint16_t measure(const std::uint16_t address) const {
+    const std::size_t limit = mode == Mode::Lockstep ? 1 : max_block_length;
+    std::uint16_t length = 0;
+    for (auto current = address; translatable(program[current]);) {
+      ++length;
+      const std::uint16_t next = (current + 1u) & 0x1ffu;
+      if (ends_block(program[current]) || length == limit || next == 0u) {
+        break;
+      }
+      current = next;
+    }
+    return length;
+  }
+
+  void translate_block(X64Emitter &x64, const std::uint16_t address) const {
+    using enum X64Emitter::Condition;
+    const auto length = lengths[address];
+    x64.compare_budget(length);
+    x64.jump_if(b, exit(address));
+    x64.charge_budget(length);
+    auto current = address;
+    for (std::uint16_t i = 0; i < length; ++i) {
+      const std::uint16_t next = (current + 1u) & 0x1ffu;
+      if (translate(x64, program[current], next)) {
+        return;
+      }
+      current = next;
+    }
+    jump(x64, current);
+  }
+
+  void translate_rom() {
+    for (std::uint16_t address = 0; address < 512; ++address) {
+      lengths[address] = measure(address);
+    }
+
+    std::vector<std::uint8_t> code;
+    X64Emitter x64{code, 1024};
+    for (std::uint16_t address = 0; address < 512; ++address) {
+      // Returns to run() with the program counter in eax
+      x64.bind(exit(address));
+      x64.store_budget(budget_offset);
+      x64.mov(X64Emitter::Reg::eax, address);
+      x64.ret();
+    }
+    for (std::uint16_t address = 0; address < 512; ++address) {
+      if (lengths[address] != 0) {
+        x64.bind(entry(address));
+        translate_block(x64, address);
+      }
+    }
+    x64.link();
+
+    buffer_size = std::size(code);
+    buffer = mmap(nullptr, buffer_size, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer == MAP_FAILED) {
+      throw std::runtime_error("unable to map the code buffer");
+    }
+    std::memcpy(buffer, std::data(code), std::size(code));
+    if (mprotect(buffer, buffer_size, PROT_READ | PROT_EXEC) != 0) {
+      munmap(buffer, buffer_size);
+      throw std::runtime_error("unable to make the code buffer executable");
+    }
+
+    auto *const base = static_cast<std::uint8_t *>(buffer);
+    for (std::uint16_t address = 0; address < 512; ++address) {
+      if (lengths[address] != 0) {
+        entries[address] =
+            reinterpret_cast<Block>(base + x64.position(entry(address)));
+      }
+    }
+  }
+
+  void verify(const std::uint64_t cycles) {
+    reference->run(cycles);
+    cycle += cycles;
+    if (!(*this == *reference)) {
+      throw std::runtime_error(
+          std::format("recompiled code diverged from the interpreter at cycle "
+                      "{:d}: pc {:03X}, expected {:03X}",
+                      cycle, pc, reference->PC()));
+    }
+  }
+
+public:
+  explicit JitEmulator(const std::array<OpCode, 512> &rom,
+                       const Mode mode = Mode::Native)
+      : BasicEmulator{rom}, mode{mode} {
+    for (std::size_t f = 0; f < std::size(files); ++f) {
+      files[f] = offset_of(&registers[f]);
+    }
+    w_offset = offset_of(&w);
+    stack0_offset = offset_of(&stack[0]);
+    stack1_offset = offset_of(&stack[1]);
+    budget_offset = offset_of(&budget);
+    if (mode == Mode::Lockstep) {
+      reference.emplace(rom);
+    }
+    translate_rom();
+  }
+
+  JitEmulator(const JitEmulator &) = delete;
+  JitEmulator &operator=(const JitEmulator &) = delete;
+
+  ~JitEmulator() { munmap(buffer, buffer_size); }
+
+  void input(const std::size_t port, const std::size_t bit, const bool set) {
+    if (set) {
+      input_high(port, bit);
+    } else {
+      input_low(port, bit);
+    }
+  }
+
+  void input_high(const std::size_t port, const std::size_t bit) {
+    BasicEmulator::input_high(port, bit);
+    if (reference) {
+      reference->input_high(port, bit);
+    }
+  }
+
+  void input_low(const std::size_t port, const std::size_t bit) {
+    BasicEmulator::input_low(port, bit);
+    if (reference) {
+      reference->input_low(port, bit);
+    }
+  }
+
+  void restore(const State &state) {
+    BasicEmulator::restore(state);
+    if (reference) {
+      reference->restore(state);
+    }
+  }
+
+  // Runs `cycles` instructions, with the same effect as calling tick() that
+  // many times.
+  void run(const std::uint64_t cycles) {
+    budget = cycles;
+    while (budget != 0) {
+      const auto length = pc < std::size(lengths) ? lengths[pc] : 0u;
+      const auto before = budget;
+      if (length != 0 && length <= budget) {
+        pc = static_cast<std::uint16_t>(entries[pc](this, budget));
+      } else {
+        tick();
+        --budget;
+      }
+      if (reference) {
+        verify(before - budget);
+      }
+    }
+  }
+};
+
+} // namespace pic1650
+
+#endif
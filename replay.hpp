@@ -0,0 +1,291 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <istream>
+#include <iterator>
+#include <ostream>
+#include <stdexcept>
+#include <vector>
+
+#include "pic1650.hpp"
+#include "state.hpp"
+
+namespace pic1650 {
+
+struct InputEvent {
+  // Number of cycles run before the input changed
+  std::uint64_t cycle{};
+  std::uint8_t port{};
+  std::uint8_t bit{};
+  bool set{};
+};
+
+struct Keyframe {
+  std::uint64_t cycle{};
+  // Number of input events already applied to state
+  std::uint64_t events{};
+  State state{};
+};
+
+// A recorded session: the ROM, every input change and a keyframe of the state
+// every keyframe_interval cycles. Starting from any keyframe and applying the
+// input events after it reproduces the session exactly.
+struct Recording {
+  static constexpr std::array<char, 8> magic{'P', 'I', 'C', '1',
+                                             '6', '5', '0', 'R'};
+  static constexpr std::uint32_t version = 1;
+  static constexpr std::uint64_t default_keyframe_interval = 1u << 20;
+
+  std::array<OpCode, 512> rom{};
+  std::uint64_t keyframe_interval{default_keyframe_interval};
+  std::uint64_t cycles{};
+  std::vector<InputEvent> events;
+  std::vector<Keyframe> keyframes;
+
+  // Recordings are little-endian, starting with magic and version
+  void save(std::ostream &os) const {
+    const auto put = [&os](const std::uint64_t x, const std::size_t size) {
+      for (std::size_t i = 0; i < size; ++i) {
+        os.put(static_cast<char>(x >> (8 * i)));
+      }
+    };
+    os.write(std::data(magic), std::size(magic));
+    put(version, 4);
+    for (const auto opcode : rom) {
+      put(opcode, 2);
+    }
+    put(keyframe_interval, 8);
+    put(cycles, 8);
+    put(std::size(events), 8);
+    for (const auto &event : events) {
+      put(event.cycle, 8);
+      put(event.port, 1);
+      put(event.bit, 1);
+      put(event.set, 1);
+    }
+    put(std::size(keyframes), 8);
+    for (const auto &keyframe : keyframes) {
+      put(keyframe.cycle, 8);
+      put(keyframe.events, 8);
+      const auto state = serialize(keyframe.state);
+      os.write(reinterpret_cast<const char *>(std::data(state)),
+               std::size(state));
+    }
+    if (!os) {
+      throw std::runtime_error("failed to write recording");
+    }
+  }
+
+  static Recording load(std::istream &is) {
+    const auto get = [&is](const std::size_t size) {
+      std::uint64_t x = 0;
+      for (std::size_t i = 0; i < size; ++i) {
+        const auto c = is.get();
+        if (c == std::istream::traits_type::eof()) {
+          throw std::runtime_error("truncated recording");
+        }
+        x |= static_cast<std::uint64_t>(c & 0xff) << (8 * i);
+      }
+      return x;
+    };
+    std::array<char, 8> found{};
+    is.read(std::data(found), std::size(found));
+    if (!is || found != magic) {
+      throw std::runtime_error("not a recording");
+    }
+    if (const auto found_version = get(4); found_version != version) {
+      throw std::runtime_error(
+          std::format("unsupported recording version {:d}", found_version));
+    }
+
+    // Reads a count of items of the given size, which a seekable stream must
+    // have room for, so that a corrupt count can't allocate without bound
+    const auto get_count = [&is, &get](const char *what,
+                                       const std::size_t size) {
+      const auto count = get(8);
+      const auto here = is.tellg();
+      if (here != std::istream::pos_type(-1) && is.seekg(0, std::ios::end)) {
+        const auto left = static_cast<std::uint64_t>(is.tellg() - here);
+        is.seekg(here);
+        if (count > left / size) {
+          throw std::runtime_error(
+              std::format("recording claims {:d} {:s} but has room for {:d}",
+                          count, what, left / size));
+        }
+      }
+      is.clear();
+      return count;
+    };
+
+    Recording recording;
+    for (auto &opcode : recording.rom) {
+      opcode = static_cast<OpCode>(get(2));
+    }
+    recording.keyframe_interval = get(8);
+    recording.cycles = get(8);
+    for (auto left = get_count("events", 11); left != 0u; --left) {
+      InputEvent event;
+      event.cycle = get(8);
+      event.port = static_cast<std::uint8_t>(get(1));
+      event.bit = static_cast<std::uint8_t>(get(1));
+      event.set = get(1) != 0;
+      if (event.port >= devices::pic1650.ports || event.bit >= 8u ||
+          event.cycle > recording.cycles ||
+          (!std::empty(recording.events) &&
+           event.cycle < recording.events.back().cycle)) {
+        throw std::runtime_error(std::format(
+            "bad input event {:d} in recording", std::size(recording.events)));
+      }
+      recording.events.push_back(event);
+    }
+    for (auto left = get_count("keyframes", 16 + serialized_state_size);
+         left != 0u; --left) {
+      Keyframe keyframe;
+      keyframe.cycle = get(8);
+      keyframe.events = get(8);
+      std::array<std::byte, serialized_state_size> state;
+      is.read(reinterpret_cast<char *>(std::data(state)), std::size(state));
+      if (!is) {
+        throw std::runtime_error("truncated recording");
+      }
+      keyframe.state = deserialize(state);
+      if (keyframe.cycle > recording.cycles ||
+          keyframe.events > std::size(recording.events) ||
+          (!std::empty(recording.keyframes) &&
+           keyframe.cycle <= recording.keyframes.back().cycle)) {
+        throw std::runtime_error(
+            std::format("bad keyframe {:d} in recording",
+                        std::size(recording.keyframes)));
+      }
+      recording.keyframes.push_back(keyframe);
+    }
+    if (std::empty(recording.keyframes) ||
+        recording.keyframes.front().cycle != 0) {
+      throw std::runtime_error("recording has no initial keyframe");
+    }
+    return recording;
+  }
+};
+
+// Records a session on an emulator, which must only be run and given inputs
+// through the recorder from then on.
+template <typename Machine> class Recorder {
+private:
+  Machine &emulator;
+  Recording session;
+
+  void keyframe() {
+    session.keyframes.push_back({.cycle = session.cycles,
+                                 .events = std::size(session.events),
+                                 .state = emulator.snapshot()});
+  }
+
+public:
+  Recorder(Machine &emulator, const std::array<OpCode, 512> &rom,
+           const std::uint64_t keyframe_interval =
+               Recording::default_keyframe_interval)
+      : emulator{emulator},
+        session{.rom = rom,
+                .keyframe_interval =
+                    std::max(keyframe_interval, std::uint64_t{1}),
+                .cycles = 0,
+                .events = {},
+                .keyframes = {}} {
+    keyframe();
+  }
+
+  void run(const std::uint64_t cycles) {
+    const auto end = session.cycles + cycles;
+    while (session.cycles < end) {
+      const auto interval = session.keyframe_interval;
+      const auto next =
+          std::min(end, (session.cycles / interval + 1) * interval);
+      emulator.run(next - session.cycles);
+      session.cycles = next;
+      if (session.cycles % interval == 0) {
+        keyframe();
+      }
+    }
+  }
+
+  void input(const std::size_t port, const std::size_t bit, const bool set) {
+    emulator.input(port, bit, set);
+    session.events.push_back({.cycle = session.cycles,
+                              .port = static_cast<std::uint8_t>(port),
+                              .bit = static_cast<std::uint8_t>(bit),
+                              .set = set});
+  }
+
+  std::uint64_t cycle() const { return session.cycles; }
+
+  const Recording &recording() const { return session; }
+};
+
+// Plays a recording back on an emulator and seeks to any cycle in it by
+// restoring the nearest keyframe at or before the cycle and running on from
+// there, so a seek costs at most keyframe_interval cycles of emulation.
+template <typename Machine> class Replayer {
+private:
+  Machine &emulator;
+  const Recording &recording;
+  std::uint64_t now{};
+  std::size_t next_event{};
+  bool positioned{};
+
+  // Runs to target, applying every event up to and including target's
+  void advance(const std::uint64_t target) {
+    const auto &events = recording.events;
+    while (true) {
+      while (next_event < std::size(events) &&
+             events[next_event].cycle <= now) {
+        const auto &event = events[next_event++];
+        emulator.input(event.port, event.bit, event.set);
+      }
+      if (now == target) {
+        return;
+      }
+      const auto stop = next_event < std::size(events)
+                            ? std::min(target, events[next_event].cycle)
+                            : target;
+      emulator.run(stop - now);
+      now = stop;
+    }
+  }
+
+public:
+  Replayer(Machine &emulator, const Recording &recording)
+      : emulator{emulator}, recording{recording} {
+    seek(0);
+  }
+
+  std::uint64_t cycle() const { return now; }
+
+  // Puts the emulator in the state it had target cycles into the recording,
+  // with the inputs changed on that cycle applied.
+  void seek(const std::uint64_t target) {
+    if (target > recording.cycles) {
+      throw std::out_of_range(
+          std::format("cycle {:d} is past the end of the recording at {:d}",
+                      target, recording.cycles));
+    }
+    const auto keyframe = std::prev(std::ranges::upper_bound(
+        recording.keyframes, target, {}, &Keyframe::cycle));
+    // Carrying on is cheaper when no keyframe lies between here and target
+    if (!positioned || target < now || keyframe->cycle > now) {
+      positioned = true;
+      emulator.restore(keyframe->state);
+      now = keyframe->cycle;
+      next_event = static_cast<std::size_t>(keyframe->events);
+    }
+    advance(target);
+  }
+
+  // Runs on through the recording; past its end the inputs stay as they were.
+  void run(const std::uint64_t cycles) { advance(now + cycles); }
+};
+
+} // namespace pic1650
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <random>
+
+#include "pic1650.hpp"
+
+namespace pic1650 {
+
+// Random legal instructions, for benchmarks and for checking engines against
+// each other. There is no CALL or RETLW, which would need a matching stack,
+// and no indirect file 0, which would need fsr set up.
+inline std::array<OpCode, 512> random_rom(const std::uint32_t seed) {
+  std::mt19937 random{seed};
+  std::array<OpCode, 512> rom{};
+  for (auto &opcode : rom) {
+    while (true) {
+      opcode = static_cast<OpCode>(random() & 0xfffu);
+      const auto [mnemonic, f, d, k] = Emulator::decode(opcode);
+      const bool indirect = has_file_operand(mnemonic) && f == 0u;
+      if (!indirect && mnemonic != Mnemonic::ILLEGAL_INSTRUCTION &&
+          mnemonic != Mnemonic::CALL && mnemonic != Mnemonic::RETLW) {
+        break;
+      }
+    }
+  }
+  return rom;
+}
+
+} // namespace pic1650
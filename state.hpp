@@ -0,0 +1,182 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#include "pic1650.hpp"
+
+namespace pic1650 {
+
+// Serialized states are a version byte followed by the State fields in
+// declaration order, multi-byte fields little-endian, with no padding.
+constexpr std::uint8_t state_format_version = 1;
+constexpr std::size_t serialized_state_size = 42;
+
+inline std::array<std::byte, serialized_state_size>
+serialize(const State &state) {
+  std::array<std::byte, serialized_state_size> bytes{};
+  auto at = std::begin(bytes);
+  const auto put8 = [&at](const std::uint8_t x) { *at++ = std::byte{x}; };
+  const auto put16 = [&put8](const std::uint16_t x) {
+    put8(static_cast<std::uint8_t>(x));
+    put8(static_cast<std::uint8_t>(x >> 8));
+  };
+  put8(state_format_version);
+  put16(state.pc);
+  put16(state.stack[0]);
+  put16(state.stack[1]);
+  put8(state.rtcc);
+  put8(state.w);
+  put8(state.fsr);
+  put8(state.status);
+  std::ranges::for_each(state.general_purpose_registers, put8);
+  std::ranges::for_each(state.inputs, put8);
+  std::ranges::for_each(state.output_latches, put8);
+  return bytes;
+}
+
+inline State deserialize(const std::span<const std::byte> bytes) {
+  if (std::size(bytes) != serialized_state_size) {
+    throw std::runtime_error(std::format(
+        "a serialized state is {:d} bytes, not {:d}", serialized_state_size,
+        std::size(bytes)));
+  }
+  auto at = std::begin(bytes);
+  const auto get8 = [&at] { return std::to_integer<std::uint8_t>(*at++); };
+  const auto get16 = [&get8] {
+    const auto low = get8();
+    return static_cast<std::uint16_t>(low | (get8() << 8));
+  };
+  if (const auto version = get8(); version != state_format_version) {
+    throw std::runtime_error(
+        std::format("unsupported state version {:d}", version));
+  }
+  State state;
+  state.pc = get16();
+  state.stack[0] = get16();
+  state.stack[1] = get16();
+  state.rtcc = get8();
+  state.w = get8();
+  state.fsr = get8();
+  state.status = get8();
+  std::ranges::generate(state.general_purpose_registers, get8);
+  std::ranges::generate(state.inputs, get8);
+  std::ranges::generate(state.output_latches, get8);
+  if (state.pc > 0x1ffu || state.fsr > 0x1fu || state.status > 0b111u) {
+    throw std::runtime_error(std::format(
+        "invalid state: pc {:d}, fsr {:d}, status {:d}", state.pc, state.fsr,
+        state.status));
+  }
+  return state;
+}
+
+// Keeps the most recent snapshots of an emulator in a fixed amount of memory
+// so that it can be sent back to any earlier cycle they cover. Snapshots are
+// taken every `interval` cycles and whenever an input changes, so restoring
+// the latest snapshot at or before a cycle and replaying from it reaches
+// exactly the state the emulator was in at that cycle. Inputs must therefore
+// go through input(), and the emulator must only be run through run(), or
+// be reported with ran().
+template <typename Machine> class RewindBuffer {
+private:
+  struct Entry {
+    std::uint64_t cycle{};
+    State state{};
+  };
+
+  Machine &emulator;
+  std::vector<Entry> entries;
+  std::uint64_t interval;
+  // Oldest entry in the ring and number of entries in use
+  std::size_t first{};
+  std::size_t count{};
+  std::uint64_t now{};
+
+  Entry &entry(const std::size_t index) {
+    return entries[(first + index) % std::size(entries)];
+  }
+
+  void record() {
+    if (count != 0 && entry(count - 1).cycle == now) {
+      entry(count - 1).state = emulator.snapshot();
+      return;
+    }
+    if (count == std::size(entries)) {
+      first = (first + 1) % std::size(entries);
+      --count;
+    }
+    entry(count++) = Entry{.cycle = now, .state = emulator.snapshot()};
+  }
+
+public:
+  RewindBuffer(Machine &emulator, const std::size_t capacity,
+               const std::uint64_t interval)
+      : emulator{emulator}, entries(std::max(capacity, 1uz)),
+        interval{std::max(interval, std::uint64_t{1})} {
+    record();
+  }
+
+  // Cycles run since the buffer was created
+  std::uint64_t cycle() const { return now; }
+
+  // The earliest cycle rewind() can still reach
+  std::uint64_t earliest() const { return entries[first].cycle; }
+
+  void run(const std::uint64_t cycles) {
+    const auto end = now + cycles;
+    while (now < end) {
+      const auto next = std::min(end, (now / interval + 1) * interval);
+      emulator.run(next - now);
+      now = next;
+      if (now % interval == 0) {
+        record();
+      }
+    }
+  }
+
+  // Accounts for `cycles` instructions the emulator ran by other means than
+  // run(), such as a debugger stepping it, and takes a snapshot
+  void ran(const std::uint64_t cycles) {
+    now += cycles;
+    record();
+  }
+
+  // Forgets every snapshot, after the emulator was put in a state it didn't
+  // run into, and starts again from that state
+  void clear() {
+    first = 0;
+    count = 0;
+    record();
+  }
+
+  void input(const std::size_t port, const std::size_t bit, const bool set) {
+    emulator.input(port, bit, set);
+    record();
+  }
+
+  // Puts the emulator back in the state it had at `target`, forgetting every
+  // snapshot after it.
+  void rewind(const std::uint64_t target) {
+    if (target > now || target < earliest()) {
+      throw std::out_of_range(
+          std::format("can only rewind to cycles {:d} to {:d}, not {:d}",
+                      earliest(), now, target));
+    }
+    while (entry(count - 1).cycle > target) {
+      --count;
+    }
+    const auto &from = entry(count - 1);
+    emulator.restore(from.state);
+    now = from.cycle;
+    emulator.run(target - now);
+    now = target;
+  }
+};
+
+} // namespace pic1650
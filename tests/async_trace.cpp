@@ -0,0 +1,97 @@
+// Checks that AsyncTraceEmulator writes exactly the CSV LoudEmulator writes,
+// whatever the number of formatter threads and the size of the ring, and
+// that with Backpressure::Drop what it writes is whole rows of that CSV in
+// order, the dropped records making up the rest.
+
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <format>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "pic1650.hpp"
+#include "async_trace.hpp"
+#include "check.hpp"
+
+namespace {
+
+constexpr std::uint64_t cycles = 50'000;
+
+std::vector<std::string> lines(const std::string &text) {
+  std::vector<std::string> split;
+  std::istringstream is{text};
+  for (std::string line; std::getline(is, line);) {
+    split.push_back(line);
+  }
+  return split;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  try {
+    pic1650::test::Checks checks;
+    const auto rom = pic1650::test::read_rom(argc, argv);
+
+    std::ostringstream expected;
+    {
+      pic1650::LoudEmulator emulator{rom, expected};
+      emulator.run(cycles);
+    }
+
+    for (const pic1650::AsyncTraceOptions options :
+         {pic1650::AsyncTraceOptions{.formatter_threads = 1,
+                                     .chunk_size = 4096,
+                                     .chunks = 64},
+          pic1650::AsyncTraceOptions{.formatter_threads = 3,
+                                     .chunk_size = 7,
+                                     .chunks = 2},
+          pic1650::AsyncTraceOptions{.formatter_threads = 4,
+                                     .chunk_size = 1,
+                                     .chunks = 5},
+          pic1650::AsyncTraceOptions{.formatter_threads = 2,
+                                     .chunk_size = 1000,
+                                     .chunks = 3}}) {
+      std::ostringstream os;
+      pic1650::AsyncTraceEmulator emulator{rom, os, options};
+      emulator.run(cycles);
+      emulator.close();
+      checks.expect(os.str() == expected.str(),
+                    std::format("{:d} formatters, {:d} chunks of {:d}",
+                                options.formatter_threads, options.chunks,
+                                options.chunk_size));
+    }
+
+    std::ostringstream os;
+    pic1650::AsyncTraceEmulator emulator{
+        rom, os,
+        {.formatter_threads = 1,
+         .chunk_size = 16,
+         .chunks = 2,
+         .backpressure = pic1650::Backpressure::Drop}};
+    emulator.run(cycles);
+    emulator.close();
+    const auto all = lines(expected.str());
+    const auto kept = lines(os.str());
+    // Each kept row must be the row of the same cnt, after the header
+    bool ordered = !kept.empty() && kept[0] == all[0];
+    std::size_t at = 1;
+    for (std::size_t i = 1; ordered && i < std::size(kept); ++i) {
+      while (at < std::size(all) && all[at] != kept[i]) {
+        ++at;
+      }
+      ordered = at < std::size(all);
+    }
+    checks.expect(ordered, "dropping: rows out of order or changed");
+    checks.expect(std::size(kept) - 1 + emulator.dropped() == cycles,
+                  std::format("dropping: {:d} rows kept and {:d} dropped",
+                              std::size(kept) - 1, emulator.dropped()));
+    return checks.result();
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+}
@@ -0,0 +1,174 @@
+// Checks that a BandLimitedSynth turns a single step into one that settles
+// at the volume, centred on the step's time, that an AudioWatcher on a latch
+// that never changes produces silence at the sample rate, and that an
+// AudioRing hands samples across threads in order, dropping what doesn't fit.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <format>
+#include <iostream>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include "pic1650.hpp"
+#include "audio.hpp"
+#include "check.hpp"
+
+namespace {
+
+std::vector<std::int16_t> samples_of_step(const double time,
+                                          const float delta) {
+  // No DC blocker, so that the level after the step holds
+  pic1650::BandLimitedSynth synth{0.45, 1.0, 0.5};
+  std::vector<std::int16_t> samples;
+  const auto keep = [&samples](const std::span<const std::int16_t> pcm) {
+    samples.insert(std::end(samples), std::begin(pcm), std::end(pcm));
+  };
+  synth.step(time, delta);
+  synth.finish(time + 1'000.0);
+  synth.flush(keep);
+  return samples;
+}
+
+void steps(pic1650::test::Checks &checks) {
+  constexpr double volume = 0.5 * 32767.0;
+  for (const float delta : {1.0f, -1.0f}) {
+    const auto samples = samples_of_step(100.5, delta);
+    const auto name = std::format("step of {:.0f}", delta);
+    checks.expect(std::size(samples) >= 1'100u,
+                  std::format("{:s}: {:d} samples", name, std::size(samples)));
+    if (std::size(samples) < 1'100u) {
+      continue;
+    }
+    checks.expect(std::ranges::all_of(std::span{samples}.first(50),
+                                      [](const auto x) { return x == 0; }),
+                  std::format("{:s}: sound before the step", name));
+    checks.expect(std::ranges::all_of(std::span{samples}.subspan(150, 950),
+                                      [delta, volume](const auto x) {
+                                        return std::abs(x - delta * volume) <=
+                                               1.0;
+                                      }),
+                  std::format("{:s}: doesn't settle at the volume", name));
+    // Halfway between two samples, the step crosses half the volume there
+    checks.expect(std::abs(samples[100] + samples[101] - delta * volume) <=
+                      2.0,
+                  std::format("{:s}: not centred on its time", name));
+    checks.expect(std::ranges::all_of(samples,
+                                      [volume](const auto x) {
+                                        return std::abs(x) <= 1.1 * volume;
+                                      }),
+                  std::format("{:s}: rings past the volume", name));
+  }
+}
+
+// Holds port A bit 0 low, as NOPs leave it, or high
+void silence(pic1650::test::Checks &checks, const bool high) {
+  std::array<pic1650::OpCode, 512> rom{};
+  if (high) {
+    rom[0] = 0b1100'1111'1111u; // MOVLW 255
+    rom[1] = 0b0000'0010'0101u; // MOVWF PORTA
+    rom[2] = 0b1010'0000'0010u; // GOTO 2
+  }
+  pic1650::Emulator emulator{rom};
+  // Past reset and the write to port A
+  emulator.run(3);
+  const pic1650::AudioOptions options;
+  pic1650::AudioWatcher watcher{emulator, options};
+  std::size_t samples = 0;
+  bool silent = true;
+  const auto check = [&](const std::span<const std::int16_t> pcm) {
+    samples += std::size(pcm);
+    silent = silent && std::ranges::all_of(
+                           pcm, [](const auto x) { return x == 0; });
+  };
+  for (auto second = 0; second < 4; ++second) {
+    watcher.run(250'000, check);
+  }
+  watcher.finish(check);
+  const auto name = high ? "latch held high" : "latch held low";
+  checks.expect(silent, std::format("{:s}: not silent", name));
+  // Samples 0 to 4 s inclusive
+  checks.expect(samples == options.sample_rate * 4u + 1u,
+                std::format("{:s}: {:d} samples in four seconds", name,
+                            samples));
+}
+
+void ring(pic1650::test::Checks &checks) {
+  pic1650::AudioRing ring{5};
+  std::array<std::int16_t, 12> in{};
+  for (std::size_t i = 0; i < std::size(in); ++i) {
+    in[i] = static_cast<std::int16_t>(i);
+  }
+  std::array<std::int16_t, 12> out{};
+  checks.expect(ring.push(std::span{in}.first(6)) == 6u,
+                "capacity rounded up to 8");
+  checks.expect(ring.push(std::span{in}.subspan(6, 4)) == 2u &&
+                    ring.dropped_samples() == 2u,
+                "overflow dropped and counted");
+  checks.expect(ring.pop(std::span{out}.first(5)) == 5u &&
+                    ring.push(std::span{in}.subspan(10, 2)) == 2u &&
+                    ring.pop(std::span{out}.subspan(5)) == 5u,
+                "pop across the wrap");
+  checks.expect(out == std::array<std::int16_t, 12>{0, 1, 2, 3, 4, 5, 6, 7,
+                                                    10, 11},
+                "samples out of order");
+  checks.expect(ring.pop(out) == 0u, "pop from an empty ring");
+
+  // A producer that never waits and a consumer that takes what is there:
+  // what arrives is what was sent, less what was dropped, in order
+  constexpr std::int16_t sent = 30'000;
+  pic1650::AudioRing shared{256};
+  std::atomic<bool> done{};
+  std::vector<std::int16_t> received;
+  std::thread consumer{[&] {
+    std::array<std::int16_t, 100> buffer{};
+    while (true) {
+      const bool last = done.load();
+      const auto count = shared.pop(buffer);
+      received.insert(std::end(received), std::begin(buffer),
+                      std::begin(buffer) + static_cast<std::ptrdiff_t>(count));
+      if (last && count == 0u) {
+        break;
+      }
+    }
+  }};
+  std::array<std::int16_t, 50> chunk{};
+  for (std::int16_t next = 0; next < sent;) {
+    for (auto &x : chunk) {
+      x = next++;
+    }
+    shared.push(chunk);
+  }
+  done = true;
+  consumer.join();
+  checks.expect(std::size(received) + shared.dropped_samples() == sent,
+                std::format("{:d} samples received and {:d} dropped of {:d}",
+                            std::size(received), shared.dropped_samples(),
+                            sent));
+  checks.expect(std::ranges::is_sorted(received) &&
+                    std::ranges::adjacent_find(received) == std::end(received),
+                "samples reordered or repeated between threads");
+}
+
+} // namespace
+
+// Needs no ROM
+int main() {
+  try {
+    pic1650::test::Checks checks;
+    steps(checks);
+    silence(checks, false);
+    silence(checks, true);
+    ring(checks);
+    return checks.result();
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+}
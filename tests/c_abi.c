@@ -0,0 +1,216 @@
+/* Drives libpic1650 through its C header, compiled as C11, and checks the
+ * error returns, the order input events apply in, pic1650_step_latches()
+ * stopping at its capacity, and that restoring a snapshot replays the same
+ * game. Exits 1 if any check failed, as the C++ tests do. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libpic1650.h"
+
+static int failures;
+
+static void expect(const int ok, const char *what) {
+  if (!ok) {
+    fprintf(stderr, "FAILED: %s\n", what);
+    ++failures;
+  }
+}
+
+static pic1650_input_event event(const uint64_t cycle, const uint8_t port,
+                                 const uint8_t bit, const uint8_t high) {
+  pic1650_input_event e;
+  memset(&e, 0, sizeof e);
+  e.cycle = cycle;
+  e.port = port;
+  e.bit = bit;
+  e.high = high;
+  return e;
+}
+
+static int input(const pic1650_emulator *emulator, const int port,
+                 const int bit) {
+  pic1650_state state;
+  pic1650_snapshot(emulator, &state);
+  return (state.inputs[port] >> bit) & 1;
+}
+
+static void errors(const unsigned char *rom, const size_t size) {
+  pic1650_emulator *emulator = pic1650_create();
+  pic1650_state state;
+  pic1650_latch_change change;
+  pic1650_input_event early = event(0, 0, 0, 0);
+  uint8_t latches[4];
+  size_t written = 1;
+
+  expect(pic1650_step(emulator, 1) == PIC1650_NO_ROM, "step with no ROM");
+  expect(pic1650_step_latches(emulator, 1, &change, 1, &written) ==
+                 PIC1650_NO_ROM &&
+             written == 0,
+         "step_latches with no ROM");
+  expect(pic1650_submit_inputs(emulator, &early, 1) == PIC1650_NO_ROM,
+         "submit_inputs with no ROM");
+  expect(pic1650_snapshot(emulator, &state) == PIC1650_NO_ROM,
+         "snapshot with no ROM");
+  expect(pic1650_latches(emulator, latches) == PIC1650_NO_ROM,
+         "latches with no ROM");
+  expect(pic1650_restore(emulator, &state) == PIC1650_NO_ROM,
+         "restore with no ROM");
+
+  expect(pic1650_load_rom(NULL, rom, size) == PIC1650_BAD_ARGUMENT,
+         "load_rom on NULL");
+  expect(pic1650_load_rom(emulator, rom, size - 1) == PIC1650_BAD_ARGUMENT,
+         "load_rom of a short image");
+  expect(pic1650_load_rom(emulator, NULL, size) == PIC1650_BAD_ARGUMENT,
+         "load_rom of NULL");
+  expect(pic1650_load_rom(emulator, rom, size) == PIC1650_OK, "load_rom");
+  expect(pic1650_step(NULL, 1) == PIC1650_BAD_ARGUMENT, "step on NULL");
+  expect(pic1650_snapshot(NULL, &state) == PIC1650_BAD_ARGUMENT &&
+             pic1650_snapshot(emulator, NULL) == PIC1650_BAD_ARGUMENT,
+         "snapshot on NULL");
+  expect(pic1650_latches(emulator, NULL) == PIC1650_BAD_ARGUMENT,
+         "latches into NULL");
+  expect(pic1650_step_latches(emulator, 1, NULL, 1, &written) ==
+                 PIC1650_BAD_ARGUMENT &&
+             pic1650_step_latches(emulator, 1, &change, 1, NULL) ==
+                 PIC1650_BAD_ARGUMENT,
+         "step_latches with NULL buffers");
+  expect(pic1650_submit_inputs(emulator, NULL, 1) == PIC1650_BAD_ARGUMENT,
+         "submit_inputs of NULL");
+
+  pic1650_step(emulator, 10);
+  {
+    const pic1650_input_event bad[] = {
+        event(20, 0, 0, 0), event(9, 0, 0, 0), event(20, 4, 0, 0),
+        event(20, 0, 8, 0)};
+    size_t i;
+    for (i = 1; i < sizeof bad / sizeof bad[0]; ++i) {
+      pic1650_input_event pair[2];
+      pair[0] = bad[0];
+      pair[1] = bad[i];
+      expect(pic1650_submit_inputs(emulator, pair, 2) == PIC1650_BAD_ARGUMENT,
+             "submit_inputs of a past cycle or a missing pin");
+    }
+  }
+  /* None of a rejected batch is queued */
+  pic1650_step(emulator, 20);
+  expect(input(emulator, 0, 0) == 1, "rejected batch applied");
+
+  pic1650_snapshot(emulator, &state);
+  state.pc = 512;
+  expect(pic1650_restore(emulator, &state) == PIC1650_BAD_ARGUMENT,
+         "restore of pc 512");
+  expect(pic1650_restore(emulator, NULL) == PIC1650_BAD_ARGUMENT,
+         "restore of NULL");
+  pic1650_destroy(emulator);
+}
+
+static void ordering(const unsigned char *rom, const size_t size) {
+  pic1650_emulator *emulator = pic1650_create();
+  /* Out of cycle order, with two pairs on cycle 100 that must apply in the
+   * order given */
+  const pic1650_input_event events[] = {
+      event(200, 1, 2, 0), event(100, 0, 0, 0), event(100, 0, 1, 1),
+      event(100, 0, 0, 1), event(100, 0, 1, 0)};
+  pic1650_load_rom(emulator, rom, size);
+  expect(pic1650_submit_inputs(emulator, events, 5) == PIC1650_OK,
+         "submit_inputs");
+  pic1650_step(emulator, 99);
+  expect(input(emulator, 0, 0) == 1 && input(emulator, 0, 1) == 1,
+         "inputs applied early");
+  pic1650_step(emulator, 1);
+  expect(input(emulator, 0, 0) == 1 && input(emulator, 0, 1) == 0,
+         "same cycle inputs out of order");
+  expect(input(emulator, 1, 2) == 1, "later input applied early");
+  pic1650_step(emulator, 100);
+  expect(input(emulator, 1, 2) == 0, "later input not applied");
+  pic1650_destroy(emulator);
+}
+
+static void capacity(const unsigned char *rom, const size_t size) {
+  pic1650_emulator *emulator = pic1650_create();
+  pic1650_latch_change changes[4];
+  pic1650_state state;
+  size_t written = 0;
+  pic1650_load_rom(emulator, rom, size);
+
+  expect(pic1650_step_latches(emulator, 10000000, changes, 3, &written) ==
+                 PIC1650_OK &&
+             written == 3,
+         "step_latches filled its buffer");
+  pic1650_snapshot(emulator, &state);
+  expect(changes[0].cycle < changes[1].cycle &&
+             changes[1].cycle < changes[2].cycle &&
+             state.cycle == changes[2].cycle,
+         "step_latches stops at the change that fills its buffer");
+  expect(memcmp(changes[2].output_latches, state.output_latches, 4) == 0,
+         "step_latches reports the latches");
+  pic1650_step_latches(emulator, 1000, changes, 0, &written);
+  pic1650_snapshot(emulator, &state);
+  expect(written == 0 && state.cycle == changes[2].cycle,
+         "step_latches ran with no room");
+  pic1650_destroy(emulator);
+}
+
+static void reproducible(const unsigned char *rom, const size_t size) {
+  pic1650_emulator *first = pic1650_create();
+  pic1650_emulator *second = pic1650_create();
+  pic1650_latch_change before[64];
+  pic1650_latch_change after[64];
+  pic1650_state start;
+  pic1650_state end_before;
+  pic1650_state end_after;
+  size_t written_before = 0;
+  size_t written_after = 0;
+  const pic1650_input_event presses[] = {event(300000, 2, 1, 0),
+                                         event(350000, 2, 1, 1)};
+  const pic1650_input_event dropped = event(320000, 0, 3, 0);
+
+  pic1650_load_rom(first, rom, size);
+  pic1650_step(first, 250000);
+  pic1650_snapshot(first, &start);
+  pic1650_submit_inputs(first, presses, 2);
+  pic1650_step(first, 200000);
+  pic1650_step_latches(first, 200000, before, 64, &written_before);
+  pic1650_snapshot(first, &end_before);
+
+  /* On another emulator, with an event queued that restoring drops */
+  pic1650_load_rom(second, rom, size);
+  pic1650_submit_inputs(second, &dropped, 1);
+  expect(pic1650_restore(second, &start) == PIC1650_OK, "restore");
+  pic1650_submit_inputs(second, presses, 2);
+  pic1650_step(second, 200000);
+  pic1650_step_latches(second, 200000, after, 64, &written_after);
+  pic1650_snapshot(second, &end_after);
+
+  expect(written_before != 0 && written_before == written_after &&
+             memcmp(before, after, written_before * sizeof before[0]) == 0,
+         "restored game changes its latches differently");
+  expect(memcmp(&end_before, &end_after, sizeof end_before) == 0,
+         "restored game ends in a different state");
+  pic1650_destroy(first);
+  pic1650_destroy(second);
+}
+
+int main(int argc, char *argv[]) {
+  unsigned char rom[1024];
+  FILE *file;
+  if (argc != 2) {
+    fprintf(stderr, "usage: c_abi tandybaseball.bin\n");
+    return 1;
+  }
+  file = fopen(argv[1], "rb");
+  if (file == NULL || fread(rom, 1, sizeof rom, file) != sizeof rom) {
+    fprintf(stderr, "can't read a ROM from %s\n", argv[1]);
+    return 1;
+  }
+  fclose(file);
+
+  expect(pic1650_abi_version() == PIC1650_ABI_VERSION, "ABI version");
+  errors(rom, sizeof rom);
+  ordering(rom, sizeof rom);
+  capacity(rom, sizeof rom);
+  reproducible(rom, sizeof rom);
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+// Shared by the test programs, which ctest runs with the ROM as their
+// argument. A test prints every failed check to stderr and exits 1 if any
+// failed, or exits 77 when it doesn't apply on this platform.
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "pic1650.hpp"
+#include "roms.hpp"
+
+namespace pic1650::test {
+
+inline constexpr int skipped = 77;
+
+inline std::array<OpCode, 512> read_rom(const int argc, char *argv[]) {
+  if (argc != 2) {
+    throw std::runtime_error("usage: <test> tandybaseball.bin");
+  }
+  std::array<OpCode, 512> rom;
+  std::ifstream file{argv[1], std::ios::binary};
+  file.read(reinterpret_cast<char *>(std::data(rom)), std::size(rom) * 2);
+  if (!file) {
+    throw std::runtime_error(
+        std::format("can't read a ROM from {:s}", argv[1]));
+  }
+  return rom;
+}
+
+// Blocks of 16 instructions that each set a port's latches high, then sit in
+// nested DECFSZ/GOTO delay loops that also wait on an input bit, leaving
+// early when it goes high, and fall through to the next block
+inline std::array<OpCode, 512> delay_loop_rom() {
+  std::array<OpCode, 512> rom{};
+  for (std::size_t at = 0; at < std::size(rom); at += 16) {
+    const auto block = static_cast<OpCode>(at / 16u);
+    const auto port = static_cast<OpCode>(PORTA + block % 4u);
+    const auto bit = static_cast<OpCode>(block % 8u);
+    const auto jump = [at](const std::size_t offset) {
+      return static_cast<OpCode>(0b1010'0000'0000u | (at + offset));
+    };
+    const std::array<OpCode, 13> code{
+        0b1100'1111'1111u,                                // MOVLW 255
+        static_cast<OpCode>(0b0000'0010'0000u | port),    // MOVWF port
+        static_cast<OpCode>(0b1100'0000'0000u | (200u - block)), // MOVLW
+        0b0000'0010'1001u,                                // MOVWF F9
+        0b1100'0000'0011u,                                // MOVLW 3
+        0b0000'0010'1010u,                                // MOVWF F10
+        static_cast<OpCode>(0b0111'0000'0000u | (bit << 5) | port), // BTFSS
+        jump(9),                                          // GOTO at + 9
+        jump(13),                                         // GOTO at + 13
+        0b0010'1110'1001u,                                // DECFSZ F9 D1
+        jump(6),                                          // GOTO at + 6
+        0b0010'1110'1010u,                                // DECFSZ F10 D1
+        jump(6),                                          // GOTO at + 6
+    };
+    std::ranges::copy(code, std::begin(rom) + static_cast<std::ptrdiff_t>(at));
+  }
+  return rom;
+}
+
+// Runs from reset to cycle `to`, pressing or releasing a button every 7'919
+// cycles, through `machine`: an emulator, or something that records or
+// rewinds one, so that another emulator can be played to the same cycle
+template <typename Machine>
+void play(Machine &machine, const std::uint64_t to) {
+  constexpr std::uint64_t period = 7'919;
+  for (std::uint64_t cycle = 0; cycle < to;) {
+    const auto next = std::min(to, (cycle / period + 1u) * period);
+    machine.run(next - cycle);
+    cycle = next;
+    if (cycle % period == 0u) {
+      const auto press = cycle / period;
+      machine.input(press % 4u, press % 8u, press % 3u != 0u);
+    }
+  }
+}
+
+class Checks {
+private:
+  int failures{};
+
+public:
+  void expect(const bool ok, const std::string_view what) {
+    if (!ok) {
+      std::cerr << "FAILED: " << what << std::endl;
+      ++failures;
+    }
+  }
+
+  int result() const { return failures == 0 ? 0 : 1; }
+};
+
+} // namespace pic1650::test
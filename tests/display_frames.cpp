@@ -0,0 +1,102 @@
+// Checks that a DisplayWatcher, run for random numbers of cycles with the
+// inputs changed between runs, publishes the same frames on the same cycles
+// as a Display fed the latches whenever ports B to D change, polled after
+// every tick().
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <format>
+#include <iostream>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "pic1650.hpp"
+#include "display.hpp"
+#include "check.hpp"
+
+namespace {
+
+using Frames = std::vector<std::pair<std::uint64_t, pic1650::Frame>>;
+
+std::array<std::uint8_t, 4> latches(const pic1650::Emulator &emulator) {
+  return {emulator.a(), emulator.b(), emulator.c(), emulator.d()};
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  try {
+    pic1650::test::Checks checks;
+    const auto rom = pic1650::test::read_rom(argc, argv);
+
+    pic1650::Emulator watched{rom};
+    pic1650::DisplayWatcher watcher{watched};
+    Frames published;
+    const auto on_frame = [&published](const std::uint64_t cycle,
+                                       const pic1650::Frame &frame) {
+      published.emplace_back(cycle, frame);
+    };
+
+    pic1650::Emulator polled{rom};
+    pic1650::Display display;
+    Frames expected;
+    auto last = latches(polled);
+    display.update(0, last);
+    std::uint64_t cycle = 0;
+
+    // Presses keys on ports A to C only, as run_ticks does
+    std::mt19937 random{1650};
+    std::size_t port = 0;
+    std::size_t bit = 0;
+    for (auto slice = 0; slice < 200; ++slice) {
+      const auto cycles = random() % (std::uint64_t{1} << (random() % 19u));
+      watcher.run(cycles, on_frame);
+      for (std::uint64_t i = 0; i < cycles; ++i) {
+        polled.tick();
+        ++cycle;
+        const auto now = latches(polled);
+        if (now[1] != last[1] || now[2] != last[2] || now[3] != last[3]) {
+          if (display.update(cycle, now)) {
+            expected.emplace_back(display.cycle(), display.frame());
+          }
+          last = now;
+        }
+      }
+      for (auto *emulator : {&watched, &polled}) {
+        emulator->input(port, bit, true);
+      }
+      if (random() % 4u != 0u) {
+        port = random() % 3u;
+        bit = random() % 8u;
+        for (auto *emulator : {&watched, &polled}) {
+          emulator->input(port, bit, false);
+        }
+      }
+    }
+
+    checks.expect(watcher.cycle() == cycle && watched == polled,
+                  std::format("watcher ran to cycle {:d}, not {:d}",
+                              watcher.cycle(), cycle));
+    checks.expect(std::size(expected) > 10u, "too few frames to compare");
+    checks.expect(published == expected,
+                  std::format("{:d} frames published, {:d} polled",
+                              std::size(published), std::size(expected)));
+    checks.expect(watcher.frame() == display.frame(), "last frame");
+    if (const auto [got, want] = std::ranges::mismatch(published, expected);
+        got != std::end(published) && want != std::end(expected)) {
+      checks.expect(false, std::format("frame {:d},{:s} polled as {:d},{:s}",
+                                       got->first,
+                                       pic1650::to_string(got->second),
+                                       want->first,
+                                       pic1650::to_string(want->second)));
+    }
+    return checks.result();
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+}
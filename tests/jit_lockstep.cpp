@@ -0,0 +1,75 @@
+// Runs JitEmulator against the interpreter: in Lockstep mode, which checks
+// the state after every instruction, and natively, comparing the state after
+// whole runs. Both on the baseball ROM with the buttons pressed now and then,
+// and on a ROM of random instructions.
+
+#include <array>
+#include <cstdint>
+#include <exception>
+#include <format>
+#include <iostream>
+
+#include "pic1650.hpp"
+#include "recompiler.hpp"
+#include "check.hpp"
+
+#if defined(PIC1650_JIT)
+namespace {
+
+// Runs in slices, pressing and releasing a button between them
+template <typename Machine> void play(Machine &machine, const int slices) {
+  for (auto slice = 0; slice < slices; ++slice) {
+    machine.input(static_cast<std::size_t>(slice % 4),
+                  static_cast<std::size_t>(slice % 8), slice % 3 != 0);
+    machine.run(20'011);
+  }
+}
+
+void compare(pic1650::test::Checks &checks, const char *name,
+             const std::array<pic1650::OpCode, 512> &rom) {
+  try {
+    pic1650::JitEmulator lockstep{rom, pic1650::JitEmulator::Mode::Lockstep};
+    play(lockstep, 50);
+  } catch (const std::exception &e) {
+    checks.expect(false, std::format("{:s} in lockstep: {:s}", name, e.what()));
+  }
+
+  for (const std::uint64_t cycles : {1u, 2u, 63u, 64u, 65u, 1'000u, 123'457u}) {
+    pic1650::JitEmulator native{rom};
+    pic1650::Emulator interpreted{rom};
+    native.run(cycles);
+    interpreted.run(cycles);
+    checks.expect(native == interpreted,
+                  std::format("{:s} after {:d} cycles", name, cycles));
+  }
+
+  pic1650::JitEmulator native{rom};
+  pic1650::Emulator interpreted{rom};
+  play(native, 200);
+  play(interpreted, 200);
+  checks.expect(native == interpreted,
+                std::format("{:s} with inputs", name));
+}
+
+} // namespace
+#endif
+
+int main(int argc, char *argv[]) {
+#if defined(PIC1650_JIT)
+  try {
+    pic1650::test::Checks checks;
+    compare(checks, "tandybaseball", pic1650::test::read_rom(argc, argv));
+    for (const std::uint32_t seed : {1650u, 1654u, 1655u}) {
+      compare(checks, "random", pic1650::random_rom(seed));
+    }
+    return checks.result();
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+#else
+  (void)argc;
+  (void)argv;
+  return pic1650::test::skipped;
+#endif
+}
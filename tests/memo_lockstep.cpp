@@ -0,0 +1,100 @@
+// Checks that a MemoizingEmulator, run for random numbers of cycles with the
+// inputs changed between runs, stays in the state a plain Emulator reaches,
+// with caches from a single set, where entries are evicted all the time, to
+// more entries than the game has calls. Runs the baseball ROM, and a ROM
+// whose one subroutine reads port A only after a delay, so that the inputs
+// often change while a call to it is recorded.
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <format>
+#include <iostream>
+#include <random>
+
+#include "pic1650.hpp"
+#include "memo.hpp"
+#include "check.hpp"
+
+namespace {
+
+// Sets port A's latches high, then calls 4 forever: a delay loop of about
+// 100 instructions, then port A copied to F10
+std::array<pic1650::OpCode, 512> slow_read_rom() {
+  std::array<pic1650::OpCode, 512> rom{
+      0b1100'1111'1111u, // MOVLW 255
+      0b0000'0010'0101u, // MOVWF PORTA
+      0b1001'0000'0100u, // CALL 4
+      0b1010'0000'0010u, // GOTO 2
+      0b1100'0011'0010u, // MOVLW 50
+      0b0000'0010'1001u, // MOVWF F9
+      0b0010'1110'1001u, // DECFSZ F9 D1
+      0b1010'0000'0110u, // GOTO 6
+      0b0010'0000'0101u, // MOVF PORTA D0
+      0b0000'0010'1010u, // MOVWF F10
+      0b1000'0000'0000u, // RETLW 0
+  };
+  return rom;
+}
+
+// Runs for up to 2^`bits` - 1 cycles at a time. Presses keys on ports A to
+// C only, as run_ticks does.
+void compare(pic1650::test::Checks &checks, const char *rom_name,
+             const std::array<pic1650::OpCode, 512> &rom,
+             const pic1650::MemoOptions &options, const unsigned bits) {
+  const auto name =
+      std::format("{:s}: {:d} entries, calls up to {:d} cycles", rom_name,
+                  options.entries, options.max_cycles);
+  pic1650::MemoizingEmulator memo{rom, options};
+  pic1650::Emulator plain{rom};
+  std::mt19937 random{1650};
+  std::size_t port = 0;
+  std::size_t bit = 0;
+  std::uint64_t cycle = 0;
+  for (auto slice = 0; slice < 1000; ++slice) {
+    const auto cycles = random() % (std::uint64_t{1} << (random() % bits));
+    memo.run(cycles);
+    plain.run(cycles);
+    cycle += cycles;
+    if (memo != plain) {
+      checks.expect(false, std::format("{:s}: run() to cycle {:d}, slice {:d}",
+                                       name, cycle, slice));
+      return;
+    }
+    memo.input(port, bit, true);
+    plain.input(port, bit, true);
+    if (random() % 4u != 0u) {
+      port = random() % 3u;
+      bit = random() % 8u;
+      memo.input(port, bit, false);
+      plain.input(port, bit, false);
+    }
+  }
+  checks.expect(memo.memo_stats().hits != 0u,
+                std::format("{:s}: no calls replayed", name));
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  try {
+    pic1650::test::Checks checks;
+    const auto rom = pic1650::test::read_rom(argc, argv);
+    const auto slow_read = slow_read_rom();
+    for (const pic1650::MemoOptions options :
+         {pic1650::MemoOptions{.entries = 1},
+          pic1650::MemoOptions{.entries = 4},
+          pic1650::MemoOptions{.entries = 64, .max_cycles = 200},
+          pic1650::MemoOptions{},
+          pic1650::MemoOptions{.entries = 1u << 16}}) {
+      compare(checks, "tandybaseball", rom, options, 21);
+      // Short runs, so that they often end part way through a recording
+      compare(checks, "slow read", slow_read, options, 11);
+    }
+    return checks.result();
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+}
@@ -0,0 +1,107 @@
+// Runs MultiEmulator against one Emulator per lane, giving every lane its own
+// inputs so that the lanes split up and come back together, and compares
+// each lane's state with its Emulator's after slices of different lengths.
+// On the baseball ROM from reset, and on ROMs of random instructions from
+// random states, for the PIC1650 and for a part with fewer ports.
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <format>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "pic1650.hpp"
+#include "multi_emulator.hpp"
+#include "check.hpp"
+
+namespace {
+
+template <pic1650::Device D>
+pic1650::BasicState<D> random_state(std::mt19937 &random) {
+  const auto byte = [&random] { return static_cast<std::uint8_t>(random()); };
+  pic1650::BasicState<D> state;
+  state.pc = static_cast<std::uint16_t>(random() & D.pc_mask());
+  state.rtcc = byte();
+  state.w = byte();
+  state.fsr = byte() & 0b1'1111u;
+  state.status = byte() & 0b111u;
+  for (auto &x : state.general_purpose_registers) {
+    x = byte();
+  }
+  for (auto &x : state.output_latches) {
+    x = byte();
+  }
+  return state;
+}
+
+// With scattered set, every few slices the lanes restart in fours from new
+// random states, since a random ROM soon settles into a few short loops
+template <std::size_t Lanes, pic1650::Device D>
+void compare(pic1650::test::Checks &checks, const char *name,
+             const std::array<pic1650::OpCode, 512> &rom,
+             const bool scattered = false) {
+  constexpr std::array<std::uint64_t, 6> lengths{1u, 2u, 63u, 1'000u,
+                                                 20'011u, 4'099u};
+  pic1650::MultiEmulator<Lanes, D> lanes{rom};
+  std::vector<pic1650::DeviceEmulator<D>> emulators(
+      Lanes, pic1650::DeviceEmulator<D>{rom});
+  std::mt19937 random{1650};
+
+  for (std::size_t slice = 0; slice < 120; ++slice) {
+    for (std::size_t lane = 0; scattered && lane < Lanes; lane += 4) {
+      if ((slice + lane / 4) % 5 == 0) {
+        const auto state = random_state<D>(random);
+        for (auto i = lane; i < std::min(lane + 4, Lanes); ++i) {
+          lanes.restore(i, state);
+          emulators[i].restore(state);
+        }
+      }
+    }
+    // Each lane presses and releases the buttons one slice behind the lane
+    // before it
+    for (std::size_t lane = 0; lane < Lanes; ++lane) {
+      const auto step = slice + lane;
+      const auto port = step % D.ports;
+      const auto bit = step % 8u;
+      const bool set = step % 3u != 0u;
+      lanes.input(lane, port, bit, set);
+      emulators[lane].input(port, bit, set);
+    }
+    const auto cycles = lengths[slice % std::size(lengths)];
+    lanes.run(cycles);
+    for (std::size_t lane = 0; lane < Lanes; ++lane) {
+      emulators[lane].run(cycles);
+      if (lanes.snapshot(lane) != emulators[lane].snapshot()) {
+        checks.expect(false, std::format("{:s}, {:d} lanes: lane {:d} "
+                                         "after slice {:d}",
+                                         name, Lanes, lane, slice));
+        return;
+      }
+    }
+  }
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  try {
+    pic1650::test::Checks checks;
+    const auto baseball = pic1650::test::read_rom(argc, argv);
+    compare<8, pic1650::devices::pic1650>(checks, "tandybaseball", baseball);
+    compare<64, pic1650::devices::pic1650>(checks, "tandybaseball", baseball);
+    for (const std::uint32_t seed : {1650u, 1654u, 1655u}) {
+      const auto rom = pic1650::random_rom(seed);
+      compare<8, pic1650::devices::pic1650>(checks, "random", rom, true);
+      compare<32, pic1650::devices::pic1655>(checks, "random pic1655", rom,
+                                             true);
+    }
+    return checks.result();
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+}
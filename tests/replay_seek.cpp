@@ -0,0 +1,77 @@
+// Checks that a recording reads back as it was written, that corrupt ones are
+// rejected, and that seeking a Replayer to a cycle puts the emulator in the
+// state a fresh run with the same inputs reaches there.
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <format>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "pic1650.hpp"
+#include "replay.hpp"
+#include "check.hpp"
+
+namespace {
+
+bool rejected(const std::string &bytes) {
+  std::istringstream is{bytes};
+  try {
+    pic1650::Recording::load(is);
+    return false;
+  } catch (const std::runtime_error &) {
+    return true;
+  }
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  try {
+    pic1650::test::Checks checks;
+    const auto rom = pic1650::test::read_rom(argc, argv);
+
+    pic1650::Emulator recorded{rom};
+    pic1650::Recorder recorder{recorded, rom, 50'000};
+    pic1650::test::play(recorder, 400'000);
+    std::ostringstream os;
+    recorder.recording().save(os);
+    const auto bytes = os.str();
+    std::istringstream is{bytes};
+    const auto recording = pic1650::Recording::load(is);
+    std::ostringstream again;
+    recording.save(again);
+    checks.expect(again.str() == bytes, "round trip");
+
+    // The event count follows the magic, version, ROM, interval and cycles
+    constexpr std::size_t events_at = 8 + 4 + 512 * 2 + 8 + 8;
+    auto huge = bytes;
+    huge[events_at + 7] = '\x40';
+    checks.expect(rejected(huge), "event count past the end");
+    checks.expect(rejected(bytes.substr(0, std::size(bytes) - 1)),
+                  "truncated recording");
+    auto port = bytes;
+    port[events_at + 8 + 8] = '\x04';
+    checks.expect(rejected(port), "input to a port that doesn't exist");
+
+    pic1650::Emulator emulator{rom};
+    pic1650::Replayer replayer{emulator, recording};
+    for (const std::uint64_t target :
+         {399'999u, 7'919u, 300'000u, 300'001u, 349'999u, 0u, 400'000u}) {
+      replayer.seek(target);
+      pic1650::Emulator fresh{rom};
+      pic1650::test::play(fresh, target);
+      checks.expect(emulator == fresh,
+                    std::format("seeked to cycle {:d}", target));
+    }
+    checks.expect(recorded == emulator, "replayed to the end");
+    return checks.result();
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+}
@@ -0,0 +1,107 @@
+// Checks that run() and run_until() leave the emulator exactly as calling
+// tick() the same number of times does, on the baseball ROM and on ROMs of
+// random instructions, with budgets that end inside and across blocks. Then
+// runs the baseball ROM and a ROM of delay loops, which run() skips through,
+// for random budgets with the inputs changed between them.
+
+#include <array>
+#include <cstdint>
+#include <exception>
+#include <format>
+#include <iostream>
+#include <random>
+
+#include "pic1650.hpp"
+#include "check.hpp"
+
+namespace {
+
+void compare(pic1650::test::Checks &checks, const char *name,
+             const std::array<pic1650::OpCode, 512> &rom) {
+  pic1650::Emulator run{rom};
+  pic1650::Emulator ticked{rom};
+  std::uint64_t cycle = 0;
+  for (const std::uint64_t cycles :
+       {0u, 1u, 2u, 3u, 5u, 16u, 63u, 64u, 65u, 1'000u, 123'457u, 7u}) {
+    run.run(cycles);
+    for (std::uint64_t i = 0; i < cycles; ++i) {
+      ticked.tick();
+    }
+    cycle += cycles;
+    checks.expect(run.snapshot() == ticked.snapshot(),
+                  std::format("{:s}: run() to cycle {:d}", name, cycle));
+  }
+
+  // Stops at every address the program reaches soon, in turn
+  for (std::uint16_t target = 0; target < 512; target += 37) {
+    const auto at = [target](const pic1650::Emulator &emulator) {
+      return emulator.PC() == target;
+    };
+    const auto executed = run.run_until(at, 50'000);
+    std::uint64_t stepped = 0;
+    while (stepped < 50'000) {
+      ticked.tick();
+      ++stepped;
+      if (at(ticked)) {
+        break;
+      }
+    }
+    checks.expect(executed == stepped && run.snapshot() == ticked.snapshot(),
+                  std::format("{:s}: run_until() pc {:d}", name, target));
+  }
+}
+
+// Holds one input low at a time, as a player pressing a key would, and
+// changes it between runs of random lengths, from none to a million. Only
+// ports A to C change: holding port D bits 4 to 6 low sends the baseball ROM
+// into INDF with fsr 0, which the emulator doesn't support.
+void randomise(pic1650::test::Checks &checks, const char *name,
+               const std::array<pic1650::OpCode, 512> &rom) {
+  pic1650::Emulator run{rom};
+  pic1650::Emulator ticked{rom};
+  std::mt19937 random{1650};
+  std::size_t port = 0;
+  std::size_t bit = 0;
+  std::uint64_t cycle = 0;
+  for (auto slice = 0; slice < 400; ++slice) {
+    const auto cycles = random() % (std::uint64_t{1} << (random() % 21u));
+    run.run(cycles);
+    for (std::uint64_t i = 0; i < cycles; ++i) {
+      ticked.tick();
+    }
+    cycle += cycles;
+    if (run.snapshot() != ticked.snapshot()) {
+      checks.expect(false, std::format("{:s}: run() to cycle {:d}, slice {:d}",
+                                       name, cycle, slice));
+      return;
+    }
+    for (auto *emulator : {&run, &ticked}) {
+      emulator->input(port, bit, true);
+    }
+    if (random() % 4u != 0u) {
+      port = random() % 3u;
+      bit = random() % 8u;
+      for (auto *emulator : {&run, &ticked}) {
+        emulator->input(port, bit, false);
+      }
+    }
+  }
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  try {
+    pic1650::test::Checks checks;
+    compare(checks, "tandybaseball", pic1650::test::read_rom(argc, argv));
+    for (const std::uint32_t seed : {1650u, 1654u, 1655u}) {
+      compare(checks, "random", pic1650::random_rom(seed));
+    }
+    randomise(checks, "tandybaseball", pic1650::test::read_rom(argc, argv));
+    randomise(checks, "delay loops", pic1650::test::delay_loop_rom());
+    return checks.result();
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+}
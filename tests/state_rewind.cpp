@@ -0,0 +1,54 @@
+// Checks that serialized states read back as they were written, and that
+// RewindBuffer puts the emulator back in the state a fresh run reaches at
+// the same cycle, with the same inputs changed on the way.
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <format>
+#include <iostream>
+#include <span>
+#include <stdexcept>
+
+#include "pic1650.hpp"
+#include "state.hpp"
+#include "check.hpp"
+
+int main(int argc, char *argv[]) {
+  try {
+    pic1650::test::Checks checks;
+    const auto rom = pic1650::test::read_rom(argc, argv);
+
+    pic1650::Emulator emulator{rom};
+    pic1650::RewindBuffer history{emulator, 64, 10'000};
+    pic1650::test::play(history, 400'000);
+    const auto state = emulator.snapshot();
+    const auto bytes = pic1650::serialize(state);
+    checks.expect(pic1650::deserialize(bytes) == state, "round trip");
+    auto versioned = bytes;
+    versioned[0] = std::byte{2};
+    for (const auto &wrong :
+         {std::span<const std::byte>{versioned},
+          std::span<const std::byte>{bytes}.first(std::size(bytes) - 1)}) {
+      try {
+        pic1650::deserialize(wrong);
+        checks.expect(false, "deserialize accepted a bad state");
+      } catch (const std::runtime_error &) {
+      }
+    }
+
+    for (const std::uint64_t target :
+         {399'999u, 390'000u, 385'432u, 360'001u, 200'000u}) {
+      history.rewind(target);
+      pic1650::Emulator fresh{rom};
+      pic1650::test::play(fresh, target);
+      checks.expect(emulator == fresh,
+                    std::format("rewound to cycle {:d}", target));
+    }
+    return checks.result();
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <istream>
+#include <ostream>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "pic1650.hpp"
+
+namespace pic1650 {
+
+// Binary traces are a 16 byte header followed by fixed-width TraceRecords,
+// stored exactly as they are laid out in memory on a little-endian host.
+static_assert(std::endian::native == std::endian::little);
+static_assert(std::is_trivially_copyable_v<TraceRecord>);
+static_assert(sizeof(TraceRecord) == 56);
+
+struct TraceHeader {
+  std::array<char, 8> magic{'P', 'I', 'C', '1', '6', '5', '0', 'T'};
+  std::uint32_t version{1};
+  std::uint32_t record_size{sizeof(TraceRecord)};
+};
+
+static_assert(sizeof(TraceHeader) == 16);
+
+// Writes trace records through a large buffer, only touching the stream when
+// the buffer fills up or on flush().
+class TraceWriter {
+private:
+  std::ostream &os;
+  std::vector<std::byte> buffer;
+  std::size_t used{};
+
+public:
+  static constexpr std::size_t default_buffer_size = 1u << 20;
+
+  explicit TraceWriter(std::ostream &os,
+                       const std::size_t buffer_size = default_buffer_size)
+      : os{os}, buffer(std::max(buffer_size, sizeof(TraceRecord))) {
+    const TraceHeader header{};
+    os.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  }
+
+  TraceWriter(const TraceWriter &) = delete;
+  TraceWriter &operator=(const TraceWriter &) = delete;
+
+  ~TraceWriter() { flush(); }
+
+  void write(const TraceRecord &record) {
+    if (std::size(buffer) - used < sizeof(record)) {
+      flush();
+    }
+    std::memcpy(std::data(buffer) + used, &record, sizeof(record));
+    used += sizeof(record);
+  }
+
+  void flush() {
+    os.write(reinterpret_cast<const char *>(std::data(buffer)),
+             static_cast<std::streamsize>(used));
+    os.flush();
+    used = 0;
+  }
+};
+
+// Reads the header shared by all trace formats, leaving the stream just past
+// it so the caller can pick a reader based on the magic.
+inline TraceHeader read_trace_header(std::istream &is) {
+  TraceHeader header{};
+  is.read(reinterpret_cast<char *>(&header), sizeof(header));
+  if (!is) {
+    throw std::runtime_error("not a trace");
+  }
+  return header;
+}
+
+// Reads the records written by TraceWriter
+class TraceReader {
+private:
+  std::istream &is;
+
+public:
+  explicit TraceReader(std::istream &is)
+      : TraceReader{is, read_trace_header(is)} {}
+
+  TraceReader(std::istream &is, const TraceHeader &header) : is{is} {
+    if (header.magic != TraceHeader{}.magic) {
+      throw std::runtime_error("not a binary trace");
+    }
+    if (header.version != TraceHeader{}.version ||
+        header.record_size != sizeof(TraceRecord)) {
+      throw std::runtime_error(
+          std::format("unsupported trace version {:d} with {:d} byte records",
+                      header.version, header.record_size));
+    }
+  }
+
+  // Reads up to std::size(records) records, returning how many were read
+  std::size_t read(std::span<TraceRecord> records) {
+    is.read(reinterpret_cast<char *>(std::data(records)),
+            static_cast<std::streamsize>(records.size_bytes()));
+    return static_cast<std::size_t>(is.gcount()) / sizeof(TraceRecord);
+  }
+
+  // Discards the next count records
+  void skip(const std::uint64_t count) {
+    is.ignore(static_cast<std::streamsize>(count * sizeof(TraceRecord)));
+  }
+};
+
+// Emulator that writes a binary trace instead of LoudEmulator's CSV
+class BinaryTraceEmulator final
+    : public BasicTracingEmulator<BinaryTraceEmulator> {
+private:
+  TraceWriter writer;
+
+public:
+  BinaryTraceEmulator(const std::array<OpCode, 512> &rom, std::ostream &os)
+      : BasicTracingEmulator{rom}, writer{os} {}
+
+  void record(const TraceRecord &record) { writer.write(record); }
+
+  void flush() { writer.flush(); }
+};
+
+} // namespace pic1650
@@ -0,0 +1,84 @@
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <exception>
+#include <format>
+#include <iostream>
+#include <limits>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+#include "delta_trace.hpp"
+#include "trace.hpp"
+
+namespace {
+
+std::uint64_t parse_count(const std::string_view text) {
+  std::uint64_t value{};
+  const auto [end, error] =
+      std::from_chars(std::data(text), std::data(text) + std::size(text), value);
+  if (error != std::errc{} || end != std::data(text) + std::size(text)) {
+    throw std::invalid_argument(std::format("bad count '{:s}'", text));
+  }
+  return value;
+}
+
+template <typename Reader>
+void convert(Reader &reader, std::uint64_t count) {
+  pic1650::CsvTraceFormatter formatter;
+  pic1650::CsvTraceFormatter::header(std::cout);
+  std::vector<pic1650::TraceRecord> records(4096);
+  while (count > 0) {
+    const auto n = reader.read(std::span{records}.first(
+        static_cast<std::size_t>(std::min<std::uint64_t>(std::size(records),
+                                                         count))));
+    if (n == 0) {
+      break;
+    }
+    for (auto i = 0uz; i < n; ++i) {
+      formatter.row(std::cout, records[i]);
+    }
+    count -= n;
+  }
+}
+
+} // namespace
+
+// Converts a binary or delta trace on stdin to CSV, optionally starting
+// --from a given tick and stopping after --count ticks.
+int main(int argc, char *argv[]) {
+  try {
+    std::ios::sync_with_stdio(false);
+    std::uint64_t from{};
+    auto count = std::numeric_limits<std::uint64_t>::max();
+    for (auto i = 1; i < argc; ++i) {
+      const std::string_view arg{argv[i]};
+      if (arg == "--from" && i + 1 < argc) {
+        from = parse_count(argv[++i]);
+      } else if (arg == "--count" && i + 1 < argc) {
+        count = parse_count(argv[++i]);
+      } else {
+        std::cerr << "usage: trace2csv [--from tick] [--count ticks] "
+                     "<game.trace >game.csv"
+                  << std::endl;
+        return 1;
+      }
+    }
+
+    const auto header = pic1650::read_trace_header(std::cin);
+    if (header.magic == pic1650::DeltaTraceHeader{}.trace.magic) {
+      pic1650::DeltaTraceReader reader{std::cin, header};
+      reader.seek(from);
+      convert(reader, count);
+    } else {
+      pic1650::TraceReader reader{std::cin, header};
+      reader.skip(from);
+      convert(reader, count);
+    }
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace pic1650 {
+
+// Runs task(index, worker) for every index below count on up to `threads`
+// threads. Each worker starts with an equal run of indices and takes work
+// from the front of its own run. When a worker runs out, it steals the back
+// half of the largest run left. Runs are packed into one atomic word each
+// (begin in the low half, end in the high half), so taking and stealing are
+// single compare-and-swaps. The first exception thrown by a task stops the
+// other workers and is rethrown once they have all finished.
+template <typename Task>
+void parallel_for(const std::size_t count, const std::size_t threads,
+                  Task task) {
+  if (count > std::numeric_limits<std::uint32_t>::max()) {
+    throw std::length_error("too many tasks for parallel_for");
+  }
+  const auto workers =
+      std::clamp<std::size_t>(threads, 1, std::max(count, 1uz));
+
+  const auto pack = [](const std::uint64_t begin, const std::uint64_t end) {
+    return begin | (end << 32);
+  };
+  const auto begin_of = [](const std::uint64_t run) {
+    return run & 0xffff'ffffu;
+  };
+  const auto end_of = [](const std::uint64_t run) { return run >> 32; };
+
+  const auto runs = std::make_unique<std::atomic<std::uint64_t>[]>(workers);
+  for (auto worker = 0uz; worker < workers; ++worker) {
+    runs[worker].store(pack(count * worker / workers,
+                            count * (worker + 1) / workers),
+                       std::memory_order_relaxed);
+  }
+
+  std::atomic<bool> failed{};
+  std::exception_ptr failure;
+
+  // Takes the next index from worker's own run, if there is one
+  const auto take = [&](const std::size_t worker, std::uint64_t &index) {
+    auto run = runs[worker].load(std::memory_order_acquire);
+    while (begin_of(run) < end_of(run)) {
+      if (runs[worker].compare_exchange_weak(
+              run, pack(begin_of(run) + 1, end_of(run)),
+              std::memory_order_acq_rel, std::memory_order_acquire)) {
+        index = begin_of(run);
+        return true;
+      }
+    }
+    return false;
+  };
+
+  // Moves the back half of the largest other run into worker's own run
+  const auto steal = [&](const std::size_t worker) {
+    while (true) {
+      auto victim = workers;
+      std::uint64_t largest = 0;
+      for (auto other = 0uz; other < workers; ++other) {
+        const auto run = runs[other].load(std::memory_order_relaxed);
+        const auto size = end_of(run) - std::min(begin_of(run), end_of(run));
+        if (other != worker && size > largest) {
+          largest = size;
+          victim = other;
+        }
+      }
+      if (victim == workers) {
+        return false;
+      }
+      auto run = runs[victim].load(std::memory_order_acquire);
+      if (begin_of(run) >= end_of(run)) {
+        continue;
+      }
+      const auto middle = begin_of(run) + (end_of(run) - begin_of(run)) / 2;
+      if (runs[victim].compare_exchange_strong(
+              run, pack(begin_of(run), middle), std::memory_order_acq_rel,
+              std::memory_order_acquire)) {
+        runs[worker].store(pack(middle, end_of(run)),
+                           std::memory_order_release);
+        return true;
+      }
+    }
+  };
+
+  const auto work = [&](const std::size_t worker) {
+    try {
+      std::uint64_t index;
+      while (!failed.load(std::memory_order_relaxed)) {
+        if (take(worker, index)) {
+          task(static_cast<std::size_t>(index), worker);
+        } else if (!steal(worker)) {
+          break;
+        }
+      }
+    } catch (...) {
+      if (!failed.exchange(true)) {
+        failure = std::current_exception();
+      }
+    }
+  };
+
+  std::vector<std::thread> pool;
+  for (auto worker = 1uz; worker < workers; ++worker) {
+    pool.emplace_back(work, worker);
+  }
+  work(0);
+  for (auto &thread : pool) {
+    thread.join();
+  }
+  if (failure) {
+    std::rethrow_exception(failure);
+  }
+}
+
+} // namespace pic1650